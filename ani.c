@@ -1,21 +1,79 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 
 #include "ani.h"
 #include "debug.h"
 
-typedef struct {
+struct ParseContext {
     FILE *file;
     size_t csize;
     char eof;
-} ParseContext;
+    char lazy_frames;
+    char recover;
+    char rejected;  // a payload does not fit the file or the budgets
+    char corrupt;   // a chunk size does not fit, the file is rejected unless recovering
+    size_t max_alloc;
+    size_t charged;  // bytes of payloads allocated
+    long end;       // end of RIFF payload, never beyond end of file
+    long list_end;  // end of the LIST being parsed
+    // Whole source, mapped on first resync
+    const uint8_t *image;
+    size_t image_size;
+    char image_mapped;
+};
 
 // Read exact bytes into buffer
 static int read_exact(ParseContext *ctx, void *buf, size_t n) {
     return fread(buf, 1, n, ctx->file) == n;
 }
 
+// Bytes charged by every parsed file alive, and the limit of it
+static atomic_size_t process_charged;
+static size_t process_budget;
+
+void ani_set_process_budget(size_t bytes) {
+    process_budget = bytes;
+}
+
+size_t ani_process_usage(void) {
+    return atomic_load(&process_charged);
+}
+
+// Charge `n` bytes to the file and the process, 0 if either budget would be exceeded
+static int charge(ParseContext *ctx, size_t n) {
+    if (ctx->max_alloc && n > ctx->max_alloc - ctx->charged) {
+        err("Payload of %zu bytes exceeds the file budget, %zu of %zu bytes are used",
+            n,
+            ctx->charged,
+            ctx->max_alloc);
+        return 0;
+    }
+    size_t used = atomic_load(&process_charged);
+    do {
+        if (process_budget && (used > process_budget || n > process_budget - used)) {
+            err("Payload of %zu bytes exceeds the process budget, %zu of %zu bytes are used",
+                n,
+                used,
+                process_budget);
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak(&process_charged, &used, used + n));
+    ctx->charged += n;
+    return 1;
+}
+
+static void release(size_t n) {
+    atomic_fetch_sub(&process_charged, n);
+}
+
+static uint32_t fourcc_of(const uint8_t *cid) {
+    return ANI_FOURCC(cid[0], cid[1], cid[2], cid[3]);
+}
+
 // Read a 32 byte int, little endian
 static uint32_t read_u32_le(ParseContext *ctx) {
     uint8_t b[4];
@@ -28,10 +86,99 @@ static int consume_bytes(ParseContext *ctx, size_t count) {
     return fseek(ctx->file, count, SEEK_CUR);
 }
 
-static ChunkAnih *parse_anih(ParseContext *ctx) {
+// Map the source so it can be scanned, a heap copy is used if it has no fd
+static const uint8_t *map_source(ParseContext *ctx) {
+    if (ctx->image) {
+        return ctx->image;
+    }
+    long pos = ftell(ctx->file);
+    fseek(ctx->file, 0, SEEK_END);
+    long size = ftell(ctx->file);
+    fseek(ctx->file, pos, SEEK_SET);
+    if (size <= 0) {
+        return NULL;
+    }
+    int fd = fileno(ctx->file);
+    if (fd >= 0) {
+        void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            ctx->image = p;
+            ctx->image_size = size;
+            ctx->image_mapped = 1;
+            return ctx->image;
+        }
+    }
+    uint8_t *buf = malloc(size);
+    if (!buf) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    fseek(ctx->file, 0, SEEK_SET);
+    if (!read_exact(ctx, buf, size)) {
+        free(buf);
+        fseek(ctx->file, pos, SEEK_SET);
+        return NULL;
+    }
+    fseek(ctx->file, pos, SEEK_SET);
+    ctx->image = buf;
+    ctx->image_size = size;
+    return ctx->image;
+}
+
+static void unmap_source(ParseContext *ctx) {
+    if (!ctx->image) {
+        return;
+    }
+    if (ctx->image_mapped) {
+        munmap((void *)ctx->image, ctx->image_size);
+    } else {
+        free((void *)ctx->image);
+    }
+    ctx->image = NULL;
+}
+
+// Find the first offset in [from, bound) holding one of `cids` whose declared size fits in bound.
+// Every cid keeps the position of its next leading byte found by memchr, so the scan runs at
+// memchr speed and each candidate is examined only once. Returns -1 if there is none
+static long resync(ParseContext *ctx, long from, long bound, const char *const *cids, int n) {
+    const uint8_t *image = map_source(ctx);
+    if (!image) {
+        return -1;
+    }
+    if (bound > (long)ctx->image_size) {
+        bound = ctx->image_size;
+    }
+    const uint8_t *next[8];
+    assert(n <= 8);
+    for (int k = 0; k < n; ++k) {
+        next[k] = from < bound ? memchr(image + from, cids[k][0], bound - from) : NULL;
+    }
+    while (1) {
+        int best = -1;
+        for (int k = 0; k < n; ++k) {
+            if (next[k] && (best < 0 || next[k] < next[best])) {
+                best = k;
+            }
+        }
+        if (best < 0) {
+            return -1;
+        }
+        const uint8_t *p = next[best];
+        long pos = p - image;
+        if (pos + 8 <= bound && !memcmp(p, cids[best], 4)) {
+            uint32_t size = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+            if (size <= bound - pos - 8) {
+                return pos;
+            }
+        }
+        next[best] = pos + 1 < bound ? memchr(p + 1, cids[best][0], bound - pos - 1) : NULL;
+    }
+}
+
+static void *parse_anih(ParseContext *ctx, void *user) {
     if (ctx->csize < 36) {
         err("anih chunk too small (%u)", ctx->csize);
-        consume_bytes(ctx, ctx->csize + (ctx->csize & 1));
+        return NULL;
     }
     // Consume anih chunk
     uint8_t anih_buf[36];
@@ -69,47 +216,40 @@ static ChunkAnih *parse_anih(ParseContext *ctx) {
         anih->cPlanes,
         anih->jifRate,
         anih->flags);
-    // skip remaining of anih chunk if any
-    if (ctx->csize > 36) {
-        consume_bytes(ctx, ctx->csize - 36);
-    }
-    if (ctx->csize & 1) {
-        consume_bytes(ctx, 1);
-    }
     return anih;
 }
 
-static void cleanup_anih(ChunkAnih *c) {
+static void cleanup_anih(void *inner, void *user) {
+    ChunkAnih *c = inner;
     if (!c) {
         return;
     }
     free(c);
 }
 
-static ChunkSeq *parse_seq(ParseContext *ctx) {
+static void *parse_seq(ParseContext *ctx, void *user) {
     ChunkSeq *seq = malloc(sizeof(ChunkSeq));
     if (!seq) {
         err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
         return NULL;
     }
     seq->count = ctx->csize / 4;
-    seq->indexes = malloc(seq->count * sizeof(unsigned));
+    seq->indexes = ani_alloc(ctx, seq->count * sizeof(unsigned));
     if (!seq->indexes) {
-        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(seq);
         return NULL;
     }
     info(" seq: %u entries", seq->count);
     for (uint32_t i = 0; i < seq->count; i++) {
         uint32_t v = read_u32_le(ctx);
         info("  seq[%u] = %u", i, v);
-    }
-    if (ctx->csize & 1) {
-        consume_bytes(ctx, 1);
+        seq->indexes[i] = v;
     }
     return seq;
 }
 
-static void cleanup_seq(ChunkSeq *c) {
+static void cleanup_seq(void *inner, void *user) {
+    ChunkSeq *c = inner;
     if (!c) {
         return;
     }
@@ -117,17 +257,16 @@ static void cleanup_seq(ChunkSeq *c) {
     free(c);
 }
 
-static ChunkRate *parse_rate(ParseContext *ctx) {
+static void *parse_rate(ParseContext *ctx, void *user) {
     ChunkRate *rate = malloc(sizeof(ChunkRate));
     if (!rate) {
         err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
         return NULL;
     }
     rate->count = ctx->csize / 4;
-    rate->jiffies = malloc(rate->count * sizeof(unsigned));
+    rate->jiffies = ani_alloc(ctx, rate->count * sizeof(unsigned));
     if (!rate->jiffies) {
         free(rate);
-        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
         return NULL;
     }
     info(" rate: %u entries", rate->count);
@@ -136,13 +275,11 @@ static ChunkRate *parse_rate(ParseContext *ctx) {
         info("  rate[%u] = %u jiffies (%.3f s)", i, v, v / 60.0);
         rate->jiffies[i] = v;
     }
-    if (ctx->csize & 1) {
-        consume_bytes(ctx, 1);
-    }
     return rate;
 }
 
-static void cleanup_rate(ChunkRate *c) {
+static void cleanup_rate(void *inner, void *user) {
+    ChunkRate *c = inner;
     if (!c) {
         return;
     }
@@ -153,19 +290,54 @@ static void cleanup_rate(ChunkRate *c) {
 }
 
 static Frame *parse_frame(ParseContext *ctx) {
-    char subid[5] = {0};
-    if (!read_exact(ctx, subid, 4)) {
+    long pos = ftell(ctx->file);
+    uint8_t subid[4];
+    if (pos + 8 > ctx->list_end || !read_exact(ctx, subid, 4)) {
         ctx->eof = 1;
         return NULL;
     }
     uint32_t subsize = read_u32_le(ctx);
     info("  subchunk '%.4s' size=%u", subid, subsize);
+    if (subsize > ctx->list_end - pos - 8) {
+        long next = -1;
+        if (ctx->recover) {
+            static const char *const cids[] = {"icon"};
+            next = resync(ctx, pos + 1, ctx->list_end, cids, 1);
+        }
+        if (next < 0) {
+            err("subchunk '%.4s' at offset %ld exceeds LIST bound, drop the rest", subid, pos);
+            ctx->corrupt = !ctx->recover;
+            fseek(ctx->file, ctx->list_end, SEEK_SET);
+        } else {
+            warn("subchunk '%.4s' at offset %ld is corrupt, resync at offset %ld", subid, pos, next);
+            fseek(ctx->file, next, SEEK_SET);
+        }
+        return NULL;
+    }
     Frame *frame = NULL;
-    if (strncmp(subid, "icon", 4) == 0) {
+    char is_icon = fourcc_of(subid) == ANI_FOURCC('i', 'c', 'o', 'n');
+    if (is_icon && ctx->lazy_frames) {
+        // Only the record is allocated, yet a file of many tiny frames must not slip the budgets
+        if (!charge(ctx, sizeof(Frame))) {
+            ctx->rejected = 1;
+            return NULL;
+        }
+        frame = malloc(sizeof(Frame));
+        if (!frame) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            ctx->rejected = 1;
+            return NULL;
+        }
+        frame->size = subsize;
+        frame->off = ftell(ctx->file);
+        frame->buffer = NULL;
+        consume_bytes(ctx, subsize);
+    } else if (is_icon) {
         // read icon data
-        uint8_t *buf = malloc(subsize);
+        long off = ftell(ctx->file);
+        uint8_t *buf = ani_alloc(ctx, subsize);
         if (!buf) {
-            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            // The file is rejected, no frame is dropped silently
             return NULL;
         }
         if (!read_exact(ctx, buf, subsize)) {
@@ -176,10 +348,12 @@ static Frame *parse_frame(ParseContext *ctx) {
         frame = malloc(sizeof(Frame));
         if (!frame) {
             err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            ctx->rejected = 1;
             free(buf);
             return NULL;
         }
         frame->size = subsize;
+        frame->off = off;
         frame->buffer = buf;
     } else {
         // skip subchunk data
@@ -201,7 +375,8 @@ static void cleanup_frame(Frame *f) {
     free(f);
 }
 
-static void cleanup_list(ChunkList *c) {
+static void cleanup_list(void *inner, void *user) {
+    ChunkList *c = inner;
     if (!c) {
         return;
     }
@@ -214,79 +389,201 @@ static void cleanup_list(ChunkList *c) {
     free(c);
 }
 
-static ChunkList *parse_list(ParseContext *ctx) {
-    // LIST chunk has a 4-byte list-type then subchunks
-    char listtype[5] = {0};
-    if (!read_exact(ctx, listtype, 4)) {
-        ctx->eof = 1;
+// Parse hotspot from the ICONDIR header of a frame, i.e. the 1st ICONDIRENTRY of a cursor
+static void parse_hotspot(ParseContext *ctx, const Frame *frame, ChunkList *list) {
+    uint8_t head[14];
+    const uint8_t *buf = frame->buffer;
+    list->hotx = 0;
+    list->hoty = 0;
+    if (frame->size < sizeof(head)) {
+        return;
+    }
+    if (!buf) {
+        // Frame is not loaded, peek at its header
+        long pos = ftell(ctx->file);
+        fseek(ctx->file, frame->off, SEEK_SET);
+        int ok = read_exact(ctx, head, sizeof(head));
+        fseek(ctx->file, pos, SEEK_SET);
+        if (!ok) {
+            return;
+        }
+        buf = head;
+    }
+    uint16_t type = buf[2] | (buf[3] << 8);
+    if (type == 2) {
+        list->hotx = buf[10] | (buf[11] << 8);
+        list->hoty = buf[12] | (buf[13] << 8);
+    }
+}
+
+// LIST fram: series of 'icon' chunks
+static void *parse_fram(ParseContext *ctx, void *user) {
+    long list_end = ctx->list_end;
+    ChunkList *list = malloc(sizeof(ChunkList));
+    if (!list) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
         return NULL;
     }
-    uint32_t list_payload = ctx->csize - 4;
-    info(" LIST type='%.4s' payload=%u", listtype, list_payload);
-    long list_end = ftell(ctx->file) + list_payload;
-    ChunkList *list = NULL;
-    if (strncmp(listtype, "fram", 4) == 0) {
-        list = malloc(sizeof(ChunkList));
-        if (!list) {
-            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-            return NULL;
+    size_t capacitty = 4;
+    list->count = 0;
+    list->hotx = 0;
+    list->hoty = 0;
+    list->frames = malloc(capacitty * sizeof(Frame *));
+    if (!list->frames) {
+        free(list);
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    unsigned icon_count = 0;
+    while (ftell(ctx->file) < list_end) {
+        Frame *frame = parse_frame(ctx);
+        if (ctx->eof) {
+            // Truncated inside the list, keep what is parsed
+            ctx->eof = 0;
+            fseek(ctx->file, list_end, SEEK_SET);
         }
-        size_t capacitty = 4;
-        list->count = 0;
-        list->frames = malloc(capacitty * sizeof(Frame *));
-        if (!list->frames) {
-            free(list);
-            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-            return NULL;
+        if (ctx->rejected) {
+            break;
         }
-        // inside fram: series of 'icon' chunks
-        unsigned icon_count = 0;
-        while (ftell(ctx->file) < list_end) {
-            Frame *frame = parse_frame(ctx);
-            if (!frame) {
-                continue;
-            }
-            if (icon_count == 0) {
-                // Parse hotspot, in 1st frame
-                uint8_t *buf = frame->buffer;
-                uint16_t type = buf[2] | (buf[3] << 8);
-                if (type == 2) {
-                    list->hotx = buf[10] | (buf[11] << 8);
-                    list->hoty = buf[12] | (buf[13] << 8);
-                } else {
-                    list->hotx = 0;
-                    list->hoty = 0;
-                }
-            }
-            if (list->count + 1 > capacitty) {
-                capacitty <<= 1;
-                Frame **tmp = realloc(list->frames, capacitty * sizeof(Frame *));
-                if (!tmp) {
-                    cleanup_list(list);
-                    return NULL;
-                }
-                list->frames = tmp;
+        if (!frame) {
+            continue;
+        }
+        if (icon_count == 0) {
+            parse_hotspot(ctx, frame, list);
+        }
+        if (list->count + 1 > capacitty) {
+            capacitty <<= 1;
+            Frame **tmp = realloc(list->frames, capacitty * sizeof(Frame *));
+            if (!tmp) {
+                err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+                ctx->rejected = 1;
+                cleanup_frame(frame);
+                cleanup_list(list, user);
+                return NULL;
             }
-            icon_count++;
-            list->frames[list->count++] = frame;
+            list->frames = tmp;
         }
-        info("Done. Extracted %d icon chunks.", icon_count);
-    } else {
-        // skip entire list
-        consume_bytes(ctx, list_payload);
-    }
-    if (ctx->csize & 1) {
-        consume_bytes(ctx, 1);
+        icon_count++;
+        list->frames[list->count++] = frame;
     }
+    info("Done. Extracted %d icon chunks.", icon_count);
     return list;
 }
 
+static void visit_fram(const Chunk *chunk, const WalkContext *ctx) {
+    debug(" Hit chunk list");
+    const ChunkList *list = chunk->inner;
+    if (ctx->visit_frame) {
+        for (unsigned j = 0; j < list->count; ++j) {
+            debug("  Visit frame `%d`", j);
+            ctx->visit_frame(list->frames[j], ctx->data);
+        }
+    }
+}
+
+// Handlers are looked up in open addressing tables keyed by FourCC, one for chunk ids and
+// one for LIST types. A chunk nobody handles usually costs a single compare with an empty slot
+#define HANDLER_SLOTS 64
+
+typedef struct {
+    ChunkHandler handler;
+    char used;
+} HandlerSlot;
+
+static HandlerSlot chunk_handlers[HANDLER_SLOTS];
+static HandlerSlot list_handlers[HANDLER_SLOTS];
+
+static unsigned handler_slot(uint32_t fourcc) {
+    return (fourcc * 0x9E3779B1u) >> 26;
+}
+
+static const ChunkHandler *lookup_handler(const HandlerSlot *table, uint32_t fourcc) {
+    unsigned i = handler_slot(fourcc);
+    for (unsigned n = 0; n < HANDLER_SLOTS && table[i].used; ++n, i = (i + 1) % HANDLER_SLOTS) {
+        if (table[i].handler.fourcc == fourcc) {
+            return &table[i].handler;
+        }
+    }
+    return NULL;
+}
+
+// Register a handler, a handler with the same FourCC is replaced. One slot always stays empty,
+// so a probe for a FourCC nobody handles stops there.
+// Not thread safe, register before parsing anything
+int ani_register_handler(const ChunkHandler *handler) {
+    HandlerSlot *table = handler->list ? list_handlers : chunk_handlers;
+    ChunkHandler *old = (ChunkHandler *)lookup_handler(table, handler->fourcc);
+    if (old) {
+        *old = *handler;
+        return 0;
+    }
+    unsigned used = 0;
+    for (unsigned n = 0; n < HANDLER_SLOTS; ++n) {
+        used += table[n].used;
+    }
+    if (used + 1 >= HANDLER_SLOTS) {
+        err("Too many chunk handlers");
+        return 1;
+    }
+    unsigned i = handler_slot(handler->fourcc);
+    while (table[i].used) {
+        i = (i + 1) % HANDLER_SLOTS;
+    }
+    table[i].handler = *handler;
+    table[i].used = 1;
+    return 0;
+}
+
+const ChunkHandler *ani_find_handler(uint32_t fourcc, char list) {
+    return lookup_handler(list ? list_handlers : chunk_handlers, fourcc);
+}
+
+__attribute__((constructor)) static void register_builtin_handlers(void) {
+    static const ChunkHandler builtin[] = {
+        {ANI_FOURCC('a', 'n', 'i', 'h'), 0, ty_anih, parse_anih, cleanup_anih, NULL, NULL},
+        {ANI_FOURCC('s', 'e', 'q', ' '), 0, ty_seq, parse_seq, cleanup_seq, NULL, NULL},
+        {ANI_FOURCC('r', 'a', 't', 'e'), 0, ty_rate, parse_rate, cleanup_rate, NULL, NULL},
+        {ANI_FOURCC('f', 'r', 'a', 'm'), 1, ty_list, parse_fram, cleanup_list, visit_fram, NULL},
+    };
+    for (unsigned i = 0; i < sizeof(builtin) / sizeof(builtin[0]); ++i) {
+        ani_register_handler(&builtin[i]);
+    }
+}
+
+uint32_t ani_chunk_size(const ParseContext *ctx) {
+    return ctx->csize;
+}
+
+int ani_read(ParseContext *ctx, void *buf, size_t n) {
+    return read_exact(ctx, buf, n);
+}
+
+void *ani_alloc(ParseContext *ctx, size_t n) {
+    // A declared size is only trusted as far as the file can back it
+    long pos = ftell(ctx->file);
+    if (pos < 0 || n > (size_t)(ctx->end - pos)) {
+        err("Payload of %zu bytes at offset %ld exceeds the end of file", n, pos);
+        ctx->rejected = 1;
+        return NULL;
+    }
+    if (!charge(ctx, n)) {
+        ctx->rejected = 1;
+        return NULL;
+    }
+    void *buf = malloc(n ? n : 1);
+    if (!buf) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        ctx->rejected = 1;
+    }
+    return buf;
+}
+
 static Chunk *parse_chunk(ParseContext *ctx) {
     long pos = ftell(ctx->file);
 
     // Read cid
-    char cid[5] = {0};
-    if (!read_exact(ctx, cid, 4)) {
+    uint8_t cid[4];
+    if (pos + 8 > ctx->end || !read_exact(ctx, cid, 4)) {
         ctx->eof = 1;
         return NULL;
     }
@@ -295,74 +592,93 @@ static Chunk *parse_chunk(ParseContext *ctx) {
         ctx->eof = 1;
         return NULL;
     }
+    uint32_t fourcc = fourcc_of(cid);
     info("Chunk '%.4s' size=%u at offset %ld", cid, ctx->csize, pos);
 
-    Chunk *chunk = malloc(sizeof(Chunk));
-    chunk->size = ctx->csize;
-    chunk->off = pos;
-#define is_cid(CID) !strncmp(cid, CID, 4)
-    if (is_cid("anih")) {
-        chunk->ty = ty_anih;
-        chunk->inner = parse_anih(ctx);
-        if (!chunk->inner) {
-            free(chunk);
-            err("Cannot parse anih");
-            chunk = NULL;
-        }
-    } else if (is_cid("seq ")) {
-        chunk->ty = ty_seq;
-        chunk->inner = parse_seq(ctx);
-        if (!chunk->inner) {
-            free(chunk);
-            err("Cannot parse seq");
-            chunk = NULL;
-        }
-    } else if (is_cid("rate")) {
-        // rate chunk: array of DWORDs
-        chunk->ty = ty_rate;
-        chunk->inner = parse_rate(ctx);
-        if (!chunk->inner) {
-            free(chunk);
-            err("Cannot parse rate");
-            chunk = NULL;
-        }
-    } else if (is_cid("LIST")) {
-        chunk->ty = ty_list;
-        chunk->inner = parse_list(ctx);
-        if (!chunk->inner) {
-            free(chunk);
-            err("Cannot parse list");
-            chunk = NULL;
+    // Check size against RIFF bound, a garbage cid means the previous size was wrong
+    char bad_cid = !isprint(cid[0]) || !isprint(cid[1]) || !isprint(cid[2]) || !isprint(cid[3]);
+    if (ctx->csize > ctx->end - pos - 8 || (ctx->recover && bad_cid)) {
+        if (ctx->recover && fourcc == ANI_FOURCC('L', 'I', 'S', 'T')) {
+            // Truncated file, frames that are complete can still be parsed
+            warn("LIST at offset %ld is truncated to %ld bytes", pos, ctx->end - pos - 8);
+            ctx->csize = ctx->end - pos - 8;
+        } else if (!ctx->recover) {
+            err("Chunk '%.4s' at offset %ld exceeds RIFF bound", cid, pos);
+            ctx->corrupt = 1;
+            ctx->eof = 1;
+            return NULL;
+        } else {
+            static const char *const cids[] = {"anih", "rate", "seq ", "LIST"};
+            long next = resync(ctx, pos + 1, ctx->end, cids, 4);
+            if (next < 0) {
+                err("Chunk '%.4s' at offset %ld is corrupt, no chunk to resync", cid, pos);
+                ctx->eof = 1;
+                return NULL;
+            }
+            warn("Chunk '%.4s' at offset %ld is corrupt, resync at offset %ld", cid, pos, next);
+            fseek(ctx->file, next, SEEK_SET);
+            return NULL;
+        }
+    }
+    long chunk_end = pos + 8 + ctx->csize + (ctx->csize & 1);
+    size_t chunk_size = ctx->csize;
+
+    const ChunkHandler *handler = NULL;
+    if (fourcc == ANI_FOURCC('L', 'I', 'S', 'T')) {
+        // LIST chunk has a 4-byte list-type then subchunks
+        uint8_t listtype[4];
+        if (ctx->csize < 4 || !read_exact(ctx, listtype, 4)) {
+            err("LIST chunk too small (%u)", ctx->csize);
+        } else {
+            fourcc = fourcc_of(listtype);
+            ctx->csize -= 4;
+            ctx->list_end = pos + 12 + ctx->csize;
+            info(" LIST type='%.4s' payload=%u", listtype, ctx->csize);
+            handler = lookup_handler(list_handlers, fourcc);
         }
     } else {
-        // Not interested in, skip
-        consume_bytes(ctx, ctx->csize);
-        if (ctx->csize & 1) {
-            consume_bytes(ctx, 1);
+        handler = lookup_handler(chunk_handlers, fourcc);
+    }
+
+    Chunk *chunk = NULL;
+    void *inner = handler ? handler->parse(ctx, handler->user) : NULL;
+    if (inner) {
+        chunk = malloc(sizeof(Chunk));
+        if (!chunk) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            handler->cleanup(inner, handler->user);
+        } else {
+            chunk->size = chunk_size;
+            chunk->off = pos;
+            chunk->ty = handler->ty;
+            chunk->fourcc = fourcc;
+            chunk->handler = handler;
+            chunk->inner = inner;
         }
-        free(chunk);
-        chunk = NULL;
+    } else if (handler) {
+        err("Cannot parse chunk at offset %ld", pos);
+    }
+    // Not interested in, or handler did not consume all of it
+    if (ftell(ctx->file) != chunk_end) {
+        fseek(ctx->file, chunk_end, SEEK_SET);
     }
-#undef is_cid
     return chunk;
 }
 
-static void cleanup_chunk(Chunk *c) {
+void cleanup_chunk(Chunk *c) {
     if (!c) {
         return;
     }
-    switch (c->ty) {
-        case ty_anih: cleanup_anih(c->inner); break;
-        case ty_seq: cleanup_seq(c->inner); break;
-        case ty_rate: cleanup_rate(c->inner); break;
-        case ty_list: cleanup_list(c->inner); break;
-        default: assert(0);
-    }
+    c->handler->cleanup(c->inner, c->handler->user);
     free(c);
 }
 
 // Parse a file
 AniFile *parse_ani(FILE *file) {
+    return parse_ani_ex(file, NULL);
+}
+
+AniFile *parse_ani_ex(FILE *file, const ParseOptions *opts) {
     AniFile *ani = malloc(sizeof(AniFile));
     if (!ani) {
         err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
@@ -370,6 +686,7 @@ AniFile *parse_ani(FILE *file) {
     }
     unsigned capacity = 4;
     ani->chunk_count = 0;
+    ani->charged = 0;
     ani->chunks = malloc(capacity * sizeof(Chunk *));
     if (!ani->chunks) {
         err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
@@ -381,6 +698,15 @@ AniFile *parse_ani(FILE *file) {
     ParseContext ctx;
     ctx.file = file;
     ctx.eof = 0;
+    ctx.lazy_frames = opts ? opts->lazy_frames : 0;
+    ctx.recover = opts ? opts->recover : 0;
+    ctx.rejected = 0;
+    ctx.corrupt = 0;
+    ctx.max_alloc = opts ? opts->max_alloc : 0;
+    ctx.charged = 0;
+    ctx.image = NULL;
+    ctx.image_size = 0;
+    ctx.image_mapped = 0;
 
     // Read RIFF header
     char riff_tag[5] = {0}, acon_tag[5] = {0};
@@ -404,19 +730,39 @@ AniFile *parse_ani(FILE *file) {
     }
     info("RIFF ACON detected, size=%u", riff_size);
 
+    // Sizes are checked against the RIFF payload, or the file if it is truncated
+    long payload_pos = ftell(file);
+    fseek(file, 0, SEEK_END);
+    ctx.end = ftell(file);
+    fseek(file, payload_pos, SEEK_SET);
+    if (riff_size >= 4 && (long)riff_size + 8 < ctx.end) {
+        ctx.end = (long)riff_size + 8;
+    }
+    ctx.list_end = ctx.end;
+
     // Parse chunks
     while (1) {
         Chunk *chunk = parse_chunk(&ctx);
-        if (ctx.eof) {
-            break;
+        ani->charged = ctx.charged;
+        if (ctx.rejected) {
+            err("File is rejected");
+            unmap_source(&ctx);
+            cleanup_chunk(chunk);
+            cleanup_ani(ani);
+            return NULL;
         }
         if (!chunk) {
+            if (ctx.eof) {
+                break;
+            }
             continue;
         }
         if (ani->chunk_count + 1 > capacity) {
             capacity <<= 1;
             Chunk **tmp = realloc(ani->chunks, capacity * sizeof(Chunk *));
             if (!tmp) {
+                unmap_source(&ctx);
+                cleanup_chunk(chunk);
                 cleanup_ani(ani);
                 return NULL;
             };
@@ -425,6 +771,12 @@ AniFile *parse_ani(FILE *file) {
         ani->chunks[ani->chunk_count++] = chunk;
     }
 
+    unmap_source(&ctx);
+    if (ctx.corrupt) {
+        err("File is corrupt, parse it with `recover` to keep the chunks that are intact");
+        cleanup_ani(ani);
+        return NULL;
+    }
     return ani;
 }
 
@@ -434,6 +786,7 @@ void cleanup_ani(AniFile *ani) {
             cleanup_chunk(ani->chunks[i]);
         }
         free(ani->chunks);
+        release(ani->charged);
         free(ani);
     }
 }
@@ -441,18 +794,147 @@ void cleanup_ani(AniFile *ani) {
 void walk(const WalkContext *ctx) {
     for (unsigned i = 0; i < ctx->ani->chunk_count; ++i) {
         debug("Visit chunk `%d`", i);
+        const Chunk *chunk = ctx->ani->chunks[i];
         if (ctx->visit_chunk) {
-            ctx->visit_chunk(ctx->ani->chunks[i], ctx->data);
-        }
-        if (ctx->ani->chunks[i]->ty == ty_list) {
-            debug(" Hit chunk list");
-            ChunkList *list = (ChunkList *)ctx->ani->chunks[i]->inner;
-            if (ctx->visit_frame) {
-                for (unsigned j = 0; j < list->count; ++j) {
-                    debug("  Visit frame `%d`", j);
-                    ctx->visit_frame(list->frames[j], ctx->data);
+            ctx->visit_chunk(chunk, ctx->data);
+        }
+        if (chunk->handler->visit) {
+            chunk->handler->visit(chunk, ctx);
+        }
+    }
+}
+
+// Write a 32 byte int, little endian
+static int write_u32_le(FILE *out, uint32_t v) {
+    uint8_t b[4] = {v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, (v >> 24) & 0xFF};
+    return fwrite(b, 1, 4, out) == 4;
+}
+
+static int write_chunk_header(FILE *out, const char *cid, uint32_t size) {
+    return fwrite(cid, 1, 4, out) == 4 && write_u32_le(out, size);
+}
+
+static int write_pad(FILE *out, uint32_t size) {
+    if (size & 1) {
+        return fputc(0, out) != EOF;
+    }
+    return 1;
+}
+
+// Payload size of a chunk as it will be serialized, without header and pad byte
+static uint32_t chunk_payload_size(const Chunk *c) {
+    switch (c->ty) {
+        case ty_anih: return 36;
+        case ty_seq: return ((ChunkSeq *)c->inner)->count * 4;
+        case ty_rate: return ((ChunkRate *)c->inner)->count * 4;
+        case ty_list: {
+            ChunkList *list = c->inner;
+            uint32_t size = 4;
+            for (unsigned i = 0; i < list->count; ++i) {
+                size += 8 + list->frames[i]->size + (list->frames[i]->size & 1);
+            }
+            return size;
+        }
+        default: assert(0);
+    }
+    return 0;
+}
+
+static int write_chunk(FILE *out, const Chunk *c) {
+    uint32_t size = chunk_payload_size(c);
+    switch (c->ty) {
+        case ty_anih: {
+            ChunkAnih *anih = c->inner;
+            uint32_t fields[9] = {anih->cbSize,
+                                  anih->cFrames,
+                                  anih->cSteps,
+                                  anih->cx,
+                                  anih->cy,
+                                  anih->cBitCount,
+                                  anih->cPlanes,
+                                  anih->jifRate,
+                                  anih->flags};
+            if (!write_chunk_header(out, "anih", size)) {
+                return 1;
+            }
+            for (int i = 0; i < 9; ++i) {
+                if (!write_u32_le(out, fields[i])) {
+                    return 1;
                 }
             }
+            break;
+        }
+        case ty_seq: {
+            ChunkSeq *seq = c->inner;
+            if (!write_chunk_header(out, "seq ", size)) {
+                return 1;
+            }
+            for (unsigned i = 0; i < seq->count; ++i) {
+                if (!write_u32_le(out, seq->indexes[i])) {
+                    return 1;
+                }
+            }
+            break;
+        }
+        case ty_rate: {
+            ChunkRate *rate = c->inner;
+            if (!write_chunk_header(out, "rate", size)) {
+                return 1;
+            }
+            for (unsigned i = 0; i < rate->count; ++i) {
+                if (!write_u32_le(out, rate->jiffies[i])) {
+                    return 1;
+                }
+            }
+            break;
+        }
+        case ty_list: {
+            ChunkList *list = c->inner;
+            if (!write_chunk_header(out, "LIST", size) || fwrite("fram", 1, 4, out) != 4) {
+                return 1;
+            }
+            for (unsigned i = 0; i < list->count; ++i) {
+                Frame *frame = list->frames[i];
+                if (!frame->buffer) {
+                    err("frame `%u` is not loaded", i);
+                    return 1;
+                }
+                if (!write_chunk_header(out, "icon", frame->size) ||
+                    fwrite(frame->buffer, 1, frame->size, out) != frame->size ||
+                    !write_pad(out, frame->size)) {
+                    return 1;
+                }
+            }
+            break;
+        }
+        default: assert(0);
+    }
+    return !write_pad(out, size);
+}
+
+// Serialize a file, chunks are written in model order, custom chunks are dropped
+int write_ani(const AniFile *ani, FILE *out) {
+    uint32_t riff_size = 4;
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        if (ani->chunks[i]->ty == ty_custom) {
+            continue;
+        }
+        uint32_t size = chunk_payload_size(ani->chunks[i]);
+        riff_size += 8 + size + (size & 1);
+    }
+    if (!write_chunk_header(out, "RIFF", riff_size) || fwrite("ACON", 1, 4, out) != 4) {
+        err("write RIFF header fail");
+        return 1;
+    }
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        if (ani->chunks[i]->ty == ty_custom) {
+            // Owned by a registered handler, unknown how to serialize
+            continue;
+        }
+        if (write_chunk(out, ani->chunks[i])) {
+            err("write chunk `%u` fail", i);
+            return 1;
         }
     }
+    return 0;
 }
@@ -3,8 +3,16 @@
 #include <stdio.h>
 #include <stdint.h>
 
-// Interested chunk type
-enum ChunkType { ty_anih, ty_seq, ty_rate, ty_list };
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Interested chunk type, chunks parsed by registered handlers are `ty_custom`
+enum ChunkType { ty_anih, ty_seq, ty_rate, ty_list, ty_custom };
+
+#define ANI_FOURCC(a, b, c, d)                                                              \
+    ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16) | \
+     ((uint32_t)(uint8_t)(d) << 24))
 
 typedef struct {
     uint32_t cbSize;
@@ -30,7 +38,8 @@ typedef struct {
 
 typedef struct {
     size_t size;
-    void *buffer;
+    long off;      // offset of payload in source file
+    void *buffer;  // NULL if parsed with `lazy_frames`
 } Frame;
 
 typedef struct {
@@ -40,16 +49,21 @@ typedef struct {
     Frame **frames;
 } ChunkList;
 
+typedef struct ChunkHandler ChunkHandler;
+
 typedef struct {
     unsigned size;
     unsigned off;
     enum ChunkType ty;
+    uint32_t fourcc;  // chunk id, or list type of a LIST
+    const ChunkHandler *handler;
     void *inner;
 } Chunk;
 
 typedef struct {
     unsigned chunk_count;
     Chunk **chunks;
+    size_t charged;  // bytes charged to the process budget, given back by `cleanup_ani`
 } AniFile;
 
 typedef void (*VisitChunkCallback)(const Chunk *, void *);
@@ -65,6 +79,66 @@ typedef struct {
 
 void walk(const WalkContext *ctx);
 
+typedef struct ParseContext ParseContext;
+
+// Parse payload of a chunk, NULL drops the chunk. The stream is moved to the end of the
+// chunk afterwards, so a handler may leave part of it unread
+typedef void *(*ParseChunkCallback)(ParseContext *ctx, void *user);
+
+typedef void (*CleanupChunkCallback)(void *inner, void *user);
+
+// Called by `walk` after `visit_chunk`
+typedef void (*VisitHandlerCallback)(const Chunk *chunk, const WalkContext *ctx);
+
+struct ChunkHandler {
+    uint32_t fourcc;  // ANI_FOURCC of chunk id, or of list type if `list` is set
+    char list;        // handles `LIST <fourcc>`, e.g. LIST INFO
+    enum ChunkType ty;
+    ParseChunkCallback parse;
+    CleanupChunkCallback cleanup;
+    VisitHandlerCallback visit;
+    void *user;
+};
+
+int ani_register_handler(const ChunkHandler *handler);
+
+// Handler of a chunk id, or of a list type if `list` is set, NULL if there is none
+const ChunkHandler *ani_find_handler(uint32_t fourcc, char list);
+
+// Payload size of the chunk being parsed, the list type is excluded for LIST
+uint32_t ani_chunk_size(const ParseContext *ctx);
+
+// Read exact bytes of the chunk being parsed, 1 on success
+int ani_read(ParseContext *ctx, void *buf, size_t n);
+
+// Allocate a payload of `n` bytes still to be read from the file, charged to the file and
+// process budgets. NULL if the file is too short to hold it or a budget is exceeded, the file
+// is rejected then
+void *ani_alloc(ParseContext *ctx, size_t n);
+
+typedef struct {
+    char lazy_frames;  // only record offset and size of frames, do not load them
+    char recover;      // resync to the next known chunk instead of giving up on a bad size
+    size_t max_alloc;  // bytes of payloads a file may allocate, 0 for no limit. Lazy frames
+                       // are charged the size of their record
+} ParseOptions;
+
+// Bytes of payloads every parsed file alive may allocate together, 0 for no limit
+void ani_set_process_budget(size_t bytes);
+
+size_t ani_process_usage(void);
+
 AniFile *parse_ani(FILE *file);
 
+// NULL if a chunk size does not fit and `recover` is not set
+AniFile *parse_ani_ex(FILE *file, const ParseOptions *opts);
+
 void cleanup_ani(AniFile *file);
+
+void cleanup_chunk(Chunk *c);
+
+int write_ani(const AniFile *ani, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,246 @@
+#pragma once
+
+// Header only C++20 layer over ani.h: an owning `ani::File`, non-owning views of chunks and
+// frames, and visitors that are templates instead of callbacks through `void *`
+
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <span>
+#include <utility>
+
+#include "ani.h"
+
+namespace ani {
+
+// A frame, its payload is only available when the file was not parsed with `lazy_frames`
+class FrameView {
+  public:
+    FrameView() noexcept = default;
+    explicit FrameView(const Frame *frame) noexcept : frame_(frame) {}
+
+    std::span<const std::byte> bytes() const noexcept {
+        if (!frame_->buffer) {
+            return {};
+        }
+        return {static_cast<const std::byte *>(frame_->buffer), frame_->size};
+    }
+    bool loaded() const noexcept { return frame_->buffer != nullptr; }
+    std::size_t size() const noexcept { return frame_->size; }
+    long offset() const noexcept { return frame_->off; }
+    const Frame *get() const noexcept { return frame_; }
+
+  private:
+    const Frame *frame_ = nullptr;
+};
+
+// Iterates an array of pointers, yielding a view of each element
+template <class View, class Raw>
+class PtrRange {
+  public:
+    class iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = View;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() noexcept = default;
+        explicit iterator(Raw *const *p) noexcept : p_(p) {}
+
+        View operator*() const noexcept { return View(*p_); }
+        iterator &operator++() noexcept {
+            ++p_;
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator tmp = *this;
+            ++p_;
+            return tmp;
+        }
+        bool operator==(const iterator &) const noexcept = default;
+
+      private:
+        Raw *const *p_ = nullptr;
+    };
+
+    PtrRange(Raw *const *first, std::size_t count) noexcept : first_(first), count_(count) {}
+
+    iterator begin() const noexcept { return iterator(first_); }
+    iterator end() const noexcept { return iterator(first_ + count_); }
+    std::size_t size() const noexcept { return count_; }
+    bool empty() const noexcept { return !count_; }
+    View operator[](std::size_t i) const noexcept { return View(first_[i]); }
+
+  private:
+    Raw *const *first_;
+    std::size_t count_;
+};
+
+using FrameRange = PtrRange<FrameView, Frame>;
+
+class ChunkView {
+  public:
+    ChunkView() noexcept = default;
+    explicit ChunkView(const Chunk *chunk) noexcept : chunk_(chunk) {}
+
+    ChunkType type() const noexcept { return chunk_->ty; }
+    uint32_t fourcc() const noexcept { return chunk_->fourcc; }
+    unsigned size() const noexcept { return chunk_->size; }
+    unsigned offset() const noexcept { return chunk_->off; }
+    const Chunk *get() const noexcept { return chunk_; }
+
+    // Typed payload, nullptr if the chunk is of another type
+    const ChunkAnih *anih() const noexcept { return as<ChunkAnih>(ty_anih); }
+    const ChunkSeq *seq() const noexcept { return as<ChunkSeq>(ty_seq); }
+    const ChunkRate *rate() const noexcept { return as<ChunkRate>(ty_rate); }
+    const ChunkList *list() const noexcept { return as<ChunkList>(ty_list); }
+
+    std::span<const unsigned> indexes() const noexcept {
+        const ChunkSeq *s = seq();
+        return s ? std::span<const unsigned>(s->indexes, s->count) : std::span<const unsigned>();
+    }
+    std::span<const uint32_t> jiffies() const noexcept {
+        const ChunkRate *r = rate();
+        return r ? std::span<const uint32_t>(r->jiffies, r->count) : std::span<const uint32_t>();
+    }
+    // Empty for chunks other than a frame list
+    FrameRange frames() const noexcept {
+        const ChunkList *l = list();
+        return l ? FrameRange(l->frames, l->count) : FrameRange(nullptr, 0);
+    }
+
+  private:
+    template <class T>
+    const T *as(ChunkType ty) const noexcept {
+        return chunk_->ty == ty ? static_cast<const T *>(chunk_->inner) : nullptr;
+    }
+
+    const Chunk *chunk_ = nullptr;
+};
+
+using ChunkRange = PtrRange<ChunkView, Chunk>;
+
+// Frames of every frame list of a file, in file order
+class AllFrames {
+  public:
+    class iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FrameView;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() noexcept = default;
+        iterator(const AniFile *ani, unsigned chunk) noexcept : ani_(ani), chunk_(chunk) {
+            skip();
+        }
+
+        FrameView operator*() const noexcept { return FrameView(list()->frames[frame_]); }
+        iterator &operator++() noexcept {
+            ++frame_;
+            skip();
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        bool operator==(const iterator &o) const noexcept {
+            return chunk_ == o.chunk_ && frame_ == o.frame_;
+        }
+
+      private:
+        const ChunkList *list() const noexcept {
+            return static_cast<const ChunkList *>(ani_->chunks[chunk_]->inner);
+        }
+        // Move to the next frame that exists, past chunks without frames
+        void skip() noexcept {
+            while (ani_ && chunk_ < ani_->chunk_count &&
+                   (ani_->chunks[chunk_]->ty != ty_list || frame_ >= list()->count)) {
+                ++chunk_;
+                frame_ = 0;
+            }
+        }
+
+        const AniFile *ani_ = nullptr;
+        unsigned chunk_ = 0;
+        unsigned frame_ = 0;
+    };
+
+    explicit AllFrames(const AniFile *ani) noexcept : ani_(ani) {}
+
+    iterator begin() const noexcept { return iterator(ani_, 0); }
+    iterator end() const noexcept { return iterator(ani_, ani_ ? ani_->chunk_count : 0); }
+
+  private:
+    const AniFile *ani_;
+};
+
+// Owns a parse result, move only
+class File {
+  public:
+    File() noexcept = default;
+    explicit File(AniFile *owned) noexcept : ani_(owned) {}
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+    File(File &&o) noexcept : ani_(std::exchange(o.ani_, nullptr)) {}
+    File &operator=(File &&o) noexcept {
+        if (this != &o) {
+            reset(std::exchange(o.ani_, nullptr));
+        }
+        return *this;
+    }
+    ~File() { reset(); }
+
+    // Empty on failure, the C parser has already logged why
+    static File parse(std::FILE *file, const ParseOptions &opts = {}) noexcept {
+        return File(parse_ani_ex(file, &opts));
+    }
+
+    explicit operator bool() const noexcept { return ani_ != nullptr; }
+    AniFile *get() const noexcept { return ani_; }
+    AniFile *release() noexcept { return std::exchange(ani_, nullptr); }
+    void reset(AniFile *owned = nullptr) noexcept {
+        if (ani_) {
+            cleanup_ani(ani_);
+        }
+        ani_ = owned;
+    }
+
+    // Both are empty for an empty File, so a failed parse can be iterated like any other
+    ChunkRange chunks() const noexcept {
+        return ani_ ? ChunkRange(ani_->chunks, ani_->chunk_count) : ChunkRange(nullptr, 0);
+    }
+    AllFrames frames() const noexcept { return AllFrames(ani_); }
+
+  private:
+    AniFile *ani_ = nullptr;
+};
+
+// Same order as `walk`, but the callables are inlined. Chunks of registered handlers reach
+// `on_chunk` only, their C visit callback is not run
+template <class OnChunk, class OnFrame>
+void visit(const File &file, OnChunk &&on_chunk, OnFrame &&on_frame) {
+    for (ChunkView chunk : file.chunks()) {
+        on_chunk(chunk);
+        for (FrameView frame : chunk.frames()) {
+            on_frame(frame);
+        }
+    }
+}
+
+template <class OnChunk>
+void visit_chunks(const File &file, OnChunk &&on_chunk) {
+    for (ChunkView chunk : file.chunks()) {
+        on_chunk(chunk);
+    }
+}
+
+template <class OnFrame>
+void visit_frames(const File &file, OnFrame &&on_frame) {
+    for (FrameView frame : file.frames()) {
+        on_frame(frame);
+    }
+}
+
+}  // namespace ani
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bundle.h"
+#include "debug.h"
+
+_Static_assert(sizeof(AnibHeader) == 32, "AnibHeader is 32 bytes");
+_Static_assert(sizeof(AnibRecord) == 56, "AnibRecord is 56 bytes");
+_Static_assert(sizeof(AnibStep) == 8, "AnibStep is 8 bytes");
+_Static_assert(sizeof(AnibFrame) == 16, "AnibFrame is 16 bytes");
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~(uint64_t)((a) - 1))
+
+// An added animation, its record gets the offsets of the index when the bundle is finished
+typedef struct {
+    AnibRecord rec;
+    char *name;
+    AnibStep *steps;
+    AnibFrame *frames;
+} Entry;
+
+struct AnibWriter {
+    char *path;
+    char *tmp_path;
+    int fd;
+    pthread_mutex_t lock;
+    uint64_t end;  // end of payloads
+    unsigned count;
+    unsigned capacity;
+    Entry *entries;
+    char failed;
+};
+
+static int pwrite_all(int fd, const void *buf, size_t n, uint64_t off) {
+    const uint8_t *p = buf;
+    while (n) {
+        ssize_t w = pwrite(fd, p, n, off);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return 1;
+        }
+        p += w;
+        off += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static void cleanup_writer(AnibWriter *w) {
+    for (unsigned i = 0; i < w->count; ++i) {
+        free(w->entries[i].name);
+        free(w->entries[i].steps);
+        free(w->entries[i].frames);
+    }
+    free(w->entries);
+    pthread_mutex_destroy(&w->lock);
+    free(w->tmp_path);
+    free(w->path);
+    free(w);
+}
+
+AnibWriter *anib_create(const char *path) {
+    AnibWriter *w = calloc(1, sizeof(AnibWriter));
+    size_t len = strlen(path);
+    char *tmp_path = malloc(len + 8);
+    char *copy = strdup(path);
+    if (!w || !tmp_path || !copy) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(w);
+        free(tmp_path);
+        free(copy);
+        return NULL;
+    }
+    sprintf(tmp_path, "%s.XXXXXX", path);
+    w->fd = mkstemp(tmp_path);
+    if (w->fd < 0) {
+        err("Cannot create temporary file for `%s`: %s", path, strerror(errno));
+        free(w);
+        free(tmp_path);
+        free(copy);
+        return NULL;
+    }
+    w->path = copy;
+    w->tmp_path = tmp_path;
+    w->end = ALIGN_UP(sizeof(AnibHeader), ANIB_ALIGN);
+    pthread_mutex_init(&w->lock, NULL);
+    return w;
+}
+
+// Copy the animation and reserve the place of its payloads
+static int push_entry(AnibWriter *w, const AnibAnimation *anim, AnibFrame *frames) {
+    Entry e;
+    e.name = strdup(anim->name);
+    e.steps = malloc(anim->step_count ? anim->step_count * sizeof(AnibStep) : 1);
+    if (!e.name || !e.steps) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(e.name);
+        free(e.steps);
+        return 1;
+    }
+    memcpy(e.steps, anim->steps, anim->step_count * sizeof(AnibStep));
+    e.frames = frames;
+    memset(&e.rec, 0, sizeof(e.rec));
+    e.rec.step_count = anim->step_count;
+    e.rec.frame_count = anim->frame_count;
+    e.rec.width = anim->width;
+    e.rec.height = anim->height;
+    e.rec.hotx = anim->hotx;
+    e.rec.hoty = anim->hoty;
+    e.rec.jif_rate = anim->jif_rate;
+    e.rec.flags = anim->flags;
+
+    pthread_mutex_lock(&w->lock);
+    int res = 0;
+    if (w->count + 1 > w->capacity) {
+        unsigned capacity = w->capacity ? w->capacity << 1 : 16;
+        Entry *tmp = realloc(w->entries, capacity * sizeof(Entry));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            res = 1;
+        } else {
+            w->entries = tmp;
+            w->capacity = capacity;
+        }
+    }
+    if (res == 0) {
+        for (unsigned i = 0; i < anim->frame_count; ++i) {
+            frames[i].off = ALIGN_UP(w->end, ANIB_ALIGN);
+            w->end = frames[i].off + frames[i].size;
+        }
+        w->entries[w->count++] = e;
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (res != 0) {
+        free(e.name);
+        free(e.steps);
+    }
+    return res;
+}
+
+int anib_add(AnibWriter *w, const AnibAnimation *anim) {
+    for (unsigned i = 0; i < anim->step_count; ++i) {
+        if (anim->steps[i].frame >= anim->frame_count) {
+            err("Step %u of `%s` refers to missing frame %u", i, anim->name, anim->steps[i].frame);
+            return 1;
+        }
+    }
+    AnibFrame *frames = malloc(anim->frame_count ? anim->frame_count * sizeof(AnibFrame) : 1);
+    if (!frames) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    for (unsigned i = 0; i < anim->frame_count; ++i) {
+        frames[i].size = anim->frame_sizes[i];
+    }
+    if (push_entry(w, anim, frames) != 0) {
+        free(frames);
+        return 1;
+    }
+    // The place is reserved, so payloads are written without holding the lock
+    for (unsigned i = 0; i < anim->frame_count; ++i) {
+        if (pwrite_all(w->fd, anim->frames[i], frames[i].size, frames[i].off) != 0) {
+            err("Cannot write bundle `%s`: %s", w->tmp_path, strerror(errno));
+            pthread_mutex_lock(&w->lock);
+            w->failed = 1;
+            pthread_mutex_unlock(&w->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Lay out names, records, steps, frames and the offset table behind the payloads
+static uint8_t *build_index(AnibWriter *w, uint64_t start, size_t *size, uint64_t *table_off) {
+    uint64_t off = start;
+    for (unsigned i = 0; i < w->count; ++i) {
+        w->entries[i].rec.name_off = off;
+        off += strlen(w->entries[i].name) + 1;
+    }
+    off = ALIGN_UP(off, 8);
+    uint64_t records_off = off;
+    off += (uint64_t)w->count * sizeof(AnibRecord);
+    for (unsigned i = 0; i < w->count; ++i) {
+        AnibRecord *r = &w->entries[i].rec;
+        r->steps_off = off;
+        off += (uint64_t)r->step_count * sizeof(AnibStep);
+        r->frames_off = off;
+        off += (uint64_t)r->frame_count * sizeof(AnibFrame);
+    }
+    *table_off = off;
+    off += (uint64_t)w->count * sizeof(uint64_t);
+
+    *size = off - start;
+    uint8_t *buf = calloc(1, *size ? *size : 1);
+    if (!buf) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    uint64_t *table = (uint64_t *)(buf + (*table_off - start));
+    for (unsigned i = 0; i < w->count; ++i) {
+        const Entry *e = &w->entries[i];
+        strcpy((char *)buf + (e->rec.name_off - start), e->name);
+        uint64_t rec_off = records_off + (uint64_t)i * sizeof(AnibRecord);
+        memcpy(buf + (rec_off - start), &e->rec, sizeof(AnibRecord));
+        memcpy(buf + (e->rec.steps_off - start), e->steps, e->rec.step_count * sizeof(AnibStep));
+        memcpy(buf + (e->rec.frames_off - start),
+               e->frames,
+               e->rec.frame_count * sizeof(AnibFrame));
+        table[i] = rec_off;
+    }
+    return buf;
+}
+
+int anib_finish(AnibWriter *w) {
+    if (!w) {
+        return 1;
+    }
+    int res = w->failed;
+    uint64_t start = ALIGN_UP(w->end, 8);
+    size_t index_size = 0;
+    uint64_t table_off = 0;
+    uint8_t *index = res ? NULL : build_index(w, start, &index_size, &table_off);
+    if (!index) {
+        res = 1;
+    } else {
+        AnibHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ANIB_MAGIC, 4);
+        header.version = ANIB_VERSION;
+        header.count = w->count;
+        header.table_off = table_off;
+        header.size = start + index_size;
+        if (pwrite_all(w->fd, index, index_size, start) != 0 ||
+            pwrite_all(w->fd, &header, sizeof(header), 0) != 0 || fchmod(w->fd, 0644) != 0 ||
+            fsync(w->fd) != 0) {
+            err("Cannot write bundle `%s`: %s", w->tmp_path, strerror(errno));
+            res = 1;
+        }
+        free(index);
+    }
+    close(w->fd);
+    if (res == 0 && rename(w->tmp_path, w->path) != 0) {
+        err("Cannot publish bundle `%s`: %s", w->path, strerror(errno));
+        res = 1;
+    }
+    if (res != 0) {
+        unlink(w->tmp_path);
+    } else {
+        debug("Bundle `%s` holds %u animations", w->path, w->count);
+    }
+    cleanup_writer(w);
+    return res;
+}
+
+// `count` items of `n` bytes at `off` lie inside the file, `off` is aligned to `align`
+static int in_file(const AnibFile *b, uint64_t off, uint64_t count, size_t n, size_t align) {
+    return off % align == 0 && off <= b->size && count <= (b->size - off) / n;
+}
+
+static int check_record(const AnibFile *b, uint64_t off) {
+    if (!in_file(b, off, 1, sizeof(AnibRecord), 8)) {
+        return 1;
+    }
+    const AnibRecord *r = (const AnibRecord *)(b->base + off);
+    if (r->name_off >= b->size || !memchr(b->base + r->name_off, 0, b->size - r->name_off) ||
+        !in_file(b, r->steps_off, r->step_count, sizeof(AnibStep), 4) ||
+        !in_file(b, r->frames_off, r->frame_count, sizeof(AnibFrame), 8)) {
+        return 1;
+    }
+    const AnibStep *steps = anib_steps(b, r);
+    for (uint32_t i = 0; i < r->step_count; ++i) {
+        if (steps[i].frame >= r->frame_count) {
+            return 1;
+        }
+    }
+    const AnibFrame *frames = anib_frames(b, r);
+    for (uint32_t i = 0; i < r->frame_count; ++i) {
+        if (!in_file(b, frames[i].off, frames[i].size, 1, ANIB_ALIGN)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+AnibFile *anib_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        err("Cannot open bundle `%s`: %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AnibHeader)) {
+        err("`%s` is not a bundle", path);
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        err("Cannot map bundle `%s`: %s", path, strerror(errno));
+        return NULL;
+    }
+    AnibFile *b = malloc(sizeof(AnibFile));
+    if (!b) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    b->base = base;
+    b->size = st.st_size;
+    b->header = base;
+    b->table = NULL;
+
+    const AnibHeader *h = b->header;
+    int bad = memcmp(h->magic, ANIB_MAGIC, 4) || h->version != ANIB_VERSION ||
+              h->size != b->size || !in_file(b, h->table_off, h->count, sizeof(uint64_t), 8);
+    if (!bad) {
+        b->table = (const uint64_t *)(b->base + h->table_off);
+        for (uint32_t i = 0; i < h->count && !bad; ++i) {
+            bad = check_record(b, b->table[i]);
+        }
+    }
+    if (bad) {
+        err("Bundle `%s` is corrupt", path);
+        anib_close(b);
+        return NULL;
+    }
+    return b;
+}
+
+void anib_close(AnibFile *b) {
+    if (b) {
+        munmap((void *)b->base, b->size);
+        free(b);
+    }
+}
+
+const AnibRecord *anib_record(const AnibFile *b, unsigned i) {
+    return i < b->header->count ? (const AnibRecord *)(b->base + b->table[i]) : NULL;
+}
+
+const AnibRecord *anib_find(const AnibFile *b, const char *name) {
+    for (unsigned i = 0; i < b->header->count; ++i) {
+        const AnibRecord *r = anib_record(b, i);
+        if (!strcmp(anib_name(b, r), name)) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+const char *anib_name(const AnibFile *b, const AnibRecord *r) {
+    return (const char *)b->base + r->name_off;
+}
+
+const AnibStep *anib_steps(const AnibFile *b, const AnibRecord *r) {
+    return (const AnibStep *)(b->base + r->steps_off);
+}
+
+const AnibFrame *anib_frames(const AnibFile *b, const AnibRecord *r) {
+    return (const AnibFrame *)(b->base + r->frames_off);
+}
+
+const uint8_t *anib_payload(const AnibFile *b, const AnibFrame *f) {
+    return b->base + f->off;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A bundle packs many animations into one file that is used in place once mapped:
+//   header | 64 byte aligned payloads | names | records, steps and frames | offset table
+// Every field is little endian and naturally aligned, so it is only loaded on little endian hosts
+
+#define ANIB_MAGIC "ANIB"
+#define ANIB_VERSION 1
+#define ANIB_ALIGN 64
+
+// Record flags
+// Payloads are serialized deltas of decoded frames, see delta.h. They follow playback: step i
+// shows frame i, whose delta turns the canvas of step i - 1 into it, and frame 0 starts from a
+// transparent canvas. Playing forward applies one delta per step, a loop restarts from a cleared
+// canvas, and seeking to step i applies deltas 0 to i
+#define ANIB_DELTA 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;  // animations
+    uint32_t reserved;
+    uint64_t table_off;  // `count` offsets of records
+    uint64_t size;  // whole file
+} AnibHeader;
+
+typedef struct {
+    uint64_t name_off;  // NUL terminated
+    uint64_t steps_off;
+    uint64_t frames_off;
+    uint32_t step_count;
+    uint32_t frame_count;
+    uint32_t width, height;
+    uint32_t hotx, hoty;
+    uint32_t jif_rate;
+    uint32_t flags;
+} AnibRecord;
+
+typedef struct {
+    uint32_t frame;  // index into the frames of the record
+    uint32_t jiffies;
+} AnibStep;
+
+typedef struct {
+    uint64_t off;  // ICO, or delta with ANIB_DELTA, aligned to ANIB_ALIGN
+    uint64_t size;
+} AnibFrame;
+
+// An animation to append, frame payloads are copied while it is added
+typedef struct {
+    const char *name;
+    uint32_t width, height;
+    uint32_t hotx, hoty;
+    uint32_t jif_rate;
+    uint32_t flags;
+    const AnibStep *steps;
+    unsigned step_count;
+    const uint8_t *const *frames;
+    const size_t *frame_sizes;
+    unsigned frame_count;
+} AnibAnimation;
+
+typedef struct AnibWriter AnibWriter;
+
+// The bundle appears at `path` only once `anib_finish` succeeds
+AnibWriter *anib_create(const char *path);
+
+// Thread safe, payloads of concurrent calls are written in parallel
+int anib_add(AnibWriter *w, const AnibAnimation *anim);
+
+// Write the index and publish the bundle, `w` is released either way
+int anib_finish(AnibWriter *w);
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    const AnibHeader *header;
+    const uint64_t *table;
+} AnibFile;
+
+// Map a bundle, every offset is checked once here so the accessors below need no checks
+AnibFile *anib_open(const char *path);
+
+void anib_close(AnibFile *b);
+
+const AnibRecord *anib_record(const AnibFile *b, unsigned i);
+
+// First record named `name`, NULL if there is none
+const AnibRecord *anib_find(const AnibFile *b, const char *name);
+
+const char *anib_name(const AnibFile *b, const AnibRecord *r);
+
+const AnibStep *anib_steps(const AnibFile *b, const AnibRecord *r);
+
+const AnibFrame *anib_frames(const AnibFile *b, const AnibRecord *r);
+
+const uint8_t *anib_payload(const AnibFile *b, const AnibFrame *f);
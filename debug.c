@@ -46,9 +46,10 @@ void lc_log(lc_log_level_t level, const char *format, ...) {
     va_end(arg_list);
     va_end(arg_list_raw);
     time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
     char time_buf[20];
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
+    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm_info);
 
     switch (level) {
         case LC_LOG_INFO: {
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+#include "png.h"
+#include "ico.h"
+#include "debug.h"
+
+// Larger images are not icons, and would overflow the size math below
+#define MAX_DIM 4096
+
+static uint16_t u16_le(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t u32_le(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t premultiply(uint32_t a, uint32_t r, uint32_t g, uint32_t b) {
+    if (a != 255) {
+        r = (r * a + 127) / 255;
+        g = (g * a + 127) / 255;
+        b = (b * a + 127) / 255;
+    }
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+// BITMAPINFOHEADER or a later version, followed by the palette, the XOR rows and the 1 bit AND
+// rows, both bottom up. biHeight counts both
+static int decode_dib(const uint8_t *buf, size_t size, Image *out) {
+    if (size < 40 || u32_le(buf) < 40 || u32_le(buf) > size) {
+        err("Bad DIB header");
+        return 1;
+    }
+    uint32_t header_size = u32_le(buf);
+    int32_t w = (int32_t)u32_le(buf + 4);
+    int32_t h2 = (int32_t)u32_le(buf + 8);
+    unsigned bpp = u16_le(buf + 14);
+    uint32_t compression = u32_le(buf + 16);
+    uint32_t colors = u32_le(buf + 32);
+    if (w <= 0 || w > MAX_DIM || h2 == 0 || h2 > 2 * MAX_DIM || h2 < -2 * MAX_DIM) {
+        err("Bad DIB dimension %dx%d", w, h2);
+        return 1;
+    }
+    // Top down DIBs are not valid in ICO, take them anyway
+    char top_down = h2 < 0;
+    uint32_t h = (top_down ? -h2 : h2) / 2;
+    if (!h) {
+        err("Bad DIB height %d", h2);
+        return 1;
+    }
+    if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32) {
+        err("Unsupported DIB depth %u", bpp);
+        return 1;
+    }
+    // BI_BITFIELDS is only seen with the default BGRA masks in icons
+    if (compression != 0 && !(compression == 3 && bpp == 32)) {
+        err("Unsupported DIB compression %u", compression);
+        return 1;
+    }
+
+    size_t pos = header_size;
+    if (compression == 3 && header_size == 40) {
+        pos += 12;
+    }
+    const uint8_t *palette = buf + pos;
+    if (bpp <= 8) {
+        uint32_t max_colors = 1u << bpp;
+        if (!colors || colors > max_colors) {
+            colors = max_colors;
+        }
+        pos += (size_t)colors * 4;
+    }
+    size_t xor_stride = ((size_t)w * bpp + 31) / 32 * 4;
+    size_t and_stride = ((size_t)w + 31) / 32 * 4;
+    const uint8_t *xor = buf + pos;
+    const uint8_t *and = xor + xor_stride * h;
+    if (pos + xor_stride * h > size) {
+        err("DIB truncated");
+        return 1;
+    }
+    // Some encoders drop the mask of 32 bit images
+    char has_mask = pos + (xor_stride + and_stride) * h <= size;
+    if (!has_mask && bpp != 32) {
+        err("DIB misses its AND mask");
+        return 1;
+    }
+
+    out->width = w;
+    out->height = h;
+    out->pixels = malloc((size_t)w * h * sizeof(uint32_t));
+    if (!out->pixels) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+
+    char has_alpha = 0;
+    for (uint32_t y = 0; y < h; ++y) {
+        uint32_t src_y = top_down ? y : h - 1 - y;
+        const uint8_t *row = xor + src_y * xor_stride;
+        const uint8_t *mask = and + src_y * and_stride;
+        uint32_t *dst = out->pixels + (size_t)y * w;
+        for (int32_t x = 0; x < w; ++x) {
+            uint32_t a = 255, r, g, b;
+            if (bpp == 32) {
+                b = row[x * 4];
+                g = row[x * 4 + 1];
+                r = row[x * 4 + 2];
+                a = row[x * 4 + 3];
+                has_alpha |= a != 0;
+            } else if (bpp == 24) {
+                b = row[x * 3];
+                g = row[x * 3 + 1];
+                r = row[x * 3 + 2];
+            } else {
+                unsigned shift = 8 - bpp - (x * bpp) % 8;
+                unsigned idx = (row[x * bpp / 8] >> shift) & ((1u << bpp) - 1);
+                if (idx >= colors) {
+                    idx = 0;
+                }
+                b = palette[idx * 4];
+                g = palette[idx * 4 + 1];
+                r = palette[idx * 4 + 2];
+            }
+            if (bpp != 32 && (mask[x / 8] >> (7 - x % 8)) & 1) {
+                a = 0;
+            }
+            dst[x] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+
+    // A 32 bit image without any alpha relies on its mask
+    for (size_t i = 0; i < (size_t)w * h; ++i) {
+        uint32_t p = out->pixels[i];
+        uint32_t a = p >> 24;
+        if (bpp == 32 && !has_alpha) {
+            uint32_t x = i % w, y = i / w;
+            uint32_t src_y = top_down ? y : h - 1 - y;
+            a = has_mask && (and[src_y * and_stride + x / 8] >> (7 - x % 8)) & 1 ? 0 : 255;
+        }
+        out->pixels[i] = premultiply(a, (p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF);
+    }
+    return 0;
+}
+
+int decode_image(const uint8_t *buf, size_t size, Image *out) {
+    out->width = 0;
+    out->height = 0;
+    out->pixels = NULL;
+    if (is_png(buf, size)) {
+        return decode_png(buf, size, out);
+    }
+    return decode_dib(buf, size, out);
+}
+
+int decode_ico(const uint8_t *ico, size_t size, unsigned want, Image *out) {
+    IcoDir dir;
+    size_t dir_size = size >= ICO_HEADER_SIZE ? ico_dir_size(ico) : 0;
+    if (!dir_size || parse_ico_dir(ico, size, &dir) != 0) {
+        err("Frame is not an ICO");
+        return 1;
+    }
+    int idx = select_ico_entry(&dir, want);
+    const IcoEntry *e = idx >= 0 ? &dir.entries[idx] : NULL;
+    int res = 1;
+    if (!e || e->offset > size || e->size > size - e->offset) {
+        err("No usable ICO entry in frame");
+    } else {
+        res = decode_image(ico + e->offset, e->size, out);
+    }
+    cleanup_ico_dir(&dir);
+    return res;
+}
+
+void cleanup_image(Image *image) {
+    free(image->pixels);
+    image->pixels = NULL;
+}
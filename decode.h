@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Decoded image, premultiplied ARGB in native u32, rows top down
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t *pixels;
+} Image;
+
+// Decode the image of an ICO entry, a PNG or a DIB with its AND mask
+int decode_image(const uint8_t *buf, size_t size, Image *out);
+
+// Decode the entry of a whole ICO closest to `want` px, the largest one if `want` is 0
+int decode_ico(const uint8_t *ico, size_t size, unsigned want, Image *out);
+
+void cleanup_image(Image *image);
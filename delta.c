@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+#include "debug.h"
+
+// Zero runs shorter than this cost less as part of a literal run than as a new pair
+#define MIN_SKIP 2
+
+// Find the first and last pixels that differ between two rows, 0 if they are equal. Blocks of
+// 8 pixels are OR reduced, which the compiler vectorizes, and only the block that differs is
+// scanned one pixel at a time
+static int row_diff(const uint32_t *a, const uint32_t *b, uint32_t n, uint32_t *first, uint32_t *last) {
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32_t d = 0;
+        for (unsigned k = 0; k < 8; ++k) {
+            d |= a[i + k] ^ b[i + k];
+        }
+        if (d) {
+            break;
+        }
+    }
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    if (i == n) {
+        return 0;
+    }
+    uint32_t j = n;
+    for (; j - i >= 8; j -= 8) {
+        uint32_t d = 0;
+        for (unsigned k = 1; k <= 8; ++k) {
+            d |= a[j - k] ^ b[j - k];
+        }
+        if (d) {
+            break;
+        }
+    }
+    while (a[j - 1] == b[j - 1]) {
+        --j;
+    }
+    *first = i;
+    *last = j - 1;
+    return 1;
+}
+
+// Run length encode the XOR of the rectangle, `xor` is scratch of w * h words
+static int encode_frame(const uint32_t *prev,
+                        const uint32_t *cur,
+                        uint32_t width,
+                        uint32_t *xor,
+                        FrameDelta *d) {
+    size_t n = (size_t)d->w * d->h;
+    for (uint32_t r = 0; r < d->h; ++r) {
+        const uint32_t *p = prev + (size_t)(d->y + r) * width + d->x;
+        const uint32_t *c = cur + (size_t)(d->y + r) * width + d->x;
+        uint32_t *x = xor + (size_t)r * d->w;
+        for (uint32_t k = 0; k < d->w; ++k) {
+            x[k] = p[k] ^ c[k];
+        }
+    }
+    // A pair covers at least one pixel, so 3 words per pixel always fit
+    uint32_t *runs = malloc(n ? n * 3 * sizeof(uint32_t) : 1);
+    if (!runs) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    size_t p = 0, o = 0;
+    while (p < n) {
+        size_t start = p;
+        while (p < n && !xor[p]) {
+            ++p;
+        }
+        if (p == n) {
+            break;
+        }
+        runs[o++] = p - start;
+        size_t copy = o++;
+        start = p;
+        while (p < n) {
+            size_t z = p;
+            while (z < n && !xor[z] && z - p < MIN_SKIP) {
+                ++z;
+            }
+            if (z - p >= MIN_SKIP || z == n) {
+                break;
+            }
+            p = z + 1;
+        }
+        runs[copy] = p - start;
+        memcpy(runs + o, xor + start, (p - start) * sizeof(uint32_t));
+        o += p - start;
+    }
+    uint32_t *shrunk = realloc(runs, o ? o * sizeof(uint32_t) : 1);
+    d->runs = shrunk ? shrunk : runs;
+    d->words = o;
+    return 0;
+}
+
+int delta_encode(const Image *frames, unsigned count, DeltaAnimation *out) {
+    out->width = count ? frames[0].width : 0;
+    out->height = count ? frames[0].height : 0;
+    out->count = 0;
+    out->deltas = NULL;
+    size_t pixels = (size_t)out->width * out->height;
+    for (unsigned i = 0; i < count; ++i) {
+        if (frames[i].width != out->width || frames[i].height != out->height) {
+            err("Frame %u is %ux%u, frame 0 is %ux%u",
+                i,
+                frames[i].width,
+                frames[i].height,
+                out->width,
+                out->height);
+            return 1;
+        }
+    }
+    uint32_t *blank = calloc(pixels ? pixels : 1, sizeof(uint32_t));
+    uint32_t *xor = malloc(pixels ? pixels * sizeof(uint32_t) : 1);
+    out->deltas = calloc(count ? count : 1, sizeof(FrameDelta));
+    if (!blank || !xor || !out->deltas) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(blank);
+        free(xor);
+        cleanup_delta(out);
+        return 1;
+    }
+
+    int res = 0;
+    for (unsigned i = 0; i < count && res == 0; ++i) {
+        const uint32_t *prev = i ? frames[i - 1].pixels : blank;
+        const uint32_t *cur = frames[i].pixels;
+        FrameDelta *d = &out->deltas[i];
+        uint32_t x0 = out->width, x1 = 0, y0 = out->height, y1 = 0;
+        for (uint32_t y = 0; y < out->height; ++y) {
+            uint32_t first, last;
+            size_t row = (size_t)y * out->width;
+            if (!row_diff(prev + row, cur + row, out->width, &first, &last)) {
+                continue;
+            }
+            x0 = first < x0 ? first : x0;
+            x1 = last > x1 ? last : x1;
+            y0 = y < y0 ? y : y0;
+            y1 = y;
+        }
+        if (y0 < out->height) {
+            d->x = x0;
+            d->y = y0;
+            d->w = x1 - x0 + 1;
+            d->h = y1 - y0 + 1;
+            res = encode_frame(prev, cur, out->width, xor, d);
+        }
+        out->count = i + 1;
+    }
+    free(blank);
+    free(xor);
+    if (res != 0) {
+        cleanup_delta(out);
+    }
+    return res;
+}
+
+void delta_apply(const FrameDelta *d, uint32_t *canvas, uint32_t width) {
+    const uint32_t *r = d->runs, *end = d->runs + d->words;
+    size_t p = 0;
+    while (end - r >= 2) {
+        p += r[0];
+        uint32_t copy = r[1];
+        r += 2;
+        // A run may wrap over rows of the rectangle
+        while (copy) {
+            uint32_t row = p / d->w, col = p % d->w;
+            uint32_t n = d->w - col < copy ? d->w - col : copy;
+            uint32_t *dst = canvas + (size_t)(d->y + row) * width + d->x + col;
+            for (uint32_t k = 0; k < n; ++k) {
+                dst[k] ^= r[k];
+            }
+            r += n;
+            p += n;
+            copy -= n;
+        }
+    }
+}
+
+void delta_frame(const DeltaAnimation *a, unsigned i, uint32_t *canvas) {
+    memset(canvas, 0, (size_t)a->width * a->height * sizeof(uint32_t));
+    for (unsigned k = 0; k <= i && k < a->count; ++k) {
+        delta_apply(&a->deltas[k], canvas, a->width);
+    }
+}
+
+void cleanup_delta(DeltaAnimation *a) {
+    if (a->deltas) {
+        for (unsigned i = 0; i < a->count; ++i) {
+            free((void *)a->deltas[i].runs);
+        }
+        free(a->deltas);
+    }
+    a->deltas = NULL;
+    a->count = 0;
+}
+
+size_t delta_blob_size(const FrameDelta *d) {
+    return (DELTA_HEADER_WORDS + d->words) * sizeof(uint32_t);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+void delta_write_blob(const DeltaAnimation *a, unsigned i, uint8_t *out) {
+    const FrameDelta *d = &a->deltas[i];
+    uint32_t head[DELTA_HEADER_WORDS] = {a->width, a->height, d->x, d->y, d->w, d->h};
+    for (unsigned k = 0; k < DELTA_HEADER_WORDS; ++k) {
+        put_u32(out + k * 4, head[k]);
+    }
+    for (size_t k = 0; k < d->words; ++k) {
+        put_u32(out + (DELTA_HEADER_WORDS + k) * 4, d->runs[k]);
+    }
+}
+
+int delta_view_blob(const uint8_t *blob,
+                    size_t size,
+                    uint32_t *width,
+                    uint32_t *height,
+                    FrameDelta *view) {
+    if (size < DELTA_HEADER_WORDS * sizeof(uint32_t) || size % 4 || (uintptr_t)blob % 4) {
+        err("Delta is truncated or misaligned");
+        return 1;
+    }
+    // Runs are used in place, so they are only read as is on little endian hosts
+    const uint32_t *w = (const uint32_t *)blob;
+    *width = w[0];
+    *height = w[1];
+    view->x = w[2];
+    view->y = w[3];
+    view->w = w[4];
+    view->h = w[5];
+    view->runs = w + DELTA_HEADER_WORDS;
+    view->words = size / 4 - DELTA_HEADER_WORDS;
+    if (view->x > *width || view->w > *width - view->x || view->y > *height ||
+        view->h > *height - view->y) {
+        err("Delta rectangle is outside of the canvas");
+        return 1;
+    }
+    uint64_t n = (uint64_t)view->w * view->h, p = 0;
+    for (size_t k = 0; k + 2 <= view->words;) {
+        p += (uint64_t)view->runs[k] + view->runs[k + 1];
+        if (p > n || view->runs[k + 1] > view->words - k - 2) {
+            err("Delta runs are outside of the rectangle");
+            return 1;
+        }
+        k += 2 + view->runs[k + 1];
+    }
+    return 0;
+}
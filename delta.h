@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decode.h"
+
+// Decoded frames stored as changes: each frame keeps the rectangle that differs from the frame
+// before it, and the XOR of that rectangle run length encoded. Frame 0 is the change from a
+// transparent canvas, so a canvas is rebuilt by applying deltas in order and renderers can
+// upload just the rectangle
+
+// Serialized delta: DELTA_HEADER_WORDS little endian words, canvas width and height then x, y, w
+// and h of the rectangle, followed by the runs
+#define DELTA_HEADER_WORDS 6
+
+typedef struct {
+    uint32_t x, y, w, h;  // empty if the frame equals the one before
+    const uint32_t *runs;  // [skip, copy, `copy` XOR words]... over the rectangle, row major
+    size_t words;
+} FrameDelta;
+
+typedef struct {
+    uint32_t width, height;
+    unsigned count;
+    FrameDelta *deltas;
+} DeltaAnimation;
+
+// Every frame must have the same size
+int delta_encode(const Image *frames, unsigned count, DeltaAnimation *out);
+
+// Turn the previous frame in `canvas` into the frame of `d`
+void delta_apply(const FrameDelta *d, uint32_t *canvas, uint32_t width);
+
+// Rebuild frame `i` into `canvas`, which holds width * height pixels
+void delta_frame(const DeltaAnimation *a, unsigned i, uint32_t *canvas);
+
+void cleanup_delta(DeltaAnimation *a);
+
+size_t delta_blob_size(const FrameDelta *d);
+
+void delta_write_blob(const DeltaAnimation *a, unsigned i, uint8_t *out);
+
+// View a serialized delta in place, `blob` must be 4 byte aligned. The rectangle and runs are
+// checked against the canvas, so the view is safe to apply on a canvas of its size
+int delta_view_blob(const uint8_t *blob,
+                    size_t size,
+                    uint32_t *width,
+                    uint32_t *height,
+                    FrameDelta *view);
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ico.h"
+#include "debug.h"
+
+static uint16_t u16_le(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t u32_le(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u16_le(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_u32_le(uint8_t *p, uint32_t v) {
+    put_u16_le(p, v & 0xFFFF);
+    put_u16_le(p + 2, v >> 16);
+}
+
+size_t ico_dir_size(const uint8_t head[ICO_HEADER_SIZE]) {
+    uint16_t type = u16_le(head + 2);
+    if (u16_le(head) != 0 || (type != 1 && type != 2)) {
+        return 0;
+    }
+    return ICO_HEADER_SIZE + (size_t)u16_le(head + 4) * ICO_ENTRY_SIZE;
+}
+
+// Entries whose image lies outside the ICO are dropped
+int parse_ico_dir(const uint8_t *buf, size_t size, IcoDir *dir) {
+    dir->count = 0;
+    dir->entries = NULL;
+    if (size < ICO_HEADER_SIZE) {
+        err("ICO too small (%zu)", size);
+        return 1;
+    }
+    size_t dir_size = ico_dir_size(buf);
+    if (!dir_size || dir_size > size) {
+        err("Not an ICONDIR");
+        return 1;
+    }
+    dir->type = u16_le(buf + 2);
+    unsigned count = u16_le(buf + 4);
+    dir->entries = malloc((count ? count : 1) * sizeof(IcoEntry));
+    if (!dir->entries) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        const uint8_t *p = buf + ICO_HEADER_SIZE + i * ICO_ENTRY_SIZE;
+        IcoEntry *e = &dir->entries[dir->count];
+        e->width = p[0] ? p[0] : 256;
+        e->height = p[1] ? p[1] : 256;
+        e->planes = u16_le(p + 4);
+        e->bit_count = u16_le(p + 6);
+        e->size = u32_le(p + 8);
+        e->offset = u32_le(p + 12);
+        memcpy(e->raw, p, ICO_ENTRY_SIZE);
+        // The whole ICO may not be loaded, only check what is known
+        if (e->offset < dir_size) {
+            warn("ICO entry `%u` overlaps ICONDIR, drop it", i);
+            continue;
+        }
+        dir->count++;
+    }
+    return 0;
+}
+
+void cleanup_ico_dir(IcoDir *dir) {
+    free(dir->entries);
+    dir->entries = NULL;
+    dir->count = 0;
+}
+
+// Prefer exact size, then the closest larger one, then the closest smaller one.
+// Ties go to the larger image, i.e. the deeper color
+int select_ico_entry(const IcoDir *dir, unsigned want) {
+    int best = -1;
+    for (int i = 0; i < dir->count; ++i) {
+        const IcoEntry *e = &dir->entries[i];
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        const IcoEntry *b = &dir->entries[best];
+        if (!want) {
+            if (e->width > b->width || (e->width == b->width && e->size > b->size)) {
+                best = i;
+            }
+            continue;
+        }
+        long de = (long)e->width - want, db = (long)b->width - want;
+        // Rank distances: exact 0, larger 1..., smaller after every larger one
+        unsigned long re = de >= 0 ? de : 0x10000 - de;
+        unsigned long rb = db >= 0 ? db : 0x10000 - db;
+        if (re < rb || (re == rb && e->size > b->size)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void build_single_ico_header(const IcoDir *dir,
+                             int idx,
+                             uint8_t out[ICO_HEADER_SIZE + ICO_ENTRY_SIZE]) {
+    put_u16_le(out, 0);
+    put_u16_le(out + 2, dir->type);
+    put_u16_le(out + 4, 1);
+    memcpy(out + ICO_HEADER_SIZE, dir->entries[idx].raw, ICO_ENTRY_SIZE);
+    put_u32_le(out + ICO_HEADER_SIZE + 12, ICO_HEADER_SIZE + ICO_ENTRY_SIZE);
+}
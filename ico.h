@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ICONDIR header, followed by ICONDIRENTRYs
+#define ICO_HEADER_SIZE 6
+#define ICO_ENTRY_SIZE 16
+
+typedef struct {
+    uint32_t width;   // 0 in the entry means 256
+    uint32_t height;
+    uint16_t planes;  // hotx for cursors
+    uint16_t bit_count;  // hoty for cursors
+    uint32_t size;
+    uint32_t offset;  // from start of the ICO
+    uint8_t raw[ICO_ENTRY_SIZE];
+} IcoEntry;
+
+typedef struct {
+    uint16_t type;  // 1 icon, 2 cursor
+    uint16_t count;
+    IcoEntry *entries;
+} IcoDir;
+
+// Bytes of ICONDIR plus entries, 0 if `head` is not an ICONDIR
+size_t ico_dir_size(const uint8_t head[ICO_HEADER_SIZE]);
+
+int parse_ico_dir(const uint8_t *buf, size_t size, IcoDir *dir);
+
+void cleanup_ico_dir(IcoDir *dir);
+
+// Entry matching `want` px best, or the largest one if `want` is 0. -1 if there is none
+int select_ico_entry(const IcoDir *dir, unsigned want);
+
+// Header of an ICO holding only entry `idx`, its image follows right after it
+void build_single_ico_header(const IcoDir *dir,
+                             int idx,
+                             uint8_t out[ICO_HEADER_SIZE + ICO_ENTRY_SIZE]);
@@ -10,350 +10,132 @@
 #include "debug.h"
 #include "ani.h"
 #include "string_builder.h"
-
-enum OutFormat { Json, Plain, Silent };
-
-enum Mode { Extract, Describe };
+#include "optimize.h"
+#include "task.h"
+#include "server.h"
+#include "watch.h"
+#include "pipeline.h"
+#include "shard.h"
+#include "report.h"
 
 // for logger
 char debug_mode = 0;
 
-// Options
-typedef struct {
-    enum Mode mode;
-    enum OutFormat out_format;
-    unsigned task_num;
-    const char **tasks;
-    const char prefix[PATH_MAX];
-} GlobalContext;
-
-typedef struct {
-    float time_ms;
-    void *buf;
-    size_t buf_size;
-} IconInfo;
-
-typedef struct {
-    unsigned count;
-    uint32_t cx;
-    uint32_t cy;
-    uint32_t hotx;
-    uint32_t hoty;
-    uint32_t jif_rate;
-    char has_rate;  // has rate chunk
-    IconInfo *icons;
-} CursorData;
-
-static void collect_chunk_info(const Chunk *chunk, void *data) {
-    CursorData *d = (CursorData *)data;
-    switch (chunk->ty) {
-        case ty_anih: {
-            ChunkAnih *inner = chunk->inner;
-            d->count = inner->cFrames;
-            assert(inner->cFrames == inner->cSteps);
-            d->cx = inner->cx;
-            d->cy = inner->cy;
-            d->jif_rate = inner->jifRate;
-            d->icons = malloc(d->count * sizeof(IconInfo));
-            if (!d->icons) {
-                err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-            }
-            break;
-        }
-        case ty_rate: {
-            d->has_rate = 1;
-            if (d->icons) {
-                ChunkRate *inner = chunk->inner;
-                assert(d->count == inner->count);
-                for (unsigned i = 0; i < inner->count; ++i) {
-                    float duration = inner->jiffies[i] == 0 ? d->jif_rate * 1000.0 / 60.0
-                                                            : inner->jiffies[i] * 1000.0 / 60.0;
-                    d->icons[i].time_ms = duration;
-                }
-            }
-            break;
-        }
-        case ty_seq: {
-            break;
-        }
-        case ty_list: {
-            if (d->icons) {
-                ChunkList *inner = chunk->inner;
-                assert(inner->count == d->count);
-                for (unsigned i = 0; i < inner->count; ++i) {
-                    d->icons[i].buf = inner->frames[i]->buffer;
-                    d->icons[i].buf_size = inner->frames[i]->size;
-                }
-                d->hotx = inner->hotx;
-                d->hoty = inner->hoty;
-            }
-            break;
-        }
-        default: assert(0);
-    }
-    if (!d->has_rate) {
-        for (unsigned i = 0; i < d->count; ++i) {
-            d->icons[i].time_ms = d->jif_rate * 1000.0 / 60.0;
-        }
+// Optimize a file and replace it atomically, the original is kept if it does not shrink
+static int optimize_file(const GlobalContext *ctx, const char *path) {
+    FILE *target = fopen(path, "rb");
+    if (!target) {
+        err("Cannot open file `%s`", path);
+        return 1;
     }
-}
-
-// Helper function to create a directory and its parents if they don't exist
-static int create_dir_recursive(char *dir) {
-#define MKDIR(path) mkdir(path, 0755)
-    char *p = dir;
-    char tmp[256];  // Adjust size as needed
-    size_t len;
-
-    while (*p) {
-        p++;
-        if (*p == '/' || *p == '\\' || *p == '\0') {
-            len = p - dir;
-            if (len == 0)
-                continue;
-            memcpy(tmp, dir, len);
-            tmp[len] = '\0';
-
-            if (MKDIR(tmp) == 0) {
-                // Directory created successfully
-            } else if (errno != EEXIST) {
-                fprintf(stderr, "Failed to create directory '%s': %s\n", tmp, strerror(errno));
-                return -1;
-            }
-        }
+    struct stat st;
+    if (fstat(fileno(target), &st) != 0) {
+        err("Cannot stat file `%s`: %s", path, strerror(errno));
+        fclose(target);
+        return 1;
     }
-    return 0;
-#undef MKDIR
-}
-
-static void write_file(const char *path, const void *buf, size_t n) {
-    char *dir_path = strdup(path);
-    if (!dir_path) {
-        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-        return;
+    ParseOptions opts = {.recover = ctx->recover, .max_alloc = ctx->file_budget};
+    AniFile *ani = parse_ani_ex(target, &opts);
+    fclose(target);
+    if (!ani) {
+        return 1;
     }
-
-    // Find the last slash to get the directory path
-    char *last_slash = strrchr(dir_path, '/');
-    if (!last_slash) {
-        last_slash = strrchr(dir_path, '\\');
+    if (optimize_ani(ani)) {
+        cleanup_ani(ani);
+        return 1;
     }
 
-    if (last_slash) {
-        *last_slash = '\0';  // Null-terminate to get the directory path
-        if (create_dir_recursive(dir_path) != 0) {
-            free(dir_path);
-            return;
-        }
+    size_t path_len = strlen(path);
+    char *tmp_path = malloc(path_len + 8);
+    if (!tmp_path) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        cleanup_ani(ani);
+        return 1;
     }
-
-    free(dir_path);
-
-    FILE *out = fopen(path, "wb");
+    sprintf(tmp_path, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    FILE *out = fd < 0 ? NULL : fdopen(fd, "wb");
     if (!out) {
-        err("Failed to open %s: %s\n", path, strerror(errno));
-        return;
+        err("Cannot create temporary file for `%s`: %s", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        cleanup_ani(ani);
+        return 1;
     }
-
-    // Check if fwrite successfully wrote all n bytes
-    if (fwrite(buf, 1, n, out) != n) {
-        err("Failed to write all bytes to %s\n", path);
+    int res = write_ani(ani, out);
+    cleanup_ani(ani);
+    long new_size = ftell(out);
+    if (fflush(out) != 0 || fsync(fd) != 0 || fchmod(fd, st.st_mode & 07777) != 0) {
+        err("Cannot flush `%s`: %s", tmp_path, strerror(errno));
+        res = 1;
     }
-
     fclose(out);
-}
 
-const static char *basename(const char *name) {
-    const char *basename = strlen(name) + name;
-    while (basename != name && *(basename - 1) != '/') {
-        --basename;
+    char rewritten = 0;
+    if (!res && new_size < st.st_size) {
+        if (rename(tmp_path, path) != 0) {
+            err("Cannot replace `%s`: %s", path, strerror(errno));
+            res = 1;
+        } else {
+            rewritten = 1;
+        }
+    }
+    if (!rewritten) {
+        unlink(tmp_path);
+        new_size = st.st_size;
+    }
+    free(tmp_path);
+    if (res) {
+        return res;
     }
-    return basename;
-}
 
-static int emit_info(const GlobalContext *ctx, const CursorData *data, const char *filename) {
-    // Dump content(json)
-    // {
-    //   "name": xxx.ani,
-    //   "width": cx,
-    //   "height": cy,
-    //   "hotx": hotx,
-    //   "hoty": hoty
-    //   "frames": [
-    //      {
-    //        "path": "path/to/frame01.ico",
-    //        "duration": time_ms
-    //      },
-    //      {
-    //        "path": "path/to/frame02.ico",
-    //        "duration": time_ms
-    //      },
-    //      {
-    //        "path": "path/to/frame03.ico",
-    //        "duration": time_ms
-    //      }
-    //   ]
-    // }
-    const char *realname = basename(filename);
+    const char *realname = path_basename(path);
     switch (ctx->out_format) {
         case Json: {
-            StringBuilder *json = sb_new();
-            if (!json) {
-                err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                return 1;
-            }
-            sb_appendf(json, "{\"name\": \"%s\",", realname);
-            sb_appendf(json, "\"width\": %u,", data->cx);
-            sb_appendf(json, "\"height\": %u,", data->cy);
-            sb_appendf(json, "\"hotx\": %u,", data->hotx);
-            sb_appendf(json, "\"hoty\": %u,", data->hoty);
-            sb_appendf(json, "\"jif_rate\": %u,", data->jif_rate);
-            sb_appendf(json, "\"frames\": [");
-            if (data->count >= 1 && data->icons) {
-                for (unsigned i = 0; i < data->count - 1; ++i) {
-                    StringBuilder *path_buf = sb_new();
-                    if (!path_buf) {
-                        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                        return 1;
-                    }
-                    sb_appendf(path_buf, "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
-                    if (ctx->mode == Extract) {
-                        write_file(path_buf->data, data->icons[i].buf, data->icons[i].buf_size);
-                        debug("Writing to file `%s`", path_buf->data);
-                    }
-
-                    sb_appendf(json, "{\"path\": \"%s\",", path_buf->data);
-                    sb_appendf(json, "\"duration\": %.3f},", data->icons[i].time_ms);
-
-                    sb_cleanup(path_buf);
-                }
-
-                StringBuilder *path_buf = sb_new();
-                if (!path_buf) {
-                    err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                    return 1;
-                }
-                sb_appendf(path_buf,
-                           "%s/%s/frame-%03d.ico",
-                           ctx->prefix,
-                           realname,
-                           data->count - 1);
-                if (ctx->mode == Extract) {
-                    write_file(path_buf->data,
-                               data->icons[data->count - 1].buf,
-                               data->icons[data->count - 1].buf_size);
-                    debug("Writing to file `%s`", path_buf->data);
-                }
-
-                sb_appendf(json, "{\"path\": \"%s\",", path_buf->data);
-                sb_appendf(json, "\"duration\": %.3lf}", data->icons[data->count - 1].time_ms);
-
-                sb_cleanup(path_buf);
-            }
-            sb_appendf(json, "]}");
-            puts(json->data);
-            sb_cleanup(json);
-            return 0;
+            printf("{\"name\": \"%s\",\"before\": %ld,\"after\": %ld,\"rewritten\": %s}\n",
+                   realname,
+                   (long)st.st_size,
+                   new_size,
+                   rewritten ? "true" : "false");
+            break;
         }
         case Plain: {
-            StringBuilder *text = sb_new();
-            if (!text) {
-                err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                return 1;
-            }
-            sb_appendf(text, "Name: %s\n", realname);
-            sb_appendf(text, "Width: %u\n", data->cx);
-            sb_appendf(text, "Height: %u\n", data->cy);
-            sb_appendf(text, "HotX: %u\n", data->hotx);
-            sb_appendf(text, "HotY: %u\n", data->hoty);
-            sb_appendf(text, "JifRate: %u\n", data->jif_rate);
-            sb_appendf(text, "Frames:\n");
-            if (data->count >= 1 && data->icons) {
-                for (unsigned i = 0; i < data->count; ++i) {
-                    StringBuilder *path_buf = sb_new();
-                    if (!path_buf) {
-                        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                        return 1;
-                    }
-                    sb_appendf(text, "  Frame%3d\n", i);
-                    sb_appendf(path_buf, "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
-                    if (ctx->mode == Extract) {
-                        write_file(path_buf->data, data->icons[i].buf, data->icons[i].buf_size);
-                        debug("Writing to file `%s`", path_buf->data);
-                    }
-
-                    sb_appendf(text, "    Output file: %s\n", path_buf->data);
-                    sb_appendf(text, "    Duration: %.3f\n", data->icons[i].time_ms);
-
-                    sb_cleanup(path_buf);
-                }
-            }
-            puts(text->data);
-            sb_cleanup(text);
-            return 0;
-        }
-        case Silent: {
-            if (ctx->mode == Extract) {
-                warn("Begin to extract `%s`", filename);
-                for (unsigned i = 0; i < data->count; ++i) {
-                    StringBuilder *path_buf = sb_new();
-                    if (!path_buf) {
-                        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                        return 1;
-                    }
-                    sb_appendf(path_buf, "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
-                    debug("Writing to file `%s`", path_buf->data);
-                    sb_cleanup(path_buf);
-                }
-            }
-            return 0;
+            printf("Name: %s\nBefore: %ld\nAfter: %ld\n\n", realname, (long)st.st_size, new_size);
+            break;
         }
+        case Silent: break;
         default: assert(0);
     }
+    return 0;
 }
 
 static int run_task(const GlobalContext *ctx) {
+    if (ctx->mode == Serve) {
+        return serve(ctx);
+    }
+    if (ctx->mode == Watch) {
+        return watch(ctx);
+    }
+    if (ctx->mode == Merge) {
+        return merge_outputs(ctx);
+    }
     if (!ctx->task_num) {
         return 1;
     }
+    if (ctx->mode == Report) {
+        return run_report(ctx);
+    }
+    if (ctx->mode != Optimize) {
+        return run_pipeline(ctx);
+    }
     int ok = 0;
     for (unsigned i = 0; i < ctx->task_num; ++i) {
-        const char *path = ctx->tasks[i];
-        FILE *target = fopen(path, "rb");
-        if (!target) {
-            err("Cannot open file `%s`", path);
-            ok = 2;
-            continue;
-        }
-        AniFile *ani = parse_ani(target);
-        if (!ani) {
-            fclose(target);
-            return 1;
-        }
-        debug("Finish parsing `%s`", path);
-        WalkContext walk_ctx;
-        walk_ctx.ani = ani;
-        walk_ctx.visit_chunk = &collect_chunk_info;
-        walk_ctx.visit_frame = NULL;
-        CursorData data;
-        data.count = 0;
-        data.icons = NULL;
-        data.cx = 0;
-        data.cy = 0;
-        data.hotx = 0;
-        data.hoty = 0;
-        data.has_rate = 0;
-        walk_ctx.data = &data;
-        walk(&walk_ctx);
-        debug("Finish collecting info of `%s`", path);
-        ok = emit_info(ctx, &data, path);
-        if (data.icons) {
-            free(data.icons);
-        } else {
-            err("Cannot visit ani info");
+        if (optimize_file(ctx, ctx->tasks[i])) {
+            ok = 1;
         }
-        cleanup_ani(ani);
-        fclose(target);
     }
     return ok;
 }
@@ -366,19 +148,201 @@ static void print_help(const char *prog_name) {
     printf("-json       Display information as json\n");
     printf("-silent     Donnot display information\n");
     printf("-extract    Do the extract job\n");
+    printf("-optimize   Rewrite files smaller in place\n");
+    printf("-recover    Skip corrupt chunks instead of stopping\n");
+    printf("-serve      Serve requests on the assigned unix socket\n");
+    printf("-j          Assign number of worker threads\n");
+    printf("-watch      Extract files in the assigned dir as they change\n");
+    printf("-r          Take *.ani files under directories recursively\n");
+    printf("-tar        Take *.ani members of the assigned archive, or name one as a.tar:b.ani\n");
+    printf("-shard      Process only shard i of N (i/N) of the files\n");
+    printf("-shard-by-size  Balance shards by file size\n");
+    printf("-merge      Combine shard outputs, NDJSON files and -store dirs\n");
+    printf("-report     Print distributions of metadata over all files\n");
+    printf("-size       Extract only the icon entry closest to N px\n");
+    printf("-best       Extract only the largest icon entry\n");
+    printf("-store      Extract frames once by hash into the assigned dir\n");
+    printf("-link       Keep frame files as hard links into the store\n");
+    printf("-xcursor    Extract as Xcursor files\n");
+    printf("-bundle     Extract into the assigned single mappable bundle file\n");
+    printf("-delta      Bundle decoded frames as changes from the frame before\n");
+    printf("-scale      Resample decoded outputs by the assigned factors, e.g. 1,1.5,2\n");
+    printf("-filter     Assign resampling filter, lanczos or box\n");
+    printf("-mem-limit  Assign MiB of files in flight in a batch\n");
+    printf("-file-budget     Assign MiB a file may allocate while parsed\n");
+    printf("-process-budget  Assign MiB all files being parsed may allocate\n");
     printf("-o          Assign output rootdir\n");
     printf("-h          Show help menu\n");
 }
 
 static void cleanup_global_ctx(GlobalContext *ctx) {
     if (ctx) {
+        for (unsigned i = 0; i < ctx->archive_count; ++i) {
+            tar_close(ctx->archives[i]);
+        }
+        free(ctx->archives);
+        free(ctx->task_rel);
         if (ctx->tasks) {
+            for (unsigned i = 0; i < ctx->task_num; ++i) {
+                free((char *)ctx->tasks[i]);
+            }
             free(ctx->tasks);
         }
         free(ctx);
     }
 }
 
+typedef struct {
+    unsigned count;
+    unsigned capacity;
+    const char **paths;
+} TaskList;
+
+static int push_task(TaskList *list, const char *path) {
+    if (list->count + 1 > list->capacity) {
+        unsigned capacity = list->capacity ? list->capacity << 1 : 4;
+        const char **tmp = realloc(list->paths, capacity * sizeof(char *));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return 1;
+        }
+        list->paths = tmp;
+        list->capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    list->paths[list->count++] = copy;
+    return 0;
+}
+
+static void push_scanned(const char *path, void *data) {
+    push_task(data, path);
+}
+
+static int compare_path(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Archive of `path`, opened once for every task in it
+static TarArchive *open_archive(GlobalContext *ctx, const char *path) {
+    for (unsigned i = 0; i < ctx->archive_count; ++i) {
+        if (!strcmp(ctx->archives[i]->path, path)) {
+            return ctx->archives[i];
+        }
+    }
+    TarArchive **tmp = realloc(ctx->archives, (ctx->archive_count + 1) * sizeof(TarArchive *));
+    if (!tmp) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    ctx->archives = tmp;
+    TarArchive *tar = tar_open(path);
+    if (tar) {
+        ctx->archives[ctx->archive_count++] = tar;
+    }
+    return tar;
+}
+
+// Every `*.ani` member of an archive becomes an `archive.tar:member` task, in archive order
+static int push_tar_members(GlobalContext *ctx, TaskList *list, const char *path) {
+    size_t len = strlen(path);
+    if (len < 4 || strcmp(path + len - 4, ".tar")) {
+        err("Archive `%s` is not named *.tar", path);
+        return 0;
+    }
+    TarArchive *tar = open_archive(ctx, path);
+    for (unsigned i = 0; tar && i < tar->count; ++i) {
+        if (!is_ani_path(tar->members[i].name)) {
+            continue;
+        }
+        char task[PATH_MAX];
+        if (snprintf(task, sizeof(task), "%s:%s", path, tar->members[i].name) >= PATH_MAX) {
+            err("Member name `%s` is too long", tar->members[i].name);
+            continue;
+        }
+        if (push_task(list, task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Replace directories in tasks with the files under them, sorted so runs are reproducible
+static void expand_tasks(GlobalContext *ctx) {
+    TaskList list = {0, 0, NULL};
+    unsigned *rel = NULL;
+    char rel_ok = 1;
+    for (unsigned i = 0; i < ctx->task_num; ++i) {
+        struct stat st;
+        unsigned first = list.count, dir_len = 0;
+        if (stat(ctx->tasks[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            scan_dir(ctx->tasks[i], push_scanned, NULL, &list);
+            qsort(list.paths + first, list.count - first, sizeof(char *), compare_path);
+            dir_len = strlen(ctx->tasks[i]) + 1;
+        } else {
+            push_task(&list, ctx->tasks[i]);
+        }
+        // Files under a dir are also known by their path below it, see `task_rel`
+        unsigned *tmp = rel_ok ? realloc(rel, (list.count + 1) * sizeof(unsigned)) : NULL;
+        if (!tmp) {
+            free(rel);
+            rel = NULL;
+            rel_ok = 0;
+        } else {
+            rel = tmp;
+            for (unsigned k = first; k < list.count; ++k) {
+                rel[k] = dir_len;
+            }
+        }
+        free((char *)ctx->tasks[i]);
+    }
+    free(ctx->tasks);
+    ctx->tasks = list.paths;
+    ctx->task_num = list.count;
+    ctx->task_rel = rel;
+}
+
+// `i/N` with 1 <= i <= N, both plain decimal numbers
+static int parse_shard(GlobalContext *ctx, const char *arg) {
+    char *end;
+    if (*arg < '0' || *arg > '9') {
+        return 1;
+    }
+    unsigned long index = strtoul(arg, &end, 10);
+    if (*end != '/' || end[1] < '0' || end[1] > '9') {
+        return 1;
+    }
+    unsigned long count = strtoul(end + 1, &end, 10);
+    if (*end || !index || index > count || count > UINT32_MAX) {
+        return 1;
+    }
+    ctx->shard_index = index - 1;
+    ctx->shard_count = count;
+    return 0;
+}
+
+// Comma separated factors, e.g. `1,1.5,2`
+static int parse_scales(GlobalContext *ctx, const char *arg) {
+    unsigned count = 0;
+    while (*arg) {
+        char *end;
+        float scale = strtof(arg, &end);
+        if (end == arg || scale <= 0 || scale > 16 || count == MAX_SCALES) {
+            return 1;
+        }
+        ctx->scales[count++] = scale;
+        arg = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') {
+            return 1;
+        }
+    }
+    ctx->scale_count = count;
+    return count ? 0 : 1;
+}
+
 static GlobalContext *parse_args(int argc, char **argv) {
     char print_help_and_exit = 0;
     int i = 1;
@@ -389,14 +353,33 @@ static GlobalContext *parse_args(int argc, char **argv) {
     }
     ctx->mode = Describe;
     ctx->out_format = Plain;
+    ctx->recover = 0;
+    ctx->jobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    ctx->socket_path = NULL;
+    ctx->watch_path = NULL;
+    ctx->recursive = 0;
+    ctx->shard_index = 0;
+    ctx->shard_count = 0;
+    ctx->shard_by_size = 0;
+    ctx->select_size = 0;
+    ctx->select_best = 0;
+    ctx->store_dir = NULL;
+    ctx->store_link = 0;
+    ctx->xcursor = 0;
+    ctx->bundle_path = NULL;
+    ctx->bundle = NULL;
+    ctx->delta = 0;
+    ctx->scale_count = 0;
+    ctx->filter = FilterLanczos;
+    ctx->mem_limit = (size_t)256 << 20;
+    ctx->file_budget = 0;
+    ctx->process_budget = 0;
+    ctx->archive_count = 0;
+    ctx->archives = NULL;
+    ctx->task_rel = NULL;
     ctx->task_num = 0;
-    unsigned capacity = 4;
-    ctx->tasks = malloc(capacity * sizeof(char *));
-    if (!ctx->tasks) {
-        cleanup_global_ctx(ctx);
-        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-        return NULL;
-    }
+    TaskList tasks = {0, 0, NULL};
+    ctx->tasks = NULL;
     if (!getcwd((char *)ctx->prefix, PATH_MAX)) {
         err("Cannot get cwd as prefix");
         cleanup_global_ctx(ctx);
@@ -414,6 +397,126 @@ static GlobalContext *parse_args(int argc, char **argv) {
             ctx->out_format = Silent;
         } else if (is_arg("-extract")) {
             ctx->mode = Extract;
+        } else if (is_arg("-optimize")) {
+            ctx->mode = Optimize;
+        } else if (is_arg("-recover")) {
+            ctx->recover = 1;
+        } else if (is_arg("-serve")) {
+            if (i + 1 >= argc || *argv[i + 1] == '-') {
+                warn("No socket is assigned after '-serve'");
+            } else {
+                ctx->mode = Serve;
+                ctx->socket_path = argv[i + 1];
+                ++i;
+            }
+        } else if (is_arg("-watch")) {
+            if (i + 1 >= argc || *argv[i + 1] == '-') {
+                warn("No dir is assigned after '-watch'");
+            } else {
+                ctx->mode = Watch;
+                ctx->watch_path = argv[i + 1];
+                ++i;
+            }
+        } else if (is_arg("-shard")) {
+            // A bad shard must not fall back to the whole list, every node would process it all
+            if (i + 1 >= argc || parse_shard(ctx, argv[i + 1]) != 0) {
+                err("No shard (i/N, 1 <= i <= N) is assigned after '-shard'");
+                ctx->tasks = tasks.paths;
+                ctx->task_num = tasks.count;
+                cleanup_global_ctx(ctx);
+                return NULL;
+            }
+            ++i;
+        } else if (is_arg("-shard-by-size")) {
+            ctx->shard_by_size = 1;
+        } else if (is_arg("-merge")) {
+            ctx->mode = Merge;
+        } else if (is_arg("-report")) {
+            ctx->mode = Report;
+        } else if (is_arg("-r")) {
+            ctx->recursive = 1;
+        } else if (is_arg("-size")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                warn("No size is assigned after '-size'");
+            } else {
+                ctx->select_size = atoi(argv[i + 1]);
+                ++i;
+            }
+        } else if (is_arg("-store")) {
+            if (i + 1 >= argc) {
+                warn("No dir is assigned after '-store'");
+            } else {
+                ctx->store_dir = argv[i + 1];
+                if (ctx->mode == Describe) {
+                    ctx->mode = Extract;
+                }
+                ++i;
+            }
+        } else if (is_arg("-bundle")) {
+            if (i + 1 >= argc) {
+                warn("No file is assigned after '-bundle'");
+            } else {
+                ctx->bundle_path = argv[i + 1];
+                if (ctx->mode == Describe) {
+                    ctx->mode = Extract;
+                }
+                ++i;
+            }
+        } else if (is_arg("-delta")) {
+            ctx->delta = 1;
+        } else if (is_arg("-xcursor")) {
+            ctx->xcursor = 1;
+            if (ctx->mode == Describe) {
+                ctx->mode = Extract;
+            }
+        } else if (is_arg("-scale")) {
+            if (i + 1 >= argc || parse_scales(ctx, argv[i + 1]) != 0) {
+                warn("No valid scale list is assigned after '-scale'");
+            } else {
+                ++i;
+            }
+        } else if (is_arg("-filter")) {
+            if (i + 1 < argc && !strcmp(argv[i + 1], "box")) {
+                ctx->filter = FilterBox;
+                ++i;
+            } else if (i + 1 < argc && !strcmp(argv[i + 1], "lanczos")) {
+                ctx->filter = FilterLanczos;
+                ++i;
+            } else {
+                warn("No filter (box, lanczos) is assigned after '-filter'");
+            }
+        } else if (is_arg("-link")) {
+            ctx->store_link = 1;
+        } else if (is_arg("-best")) {
+            ctx->select_best = 1;
+        } else if (is_arg("-mem-limit")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                warn("No size is assigned after '-mem-limit'");
+            } else {
+                ctx->mem_limit = (size_t)atoi(argv[i + 1]) << 20;
+                ++i;
+            }
+        } else if (is_arg("-file-budget")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                warn("No size is assigned after '-file-budget'");
+            } else {
+                ctx->file_budget = (size_t)atoi(argv[i + 1]) << 20;
+                ++i;
+            }
+        } else if (is_arg("-process-budget")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                warn("No size is assigned after '-process-budget'");
+            } else {
+                ctx->process_budget = (size_t)atoi(argv[i + 1]) << 20;
+                ++i;
+            }
+        } else if (is_arg("-j")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                warn("No thread number is assigned after '-j'");
+            } else {
+                ctx->jobs = atoi(argv[i + 1]);
+                ++i;
+            }
         } else if (is_arg("-o")) {
             if (i + 1 >= argc || *argv[i + 1] == '-') {
                 warn("No path is assigned after '-o'");
@@ -421,31 +524,76 @@ static GlobalContext *parse_args(int argc, char **argv) {
                 strcpy((char *)ctx->prefix, argv[i + 1]);
                 ++i;
             }
+        } else if (is_arg("-tar")) {
+            if (i + 1 >= argc) {
+                warn("No archive is assigned after '-tar'");
+            } else if (push_tar_members(ctx, &tasks, argv[i + 1])) {
+                ctx->tasks = tasks.paths;
+                ctx->task_num = tasks.count;
+                cleanup_global_ctx(ctx);
+                return NULL;
+            } else {
+                ++i;
+            }
         } else if (*argv[i] == '-') {
             warn("Not an option: `%s`", argv[i]);
         } else {
             // push a task
-            if (ctx->task_num + 1 > capacity) {
-                capacity <<= 1;
-                const char **tmp = realloc(ctx->tasks, capacity * sizeof(char *));
-                if (!tmp) {
-                    cleanup_global_ctx(ctx);
-                    err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
-                    return NULL;
-                }
-                ctx->tasks = tmp;
+            if (push_task(&tasks, argv[i])) {
+                ctx->tasks = tasks.paths;
+                ctx->task_num = tasks.count;
+                cleanup_global_ctx(ctx);
+                return NULL;
             }
-            ctx->tasks[ctx->task_num++] = argv[i];
         }
 #undef is_arg
         ++i;
     }
+    ctx->tasks = tasks.paths;
+    ctx->task_num = tasks.count;
+    if (ctx->delta && !ctx->bundle_path) {
+        err("'-delta' needs '-bundle', deltas are only stored in bundles");
+        cleanup_global_ctx(ctx);
+        return NULL;
+    }
+    if (ctx->scale_count && !ctx->xcursor && !ctx->delta) {
+        err("'-scale' needs '-xcursor' or '-delta', other outputs keep frames as they are");
+        cleanup_global_ctx(ctx);
+        return NULL;
+    }
+    if (ctx->scale_count > 1 && ctx->delta && !ctx->xcursor) {
+        err("'-delta' takes a single '-scale' factor, a bundle record has one canvas");
+        cleanup_global_ctx(ctx);
+        return NULL;
+    }
+    if (ctx->recursive) {
+        expand_tasks(ctx);
+    }
+    // Archives are mapped once here, tasks in them are read in place later
+    for (unsigned k = 0; ctx->mode != Merge && k < ctx->task_num; ++k) {
+        char archive[PATH_MAX];
+        const char *member;
+        if (split_tar_path(ctx->tasks[k], archive, &member)) {
+            open_archive(ctx, archive);
+        }
+    }
+    if (ctx->shard_count && ctx->mode != Merge && shard_tasks(ctx) != 0) {
+        cleanup_global_ctx(ctx);
+        return NULL;
+    }
     if (debug_mode) {
         debug("Output format: %s",
               ctx->out_format == Json    ? "Json"
               : ctx->out_format == Plain ? "Plain"
                                          : "Silent");
-        debug("Mode: %s", ctx->mode == Extract ? "Extract" : "Describe");
+        debug("Mode: %s",
+              ctx->mode == Extract    ? "Extract"
+              : ctx->mode == Optimize ? "Optimize"
+              : ctx->mode == Serve    ? "Serve"
+              : ctx->mode == Watch    ? "Watch"
+              : ctx->mode == Merge    ? "Merge"
+              : ctx->mode == Report   ? "Report"
+                                      : "Describe");
         debug("Prefix: %s", ctx->prefix);
         if (!ctx->task_num) {
             warn("No file to convert");
@@ -473,7 +621,19 @@ int main(int argc, char **argv) {
         warn("Cannot parse args");
         return 1;
     }
+    ani_set_process_budget(ctx->process_budget);
+    // A bundle collects a whole batch, it is published once every file is in
+    if (ctx->bundle_path && ctx->mode == Extract) {
+        ctx->bundle = anib_create(ctx->bundle_path);
+        if (!ctx->bundle) {
+            cleanup_global_ctx(ctx);
+            return 1;
+        }
+    }
     int res = run_task(ctx);
+    if (ctx->bundle && anib_finish(ctx->bundle) != 0) {
+        res = 1;
+    }
     cleanup_global_ctx(ctx);
     return res;
 }
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "debug.h"
+
+// FNV-1a, only used to avoid memcmp between frames that surely differ
+static uint64_t hash_frame(const Frame *f) {
+    const uint8_t *p = f->buffer;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < f->size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// A chunk built from scratch, it is released by the handler of its FourCC like a parsed one
+static Chunk *new_chunk(uint32_t fourcc, void *inner) {
+    const ChunkHandler *handler = ani_find_handler(fourcc, 0);
+    if (!handler) {
+        err("No handler of chunk '%.4s'", (const char *)&fourcc);
+        return NULL;
+    }
+    Chunk *chunk = malloc(sizeof(Chunk));
+    if (!chunk) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    chunk->size = 0;
+    chunk->off = 0;
+    chunk->ty = handler->ty;
+    chunk->fourcc = fourcc;
+    chunk->handler = handler;
+    chunk->inner = inner;
+    return chunk;
+}
+
+// Rewrite the chunk model into its smallest equivalent form:
+//  - duplicated chunks are dropped, parser has already skipped INFO lists and unknown chunks
+//  - byte-identical frames are collapsed, steps refer to them through `seq `
+//  - uniform `rate` is folded into `anih.jifRate`
+//  - `seq ` is dropped when it is the identity
+// Returns 0 when the model is rewritten, otherwise the model is left untouched
+int optimize_ani(AniFile *ani) {
+    Chunk *anih_chunk = NULL, *seq_chunk = NULL, *rate_chunk = NULL, *list_chunk = NULL;
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        Chunk *c = ani->chunks[i];
+        switch (c->ty) {
+            case ty_anih: anih_chunk = anih_chunk ? anih_chunk : c; break;
+            case ty_seq: seq_chunk = seq_chunk ? seq_chunk : c; break;
+            case ty_rate: rate_chunk = rate_chunk ? rate_chunk : c; break;
+            case ty_list: list_chunk = list_chunk ? list_chunk : c; break;
+            default: break;
+        }
+    }
+    if (!anih_chunk || !list_chunk) {
+        warn("No anih or frame list, skip optimizing");
+        return 1;
+    }
+    ChunkAnih *anih = anih_chunk->inner;
+    ChunkList *list = list_chunk->inner;
+    ChunkSeq *seq = seq_chunk ? seq_chunk->inner : NULL;
+    ChunkRate *rate = rate_chunk ? rate_chunk->inner : NULL;
+
+    unsigned step_count = seq ? seq->count : list->count;
+    if (!step_count) {
+        warn("Animation has no step, skip optimizing");
+        return 1;
+    }
+    if (seq) {
+        for (unsigned i = 0; i < seq->count; ++i) {
+            if (seq->indexes[i] >= list->count) {
+                warn("seq[%u] = %u is out of range, skip optimizing", i, seq->indexes[i]);
+                return 1;
+            }
+        }
+    }
+    if (rate && rate->count != step_count) {
+        warn("rate has %u entries but there are %u steps, skip optimizing",
+             rate->count,
+             step_count);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < list->count; ++i) {
+        if (!list->frames[i]->buffer) {
+            warn("Frame `%u` is not loaded, skip optimizing", i);
+            return 1;
+        }
+    }
+
+    // Collapse identical frames, remap[old] = new
+    unsigned *remap = malloc(list->count * sizeof(unsigned));
+    uint64_t *hashes = malloc(list->count * sizeof(uint64_t));
+    unsigned *steps = malloc(step_count * sizeof(unsigned));
+    if (!remap || !hashes || !steps) {
+        free(remap);
+        free(hashes);
+        free(steps);
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    unsigned frame_count = 0;
+    for (unsigned i = 0; i < list->count; ++i) {
+        Frame *f = list->frames[i];
+        hashes[i] = hash_frame(f);
+        remap[i] = frame_count;
+        for (unsigned j = 0; j < i; ++j) {
+            Frame *g = list->frames[j];
+            if (hashes[i] == hashes[j] && f->size == g->size &&
+                !memcmp(f->buffer, g->buffer, f->size)) {
+                remap[i] = remap[j];
+                break;
+            }
+        }
+        if (remap[i] != frame_count) {
+            debug("Frame `%u` is identical to frame `%u`", i, remap[i]);
+            continue;
+        }
+        ++frame_count;
+    }
+
+    char identity = frame_count == step_count;
+    for (unsigned i = 0; i < step_count; ++i) {
+        steps[i] = remap[seq ? seq->indexes[i] : i];
+        identity = identity && steps[i] == i;
+    }
+    free(hashes);
+
+    // Allocate what the rewrite needs before touching the model
+    ChunkSeq *new_seq = NULL;
+    Chunk *new_seq_chunk = NULL;
+    if (!identity && !seq) {
+        new_seq = malloc(sizeof(ChunkSeq));
+        new_seq_chunk = new_seq ? new_chunk(ANI_FOURCC('s', 'e', 'q', ' '), new_seq) : NULL;
+        if (!new_seq_chunk) {
+            if (!new_seq) {
+                err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            }
+            free(new_seq);
+            free(remap);
+            free(steps);
+            return 1;
+        }
+    }
+
+    // Frames are compacted in place, keep the first of every group
+    for (unsigned i = 0, j = 0; i < list->count; ++i) {
+        if (remap[i] == j) {
+            list->frames[j++] = list->frames[i];
+        } else {
+            Frame *dup = list->frames[i];
+            free(dup->buffer);
+            free(dup);
+        }
+    }
+    info("Collapsed %u frames into %u", list->count, frame_count);
+    list->count = frame_count;
+    free(remap);
+
+    // Fold uniform rate
+    char uniform = rate != NULL;
+    for (unsigned i = 1; rate && i < rate->count; ++i) {
+        uniform = uniform && rate->jiffies[i] == rate->jiffies[0];
+    }
+    if (uniform && rate->jiffies[0] != 0) {
+        info("Fold uniform rate %u into jifRate", rate->jiffies[0]);
+        anih->jifRate = rate->jiffies[0];
+        rate_chunk = NULL;
+    }
+
+    if (identity) {
+        free(steps);
+        seq_chunk = NULL;
+    } else {
+        if (new_seq) {
+            seq = new_seq;
+            seq_chunk = new_seq_chunk;
+        } else {
+            free(seq->indexes);
+        }
+        seq->count = step_count;
+        seq->indexes = steps;
+    }
+
+    anih->cbSize = 36;
+    anih->cFrames = frame_count;
+    anih->cSteps = step_count;
+    anih->flags = seq_chunk ? (anih->flags | AF_SEQUENCE) : (anih->flags & ~AF_SEQUENCE);
+
+    // Rebuild chunk array in canonical order, anything else is released
+    Chunk *keep[4] = {anih_chunk, rate_chunk, seq_chunk, list_chunk};
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        Chunk *c = ani->chunks[i];
+        if (c != anih_chunk && c != rate_chunk && c != seq_chunk && c != list_chunk) {
+            cleanup_chunk(c);
+        }
+    }
+    ani->chunk_count = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        if (keep[i]) {
+            ani->chunks[ani->chunk_count++] = keep[i];
+        }
+    }
+    return 0;
+}
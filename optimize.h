@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ani.h"
+
+// anih.flags bits
+#define AF_ICON 0x1
+#define AF_SEQUENCE 0x2
+
+int optimize_ani(AniFile *ani);
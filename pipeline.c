@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "debug.h"
+
+// Batch is split into three stages, each on its own thread:
+//   reader   opens files and starts readahead of them
+//   parser   parses and collects info
+//   emitter  writes frames and prints, on the calling thread
+// Queues between stages are bounded, and the reader stops once the files in flight exceed
+// `mem_limit`, so reads, parsing and writes overlap while memory stays bounded
+#define QUEUE_SIZE 64
+
+typedef struct {
+    const char *path;
+    FILE *file;
+    size_t cost;
+    ParsedFile *parsed;
+} Job;
+
+typedef struct {
+    Job *items[QUEUE_SIZE];
+    unsigned head;
+    unsigned count;
+    char closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} JobQueue;
+
+typedef struct {
+    const GlobalContext *ctx;
+    JobQueue read_queue;
+    JobQueue parse_queue;
+    size_t in_flight;
+    pthread_mutex_t mem_lock;
+    pthread_cond_t mem_freed;
+} Pipeline;
+
+static void queue_init(JobQueue *q) {
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(JobQueue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static void queue_push(JobQueue *q, Job *job) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == QUEUE_SIZE) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->items[(q->head + q->count) % QUEUE_SIZE] = job;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void queue_close(JobQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// NULL once the queue is closed and drained
+static Job *queue_pop(JobQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (!q->count && !q->closed) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    Job *job = NULL;
+    if (q->count) {
+        job = q->items[q->head];
+        q->head = (q->head + 1) % QUEUE_SIZE;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+// A single job larger than the limit is still let through once nothing else is in flight
+static void acquire_memory(Pipeline *p, size_t cost) {
+    pthread_mutex_lock(&p->mem_lock);
+    while (p->in_flight && p->in_flight + cost > p->ctx->mem_limit) {
+        pthread_cond_wait(&p->mem_freed, &p->mem_lock);
+    }
+    p->in_flight += cost;
+    pthread_mutex_unlock(&p->mem_lock);
+}
+
+static void release_memory(Pipeline *p, size_t cost) {
+    pthread_mutex_lock(&p->mem_lock);
+    p->in_flight -= cost;
+    pthread_cond_signal(&p->mem_freed);
+    pthread_mutex_unlock(&p->mem_lock);
+}
+
+static void *read_stage(void *arg) {
+    Pipeline *p = arg;
+    for (unsigned i = 0; i < p->ctx->task_num; ++i) {
+        Job *job = malloc(sizeof(Job));
+        if (!job) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            break;
+        }
+        job->path = p->ctx->tasks[i];
+        job->cost = 0;
+        job->parsed = NULL;
+        job->file = open_task(p->ctx, job->path, &job->cost);
+        if (job->file) {
+            int fd = fileno(job->file);
+            acquire_memory(p, job->cost);
+            // Kernel reads ahead asynchronously while earlier files are parsed and written, a
+            // member of an archive has no fd and the mapped archive is already read sequentially
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            }
+        }
+        queue_push(&p->read_queue, job);
+    }
+    queue_close(&p->read_queue);
+    return NULL;
+}
+
+static void *parse_stage(void *arg) {
+    Pipeline *p = arg;
+    Job *job;
+    while ((job = queue_pop(&p->read_queue))) {
+        if (job->file) {
+            job->parsed = parse_file(p->ctx, job->file, job->path);
+        }
+        queue_push(&p->parse_queue, job);
+    }
+    queue_close(&p->parse_queue);
+    return NULL;
+}
+
+int run_pipeline(const GlobalContext *ctx) {
+    StringBuilder *out = sb_new();
+    Pipeline *p = malloc(sizeof(Pipeline));
+    if (!out || !p) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        sb_cleanup(out);
+        free(p);
+        return 1;
+    }
+    p->ctx = ctx;
+    p->in_flight = 0;
+    queue_init(&p->read_queue);
+    queue_init(&p->parse_queue);
+    pthread_mutex_init(&p->mem_lock, NULL);
+    pthread_cond_init(&p->mem_freed, NULL);
+
+    int ok = 0;
+    pthread_t reader, parser;
+    char has_parser = pthread_create(&parser, NULL, parse_stage, p) == 0;
+    char has_reader = has_parser && pthread_create(&reader, NULL, read_stage, p) == 0;
+    if (!has_reader) {
+        err("Cannot start pipeline: %s", strerror(errno));
+        queue_close(&p->read_queue);
+        queue_close(&p->parse_queue);
+        ok = 1;
+    }
+
+    Job *job;
+    while ((job = queue_pop(&p->parse_queue))) {
+        if (!job->file) {
+            err("Cannot open file `%s`", job->path);
+            ok = 2;
+        } else if (!job->parsed) {
+            ok = 1;
+        } else {
+            sb_reset(out);
+            if (emit_file(ctx, job->parsed, job->path, out)) {
+                ok = 1;
+            }
+            fputs(out->data, stdout);
+            cleanup_parsed_file(job->parsed);
+        }
+        if (job->file) {
+            fclose(job->file);
+            release_memory(p, job->cost);
+        }
+        free(job);
+    }
+
+    if (has_reader) {
+        pthread_join(reader, NULL);
+    }
+    if (has_parser) {
+        pthread_join(parser, NULL);
+    }
+    queue_destroy(&p->read_queue);
+    queue_destroy(&p->parse_queue);
+    pthread_mutex_destroy(&p->mem_lock);
+    pthread_cond_destroy(&p->mem_freed);
+    free(p);
+    sb_cleanup(out);
+    return ok;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "task.h"
+
+int run_pipeline(const GlobalContext *ctx);
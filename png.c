@@ -0,0 +1,774 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "png.h"
+#include "debug.h"
+
+// Larger images are not icons, and would overflow the size math below
+#define PNG_MAX_DIM 4096
+
+// Huffman codes are at most 15 bits, codes up to FAST_BITS long resolve with a single lookup
+#define MAX_BITS 15
+#define FAST_BITS 10
+#define MAX_LIT_CODES 288
+#define MAX_DIST_CODES 30
+
+#define ADLER_MOD 65521
+// Most bytes summed before the sums may overflow 32 bits
+#define ADLER_NMAX 5552
+
+static const uint8_t png_sig[PNG_SIGNATURE_SIZE] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static uint32_t crc_table[8][256];
+
+// Slice-by-8 tables, table k advances a byte through k more zero bytes
+__attribute__((constructor)) static void init_crc_table(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+        }
+    }
+}
+
+static uint32_t u32_le(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t u32_be(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Running checksums, start with 0 for CRC32 and 1 for Adler32
+static uint32_t png_crc32(uint32_t crc, const uint8_t *buf, size_t n) {
+    crc = ~crc;
+    while (n >= 8) {
+        uint32_t a = crc ^ u32_le(buf);
+        uint32_t b = u32_le(buf + 4);
+        crc = crc_table[7][a & 0xFF] ^ crc_table[6][(a >> 8) & 0xFF] ^
+              crc_table[5][(a >> 16) & 0xFF] ^ crc_table[4][a >> 24] ^ crc_table[3][b & 0xFF] ^
+              crc_table[2][(b >> 8) & 0xFF] ^ crc_table[1][(b >> 16) & 0xFF] ^
+              crc_table[0][b >> 24];
+        buf += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = crc_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Blocks of 16 bytes add their weighted sum to `b` at once, which the compiler vectorizes
+static uint32_t png_adler32(uint32_t adler, const uint8_t *buf, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n) {
+        size_t k = n < ADLER_NMAX ? n : ADLER_NMAX;
+        n -= k;
+        for (; k >= 16; k -= 16, buf += 16) {
+            uint32_t sum = 0, weighted = 0;
+            for (unsigned i = 0; i < 16; ++i) {
+                sum += buf[i];
+                weighted += (16 - i) * buf[i];
+            }
+            b += a * 16 + weighted;
+            a += sum;
+        }
+        while (k--) {
+            a += *buf++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return b << 16 | a;
+}
+
+int is_png(const uint8_t *buf, size_t size) {
+    return size >= PNG_SIGNATURE_SIZE && !memcmp(buf, png_sig, PNG_SIGNATURE_SIZE);
+}
+
+typedef struct {
+    uint16_t fast[1 << FAST_BITS];  // length << 9 | symbol, 0 for longer codes
+    uint16_t count[MAX_BITS + 1];  // codes of each length
+    uint16_t symbol[MAX_LIT_CODES];  // symbols ordered by code
+} Huffman;
+
+typedef struct {
+    const uint8_t *in;
+    size_t in_size;
+    size_t pos;
+    uint64_t bits;
+    unsigned nbits;
+    unsigned pad;  // zero bits fed past the end of the input
+    uint8_t *out;
+    size_t out_size;
+    size_t out_pos;
+} Inflater;
+
+static void refill(Inflater *s) {
+    while (s->nbits <= 56) {
+        uint64_t byte = 0;
+        if (s->pos < s->in_size) {
+            byte = s->in[s->pos++];
+        } else {
+            s->pad += 8;
+        }
+        s->bits |= byte << s->nbits;
+        s->nbits += 8;
+    }
+}
+
+// Whether bits past the end of the input were consumed
+static int overrun(const Inflater *s) {
+    return s->nbits < s->pad;
+}
+
+static uint32_t get_bits(Inflater *s, unsigned n) {
+    if (s->nbits < n) {
+        refill(s);
+    }
+    uint32_t v = s->bits & ((1u << n) - 1);
+    s->bits >>= n;
+    s->nbits -= n;
+    return v;
+}
+
+static unsigned reverse_bits(unsigned code, unsigned len) {
+    unsigned r = 0;
+    while (len--) {
+        r = r << 1 | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+// Incomplete codes are allowed, a distance tree may hold a single code
+static int build_huffman(Huffman *h, const uint8_t *lengths, unsigned n) {
+    memset(h->count, 0, sizeof(h->count));
+    for (unsigned i = 0; i < n; ++i) {
+        h->count[lengths[i]]++;
+    }
+    h->count[0] = 0;
+    int left = 1;
+    for (unsigned len = 1; len <= MAX_BITS; ++len) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) {
+            return 1;
+        }
+    }
+
+    uint16_t offs[MAX_BITS + 2];
+    uint16_t next_code[MAX_BITS + 1];
+    offs[1] = 0;
+    next_code[0] = 0;
+    unsigned code = 0;
+    for (unsigned len = 1; len <= MAX_BITS; ++len) {
+        offs[len + 1] = offs[len] + h->count[len];
+        code = (code + h->count[len - 1]) << 1;
+        next_code[len] = code;
+    }
+    memset(h->fast, 0, sizeof(h->fast));
+    for (unsigned sym = 0; sym < n; ++sym) {
+        unsigned len = lengths[sym];
+        if (!len) {
+            continue;
+        }
+        h->symbol[offs[len]++] = sym;
+        unsigned c = next_code[len]++;
+        if (len <= FAST_BITS) {
+            for (unsigned j = reverse_bits(c, len); j < (1u << FAST_BITS); j += 1u << len) {
+                h->fast[j] = len << 9 | sym;
+            }
+        }
+    }
+    return 0;
+}
+
+// -1 on an invalid code
+static int decode_symbol(Inflater *s, const Huffman *h) {
+    if (s->nbits < MAX_BITS) {
+        refill(s);
+    }
+    uint16_t e = h->fast[s->bits & ((1u << FAST_BITS) - 1)];
+    if (e) {
+        unsigned len = e >> 9;
+        s->bits >>= len;
+        s->nbits -= len;
+        return e & 0x1FF;
+    }
+    // Canonical decoding, codes are stored MSB first
+    uint64_t bits = s->bits;
+    int code = 0, first = 0, index = 0;
+    for (unsigned len = 1; len <= MAX_BITS; ++len) {
+        code |= bits & 1;
+        bits >>= 1;
+        int count = h->count[len];
+        if (code - count < first) {
+            s->bits >>= len;
+            s->nbits -= len;
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static const uint16_t len_base[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                      31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                      2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                       33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                       1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385,
+                                       24577};
+static const uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                       6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static int inflate_codes(Inflater *s, const Huffman *lit, const Huffman *dist) {
+    for (;;) {
+        int sym = decode_symbol(s, lit);
+        if (sym < 0 || overrun(s)) {
+            err("Bad literal/length code");
+            return 1;
+        }
+        if (sym < 256) {
+            if (s->out_pos == s->out_size) {
+                err("Inflated data too large");
+                return 1;
+            }
+            s->out[s->out_pos++] = sym;
+            continue;
+        }
+        if (sym == 256) {
+            return 0;
+        }
+        sym -= 257;
+        if (sym >= 29) {
+            err("Bad length code %d", sym + 257);
+            return 1;
+        }
+        size_t len = len_base[sym] + get_bits(s, len_extra[sym]);
+        int dsym = decode_symbol(s, dist);
+        if (dsym < 0 || dsym >= 30 || overrun(s)) {
+            err("Bad distance code");
+            return 1;
+        }
+        size_t d = dist_base[dsym] + get_bits(s, dist_extra[dsym]);
+        if (d > s->out_pos || len > s->out_size - s->out_pos) {
+            err("Bad back reference");
+            return 1;
+        }
+        // Byte by byte, the source may overlap what is being written
+        uint8_t *dst = s->out + s->out_pos;
+        const uint8_t *src = dst - d;
+        for (size_t i = 0; i < len; ++i) {
+            dst[i] = src[i];
+        }
+        s->out_pos += len;
+    }
+}
+
+static int inflate_stored(Inflater *s) {
+    get_bits(s, s->nbits % 8);
+    uint32_t len = get_bits(s, 16);
+    uint32_t nlen = get_bits(s, 16);
+    if (len != (~nlen & 0xFFFF) || overrun(s)) {
+        err("Bad stored block");
+        return 1;
+    }
+    if (len > s->out_size - s->out_pos) {
+        err("Inflated data too large");
+        return 1;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+        s->out[s->out_pos++] = get_bits(s, 8);
+    }
+    return overrun(s);
+}
+
+static int inflate_fixed(Inflater *s) {
+    uint8_t lengths[MAX_LIT_CODES + MAX_DIST_CODES];
+    unsigned i = 0;
+    for (; i < 144; ++i) {
+        lengths[i] = 8;
+    }
+    for (; i < 256; ++i) {
+        lengths[i] = 9;
+    }
+    for (; i < 280; ++i) {
+        lengths[i] = 7;
+    }
+    for (; i < MAX_LIT_CODES; ++i) {
+        lengths[i] = 8;
+    }
+    for (; i < MAX_LIT_CODES + MAX_DIST_CODES; ++i) {
+        lengths[i] = 5;
+    }
+    Huffman lit, dist;
+    build_huffman(&lit, lengths, MAX_LIT_CODES);
+    build_huffman(&dist, lengths + MAX_LIT_CODES, MAX_DIST_CODES);
+    return inflate_codes(s, &lit, &dist);
+}
+
+static int inflate_dynamic(Inflater *s) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    unsigned nlen = get_bits(s, 5) + 257;
+    unsigned ndist = get_bits(s, 5) + 1;
+    unsigned ncode = get_bits(s, 4) + 4;
+    if (nlen > MAX_LIT_CODES || ndist > MAX_DIST_CODES) {
+        err("Bad dynamic block header");
+        return 1;
+    }
+    uint8_t lengths[MAX_LIT_CODES + MAX_DIST_CODES];
+    memset(lengths, 0, 19);
+    for (unsigned i = 0; i < ncode; ++i) {
+        lengths[order[i]] = get_bits(s, 3);
+    }
+    Huffman lencode;
+    if (build_huffman(&lencode, lengths, 19) != 0) {
+        err("Bad code length code");
+        return 1;
+    }
+
+    unsigned i = 0;
+    while (i < nlen + ndist) {
+        int sym = decode_symbol(s, &lencode);
+        if (sym < 0 || overrun(s)) {
+            err("Bad code length");
+            return 1;
+        }
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+        uint8_t len = 0;
+        unsigned repeat;
+        if (sym == 16) {
+            if (!i) {
+                err("Repeat without a previous length");
+                return 1;
+            }
+            len = lengths[i - 1];
+            repeat = 3 + get_bits(s, 2);
+        } else if (sym == 17) {
+            repeat = 3 + get_bits(s, 3);
+        } else {
+            repeat = 11 + get_bits(s, 7);
+        }
+        if (i + repeat > nlen + ndist) {
+            err("Too many code lengths");
+            return 1;
+        }
+        while (repeat--) {
+            lengths[i++] = len;
+        }
+    }
+    if (!lengths[256]) {
+        err("No end of block code");
+        return 1;
+    }
+
+    Huffman lit, dist;
+    if (build_huffman(&lit, lengths, nlen) != 0 ||
+        build_huffman(&dist, lengths + nlen, ndist) != 0) {
+        err("Bad literal/length or distance code");
+        return 1;
+    }
+    return inflate_codes(s, &lit, &dist);
+}
+
+// zlib stream into `out`, which has to be filled exactly
+static int zlib_decompress(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size) {
+    if (in_size < 6 || (in[0] & 0x0F) != 8 || ((in[0] << 8) | in[1]) % 31 || in[1] & 0x20) {
+        err("Bad zlib header");
+        return 1;
+    }
+    Inflater s = {in, in_size, 2, 0, 0, 0, out, out_size, 0};
+    unsigned last;
+    do {
+        last = get_bits(&s, 1);
+        unsigned type = get_bits(&s, 2);
+        int res;
+        switch (type) {
+            case 0: res = inflate_stored(&s); break;
+            case 1: res = inflate_fixed(&s); break;
+            case 2: res = inflate_dynamic(&s); break;
+            default: err("Bad block type"); return 1;
+        }
+        if (res != 0) {
+            return 1;
+        }
+    } while (!last);
+
+    get_bits(&s, s.nbits % 8);
+    uint32_t check = get_bits(&s, 8) << 24;
+    check |= get_bits(&s, 8) << 16;
+    check |= get_bits(&s, 8) << 8;
+    check |= get_bits(&s, 8);
+    if (overrun(&s)) {
+        err("zlib stream truncated");
+        return 1;
+    }
+    if (s.out_pos != out_size) {
+        err("Inflated %zu bytes, expected %zu", s.out_pos, out_size);
+        return 1;
+    }
+    if (check != png_adler32(1, out, out_size)) {
+        err("Adler32 mismatch");
+        return 1;
+    }
+    return 0;
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// `prev` is a zero row for the first row of a pass. Up has no dependency between bytes and
+// vectorizes, the others only depend on the pixel `bpp` bytes back
+static int unfilter_row(uint8_t *row, const uint8_t *prev, size_t stride, unsigned bpp, uint8_t type) {
+    switch (type) {
+        case 0: break;
+        case 1:
+            for (size_t i = bpp; i < stride; ++i) {
+                row[i] += row[i - bpp];
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < stride; ++i) {
+                row[i] += prev[i];
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < bpp && i < stride; ++i) {
+                row[i] += prev[i] >> 1;
+            }
+            for (size_t i = bpp; i < stride; ++i) {
+                row[i] += (row[i - bpp] + prev[i]) >> 1;
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < bpp && i < stride; ++i) {
+                row[i] += prev[i];
+            }
+            for (size_t i = bpp; i < stride; ++i) {
+                row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+            }
+            break;
+        default: err("Bad filter type %u", type); return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t width, height;
+    unsigned depth, color, channels;
+    uint8_t palette[256][4];
+    unsigned palette_size;
+    char has_key;
+    uint16_t key[3];  // transparent gray or rgb
+} PngInfo;
+
+static uint16_t sample_at(const uint8_t *row, size_t idx, unsigned depth) {
+    switch (depth) {
+        case 16: return row[idx * 2] << 8 | row[idx * 2 + 1];
+        case 8: return row[idx];
+        default: {
+            unsigned per_byte = 8 / depth;
+            unsigned shift = 8 - depth - (idx % per_byte) * depth;
+            return (row[idx / per_byte] >> shift) & ((1u << depth) - 1);
+        }
+    }
+}
+
+static uint32_t to_8bit(uint16_t v, unsigned depth) {
+    return depth == 16 ? v >> 8 : depth == 8 ? v : v * 255 / ((1u << depth) - 1);
+}
+
+static uint32_t pixel_at(const PngInfo *png, const uint8_t *row, uint32_t x) {
+    size_t base = (size_t)x * png->channels;
+    uint32_t r, g, b, a = 255;
+    switch (png->color) {
+        case 0: {
+            uint16_t v = sample_at(row, base, png->depth);
+            r = g = b = to_8bit(v, png->depth);
+            if (png->has_key && v == png->key[0]) {
+                a = 0;
+            }
+            break;
+        }
+        case 2: {
+            uint16_t v[3] = {sample_at(row, base, png->depth),
+                             sample_at(row, base + 1, png->depth),
+                             sample_at(row, base + 2, png->depth)};
+            r = to_8bit(v[0], png->depth);
+            g = to_8bit(v[1], png->depth);
+            b = to_8bit(v[2], png->depth);
+            if (png->has_key && v[0] == png->key[0] && v[1] == png->key[1] && v[2] == png->key[2]) {
+                a = 0;
+            }
+            break;
+        }
+        case 3: {
+            unsigned idx = sample_at(row, base, png->depth);
+            // Out of range indexes are an error for libpng, black is friendlier for a cursor
+            const uint8_t *c = idx < png->palette_size ? png->palette[idx] : NULL;
+            r = c ? c[0] : 0;
+            g = c ? c[1] : 0;
+            b = c ? c[2] : 0;
+            a = c ? c[3] : 255;
+            break;
+        }
+        case 4:
+            r = g = b = to_8bit(sample_at(row, base, png->depth), png->depth);
+            a = to_8bit(sample_at(row, base + 1, png->depth), png->depth);
+            break;
+        default:
+            r = to_8bit(sample_at(row, base, png->depth), png->depth);
+            g = to_8bit(sample_at(row, base + 1, png->depth), png->depth);
+            b = to_8bit(sample_at(row, base + 2, png->depth), png->depth);
+            a = to_8bit(sample_at(row, base + 3, png->depth), png->depth);
+            break;
+    }
+    if (a != 255) {
+        r = (r * a + 127) / 255;
+        g = (g * a + 127) / 255;
+        b = (b * a + 127) / 255;
+    }
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+static const uint8_t adam7_x[7] = {0, 4, 0, 2, 0, 1, 0};
+static const uint8_t adam7_y[7] = {0, 0, 4, 0, 2, 0, 1};
+static const uint8_t adam7_dx[7] = {8, 8, 4, 4, 2, 2, 1};
+static const uint8_t adam7_dy[7] = {8, 8, 8, 4, 4, 2, 2};
+
+static size_t pass_stride(const PngInfo *png, uint32_t width) {
+    return ((size_t)width * png->channels * png->depth + 7) / 8;
+}
+
+static void pass_size(const PngInfo *png, char interlaced, int pass, uint32_t *w, uint32_t *h) {
+    if (!interlaced) {
+        *w = png->width;
+        *h = png->height;
+        return;
+    }
+    *w = (png->width + adam7_dx[pass] - 1 - adam7_x[pass]) / adam7_dx[pass];
+    *h = (png->height + adam7_dy[pass] - 1 - adam7_y[pass]) / adam7_dy[pass];
+    if (png->width <= adam7_x[pass] || png->height <= adam7_y[pass]) {
+        *w = *h = 0;
+    }
+}
+
+static int parse_ihdr(const uint8_t *p, uint32_t len, PngInfo *png, char *interlaced) {
+    if (len != 13) {
+        err("Bad IHDR");
+        return 1;
+    }
+    png->width = u32_be(p);
+    png->height = u32_be(p + 4);
+    png->depth = p[8];
+    png->color = p[9];
+    *interlaced = p[12];
+    if (!png->width || !png->height || png->width > PNG_MAX_DIM || png->height > PNG_MAX_DIM) {
+        err("Bad PNG dimension %ux%u", png->width, png->height);
+        return 1;
+    }
+    // Allowed bit depths of each color type, as a bit set
+    static const uint32_t depths[7] = {0x10116, 0, 0x10100, 0x116, 0x10100, 0, 0x10100};
+    if (png->color > 6 || png->depth > 16 || !(depths[png->color] & (1u << png->depth)) || p[10] ||
+        p[11] || *interlaced > 1) {
+        err("Unsupported PNG format, color %u depth %u", png->color, png->depth);
+        return 1;
+    }
+    static const uint8_t channels[7] = {1, 0, 3, 1, 2, 0, 4};
+    png->channels = channels[png->color];
+    return 0;
+}
+
+// Walk the chunks up to IEND, collecting the header, palette, transparency and the
+// concatenated IDAT payload
+static int read_chunks(const uint8_t *buf,
+                       size_t size,
+                       PngInfo *png,
+                       char *interlaced,
+                       uint8_t **idat,
+                       size_t *idat_size) {
+    char has_header = 0;
+    size_t idat_cap = 0;
+    size_t pos = PNG_SIGNATURE_SIZE;
+    for (;;) {
+        if (size - pos < 12) {
+            err("PNG truncated");
+            return 1;
+        }
+        uint32_t len = u32_be(buf + pos);
+        const uint8_t *type = buf + pos + 4;
+        const uint8_t *data = type + 4;
+        if (len > size - pos - 12) {
+            err("PNG chunk exceeds the file");
+            return 1;
+        }
+        if (png_crc32(0, type, len + 4) != u32_be(data + len)) {
+            err("CRC mismatch in chunk `%.4s`", type);
+            return 1;
+        }
+        pos += 12 + (size_t)len;
+
+        if (!memcmp(type, "IHDR", 4)) {
+            if (parse_ihdr(data, len, png, interlaced) != 0) {
+                return 1;
+            }
+            has_header = 1;
+        } else if (!has_header) {
+            err("PNG misses IHDR");
+            return 1;
+        } else if (!memcmp(type, "PLTE", 4)) {
+            if (len % 3 || len / 3 > 256) {
+                err("Bad PLTE");
+                return 1;
+            }
+            png->palette_size = len / 3;
+            for (unsigned i = 0; i < png->palette_size; ++i) {
+                memcpy(png->palette[i], data + i * 3, 3);
+                png->palette[i][3] = 255;
+            }
+        } else if (!memcmp(type, "tRNS", 4)) {
+            if (png->color == 3) {
+                for (unsigned i = 0; i < len && i < 256; ++i) {
+                    png->palette[i][3] = data[i];
+                }
+            } else if (png->color == 0 && len >= 2) {
+                png->has_key = 1;
+                png->key[0] = data[0] << 8 | data[1];
+            } else if (png->color == 2 && len >= 6) {
+                png->has_key = 1;
+                for (int i = 0; i < 3; ++i) {
+                    png->key[i] = data[i * 2] << 8 | data[i * 2 + 1];
+                }
+            }
+        } else if (!memcmp(type, "IDAT", 4)) {
+            if (*idat_size + len > idat_cap) {
+                size_t cap = idat_cap ? idat_cap * 2 : 4096;
+                while (cap < *idat_size + len) {
+                    cap *= 2;
+                }
+                uint8_t *grown = realloc(*idat, cap);
+                if (!grown) {
+                    err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+                    return 1;
+                }
+                *idat = grown;
+                idat_cap = cap;
+            }
+            memcpy(*idat + *idat_size, data, len);
+            *idat_size += len;
+        } else if (!memcmp(type, "IEND", 4)) {
+            break;
+        } else if (!(type[0] & 0x20)) {
+            err("Unknown critical chunk `%.4s`", type);
+            return 1;
+        }
+    }
+    if (png->color == 3 && !png->palette_size) {
+        err("PNG misses PLTE");
+        return 1;
+    }
+    return 0;
+}
+
+// Inflate, unfilter and convert every pass of the image
+static int decode_passes(const PngInfo *png,
+                         char interlaced,
+                         const uint8_t *idat,
+                         size_t idat_size,
+                         Image *out) {
+    // Filtered rows of every pass, each with its filter type byte
+    size_t raw_size = 0;
+    for (int pass = 0; pass < (interlaced ? 7 : 1); ++pass) {
+        uint32_t w, h;
+        pass_size(png, interlaced, pass, &w, &h);
+        if (w && h) {
+            raw_size += (size_t)h * (pass_stride(png, w) + 1);
+        }
+    }
+    uint8_t *raw = malloc(raw_size);
+    uint8_t *zero = calloc(pass_stride(png, png->width) + 1, 1);
+    if (!raw || !zero) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(raw);
+        free(zero);
+        return 1;
+    }
+
+    int res = zlib_decompress(idat, idat_size, raw, raw_size);
+    unsigned bpp = (png->channels * png->depth + 7) / 8;
+    uint8_t *row = raw;
+    for (int pass = 0; res == 0 && pass < (interlaced ? 7 : 1); ++pass) {
+        uint32_t w, h;
+        pass_size(png, interlaced, pass, &w, &h);
+        if (!w || !h) {
+            continue;
+        }
+        size_t stride = pass_stride(png, w);
+        const uint8_t *prev = zero;
+        for (uint32_t y = 0; y < h && res == 0; ++y) {
+            res = unfilter_row(row + 1, prev, stride, bpp, row[0]);
+            uint32_t oy = interlaced ? adam7_y[pass] + y * adam7_dy[pass] : y;
+            for (uint32_t x = 0; x < w; ++x) {
+                uint32_t ox = interlaced ? adam7_x[pass] + x * adam7_dx[pass] : x;
+                out->pixels[(size_t)oy * png->width + ox] = pixel_at(png, row + 1, x);
+            }
+            prev = row + 1;
+            row += stride + 1;
+        }
+    }
+    free(raw);
+    free(zero);
+    return res;
+}
+
+int decode_png(const uint8_t *buf, size_t size, Image *out) {
+    out->width = 0;
+    out->height = 0;
+    out->pixels = NULL;
+    if (!is_png(buf, size)) {
+        err("Not a PNG");
+        return 1;
+    }
+
+    PngInfo png;
+    memset(&png, 0, sizeof(png));
+    char interlaced = 0;
+    uint8_t *idat = NULL;
+    size_t idat_size = 0;
+    if (read_chunks(buf, size, &png, &interlaced, &idat, &idat_size) != 0) {
+        free(idat);
+        return 1;
+    }
+
+    out->pixels = malloc((size_t)png.width * png.height * sizeof(uint32_t));
+    if (!out->pixels) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(idat);
+        return 1;
+    }
+    out->width = png.width;
+    out->height = png.height;
+    int res = decode_passes(&png, interlaced, idat, idat_size, out);
+    free(idat);
+    if (res != 0) {
+        cleanup_image(out);
+    }
+    return res;
+}
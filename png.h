@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decode.h"
+
+#define PNG_SIGNATURE_SIZE 8
+
+int is_png(const uint8_t *buf, size_t size);
+
+// Decode a whole PNG, every color type, bit depth and Adam7 interlacing
+int decode_png(const uint8_t *buf, size_t size, Image *out);
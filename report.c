@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "report.h"
+#include "ani.h"
+#include "debug.h"
+
+typedef struct {
+    uint64_t key;
+    uint64_t n;
+} Bin;
+
+// Bins sorted by key, distributions of icon metadata have few distinct values
+typedef struct {
+    unsigned count;
+    unsigned capacity;
+    Bin *bins;
+} Histogram;
+
+typedef struct {
+    uint64_t files;
+    uint64_t failed;
+    uint64_t no_anih;
+    uint64_t has_rate;
+    uint64_t has_seq;
+    uint64_t frames_steps_differ;  // anih.cFrames != anih.cSteps
+    Histogram size;  // cx << 32 | cy
+    Histogram bit_count;
+    Histogram frames;  // icons in the frame list
+    Histogram jif_rate;
+    Histogram flags;
+} ReportStats;
+
+typedef struct {
+    const GlobalContext *ctx;
+    unsigned next;  // next task, shared by the workers
+} ReportJob;
+
+// Every worker keeps partial stats, they are merged once every task is done
+typedef struct {
+    ReportJob *job;
+    ReportStats *stats;
+} Worker;
+
+static int hist_add(Histogram *h, uint64_t key, uint64_t n) {
+    unsigned lo = 0, hi = h->count;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (h->bins[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < h->count && h->bins[lo].key == key) {
+        h->bins[lo].n += n;
+        return 0;
+    }
+    if (h->count + 1 > h->capacity) {
+        unsigned capacity = h->capacity ? h->capacity << 1 : 8;
+        Bin *tmp = realloc(h->bins, capacity * sizeof(Bin));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return 1;
+        }
+        h->bins = tmp;
+        h->capacity = capacity;
+    }
+    memmove(h->bins + lo + 1, h->bins + lo, (h->count - lo) * sizeof(Bin));
+    h->bins[lo].key = key;
+    h->bins[lo].n = n;
+    h->count++;
+    return 0;
+}
+
+static void hist_merge(Histogram *dst, const Histogram *src) {
+    for (unsigned i = 0; i < src->count; ++i) {
+        hist_add(dst, src->bins[i].key, src->bins[i].n);
+    }
+}
+
+static void cleanup_stats(ReportStats *s) {
+    free(s->size.bins);
+    free(s->bit_count.bins);
+    free(s->frames.bins);
+    free(s->jif_rate.bins);
+    free(s->flags.bins);
+}
+
+static void merge_stats(ReportStats *dst, const ReportStats *src) {
+    dst->files += src->files;
+    dst->failed += src->failed;
+    dst->no_anih += src->no_anih;
+    dst->has_rate += src->has_rate;
+    dst->has_seq += src->has_seq;
+    dst->frames_steps_differ += src->frames_steps_differ;
+    hist_merge(&dst->size, &src->size);
+    hist_merge(&dst->bit_count, &src->bit_count);
+    hist_merge(&dst->frames, &src->frames);
+    hist_merge(&dst->jif_rate, &src->jif_rate);
+    hist_merge(&dst->flags, &src->flags);
+}
+
+static void collect(ReportStats *s, const AniFile *ani) {
+    const ChunkAnih *anih = NULL;
+    const ChunkList *list = NULL;
+    char has_rate = 0, has_seq = 0;
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        const Chunk *c = ani->chunks[i];
+        switch (c->ty) {
+            case ty_anih: anih = anih ? anih : c->inner; break;
+            case ty_seq: has_seq = 1; break;
+            case ty_rate: has_rate = 1; break;
+            case ty_list: list = list ? list : c->inner; break;
+            default: break;
+        }
+    }
+    s->has_rate += has_rate;
+    s->has_seq += has_seq;
+    hist_add(&s->frames, list ? list->count : 0, 1);
+    if (!anih) {
+        s->no_anih++;
+        return;
+    }
+    hist_add(&s->size, (uint64_t)anih->cx << 32 | anih->cy, 1);
+    hist_add(&s->bit_count, anih->cBitCount, 1);
+    hist_add(&s->jif_rate, anih->jifRate, 1);
+    hist_add(&s->flags, anih->flags, 1);
+    s->frames_steps_differ += anih->cFrames != anih->cSteps;
+}
+
+static void report_file(const GlobalContext *ctx, ReportStats *s, const char *path) {
+    s->files++;
+    size_t size;
+    FILE *file = open_task(ctx, path, &size);
+    if (!file) {
+        err("Cannot open file `%s`", path);
+        s->failed++;
+        return;
+    }
+    // Frames are only counted, so none of them is read
+    ParseOptions opts = {.lazy_frames = 1, .recover = ctx->recover, .max_alloc = ctx->file_budget};
+    AniFile *ani = parse_ani_ex(file, &opts);
+    fclose(file);
+    if (!ani) {
+        s->failed++;
+        return;
+    }
+    collect(s, ani);
+    cleanup_ani(ani);
+}
+
+static void *report_worker(void *arg) {
+    Worker *w = arg;
+    const GlobalContext *ctx = w->job->ctx;
+    unsigned i;
+    while ((i = __atomic_fetch_add(&w->job->next, 1, __ATOMIC_RELAXED)) < ctx->task_num) {
+        report_file(ctx, w->stats, ctx->tasks[i]);
+    }
+    return NULL;
+}
+
+static void print_hist_json(const char *name, const Histogram *h, char pair, char hex) {
+    printf("\"%s\": {", name);
+    for (unsigned i = 0; i < h->count; ++i) {
+        uint64_t k = h->bins[i].key;
+        fputs(i ? ", " : "", stdout);
+        if (pair) {
+            printf("\"%ux%u\"", (uint32_t)(k >> 32), (uint32_t)k);
+        } else {
+            printf(hex ? "\"0x%08x\"" : "\"%u\"", (uint32_t)k);
+        }
+        printf(": %llu", (unsigned long long)h->bins[i].n);
+    }
+    printf("}");
+}
+
+static void print_hist_plain(const char *name, const Histogram *h, char pair, char hex) {
+    printf("%s:\n", name);
+    for (unsigned i = 0; i < h->count; ++i) {
+        uint64_t k = h->bins[i].key;
+        if (pair) {
+            printf("    %ux%u", (uint32_t)(k >> 32), (uint32_t)k);
+        } else {
+            printf(hex ? "    0x%08x" : "    %u", (uint32_t)k);
+        }
+        printf(": %llu\n", (unsigned long long)h->bins[i].n);
+    }
+}
+
+static void print_report(const GlobalContext *ctx, const ReportStats *s) {
+    switch (ctx->out_format) {
+        case Json: {
+            printf("{\"files\": %llu, \"failed\": %llu, \"no_anih\": %llu, ",
+                   (unsigned long long)s->files,
+                   (unsigned long long)s->failed,
+                   (unsigned long long)s->no_anih);
+            printf("\"has_rate\": %llu, \"has_seq\": %llu, \"frames_steps_differ\": %llu, ",
+                   (unsigned long long)s->has_rate,
+                   (unsigned long long)s->has_seq,
+                   (unsigned long long)s->frames_steps_differ);
+            print_hist_json("size", &s->size, 1, 0);
+            printf(", ");
+            print_hist_json("bit_count", &s->bit_count, 0, 0);
+            printf(", ");
+            print_hist_json("frames", &s->frames, 0, 0);
+            printf(", ");
+            print_hist_json("jif_rate", &s->jif_rate, 0, 0);
+            printf(", ");
+            print_hist_json("flags", &s->flags, 0, 1);
+            printf("}\n");
+            break;
+        }
+        case Plain: {
+            printf("Files: %llu\nFailed: %llu\nNo anih: %llu\n",
+                   (unsigned long long)s->files,
+                   (unsigned long long)s->failed,
+                   (unsigned long long)s->no_anih);
+            printf("Has rate: %llu\nHas seq: %llu\nFrames differ from steps: %llu\n",
+                   (unsigned long long)s->has_rate,
+                   (unsigned long long)s->has_seq,
+                   (unsigned long long)s->frames_steps_differ);
+            print_hist_plain("Size", &s->size, 1, 0);
+            print_hist_plain("Bit count", &s->bit_count, 0, 0);
+            print_hist_plain("Frames", &s->frames, 0, 0);
+            print_hist_plain("Jif rate", &s->jif_rate, 0, 0);
+            print_hist_plain("Flags", &s->flags, 0, 1);
+            break;
+        }
+        case Silent: break;
+    }
+}
+
+int run_report(const GlobalContext *ctx) {
+    unsigned workers = ctx->jobs < ctx->task_num ? ctx->jobs : ctx->task_num;
+    workers = workers ? workers : 1;
+    ReportStats *stats = calloc(workers, sizeof(ReportStats));
+    Worker *args = malloc(workers * sizeof(Worker));
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    if (!stats || !args || !threads) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(stats);
+        free(args);
+        free(threads);
+        return 1;
+    }
+    ReportJob job = {ctx, 0};
+    for (unsigned i = 0; i < workers; ++i) {
+        args[i].job = &job;
+        args[i].stats = &stats[i];
+    }
+    // Worker 0 is the calling thread, which also covers a failed pthread_create
+    unsigned started = 1;
+    while (started < workers &&
+           pthread_create(&threads[started], NULL, report_worker, &args[started]) == 0) {
+        ++started;
+    }
+    report_worker(&args[0]);
+    for (unsigned i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+        merge_stats(&stats[0], &stats[i]);
+    }
+    print_report(ctx, &stats[0]);
+    int res = stats[0].failed != 0;
+    for (unsigned i = 0; i < workers; ++i) {
+        cleanup_stats(&stats[i]);
+    }
+    free(stats);
+    free(args);
+    free(threads);
+    return res;
+}
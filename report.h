@@ -0,0 +1,7 @@
+#pragma once
+
+#include "task.h"
+
+// Parse every task for metadata only, in parallel, and print distributions of anih fields,
+// frame counts and chunk presence over the whole set
+int run_report(const GlobalContext *ctx);
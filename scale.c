@@ -0,0 +1,188 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scale.h"
+#include "debug.h"
+
+// Contributions of source pixels to each output pixel along one axis. Every output pixel has
+// `taps` weights starting at `start`, unused ones are 0, so the inner loops have a fixed trip count
+typedef struct {
+    unsigned taps;
+    int *start;
+    float *weights;
+} Contribs;
+
+static float sinc(float x) {
+    if (x == 0.0f) {
+        return 1.0f;
+    }
+    x *= (float)M_PI;
+    return sinf(x) / x;
+}
+
+static float filter_support(enum ScaleFilter filter) {
+    return filter == FilterBox ? 0.5f : 3.0f;
+}
+
+static float filter_weight(enum ScaleFilter filter, float x) {
+    if (filter == FilterBox) {
+        return x >= -0.5f && x < 0.5f ? 1.0f : 0.0f;
+    }
+    return x > -3.0f && x < 3.0f ? sinc(x) * sinc(x / 3.0f) : 0.0f;
+}
+
+static int build_contribs(uint32_t src, uint32_t dst, enum ScaleFilter filter, Contribs *c) {
+    float scale = (float)dst / src;
+    // Downscaling stretches the filter over the source pixels one output pixel covers
+    float fscale = scale < 1.0f ? scale : 1.0f;
+    float support = filter_support(filter) / fscale;
+    c->taps = (unsigned)ceilf(support * 2.0f) + 1;
+    if (c->taps > src) {
+        c->taps = src;
+    }
+    c->start = malloc(dst * sizeof(int));
+    c->weights = calloc((size_t)dst * c->taps, sizeof(float));
+    if (!c->start || !c->weights) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(c->start);
+        free(c->weights);
+        return 1;
+    }
+    for (uint32_t i = 0; i < dst; ++i) {
+        float center = (i + 0.5f) / scale;
+        int lo = (int)floorf(center - support);
+        if (lo < 0) {
+            lo = 0;
+        }
+        if (lo + c->taps > src) {
+            lo = src - c->taps;
+        }
+        float *w = c->weights + (size_t)i * c->taps;
+        float sum = 0.0f;
+        for (unsigned t = 0; t < c->taps; ++t) {
+            w[t] = filter_weight(filter, (lo + t + 0.5f - center) * fscale);
+            sum += w[t];
+        }
+        // Box upscaling can fall between taps, take the nearest pixel then
+        if (sum == 0.0f) {
+            int nearest = (int)center - lo;
+            unsigned t = nearest < 0 ? 0 : (unsigned)nearest;
+            w[t < c->taps ? t : c->taps - 1] = sum = 1.0f;
+        }
+        for (unsigned t = 0; t < c->taps; ++t) {
+            w[t] /= sum;
+        }
+        c->start[i] = lo;
+    }
+    return 0;
+}
+
+static void cleanup_contribs(Contribs *c) {
+    free(c->start);
+    free(c->weights);
+}
+
+static uint32_t clamp_channel(float v) {
+    return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint32_t)(v + 0.5f);
+}
+
+// Both passes work on 4 interleaved float channels, the per tap loops over them vectorize
+int scale_image(const Image *src,
+                uint32_t width,
+                uint32_t height,
+                enum ScaleFilter filter,
+                Image *out) {
+    out->width = width;
+    out->height = height;
+    out->pixels = NULL;
+    if (!src->width || !src->height || !width || !height) {
+        err("Cannot scale %ux%u to %ux%u", src->width, src->height, width, height);
+        return 1;
+    }
+
+    Contribs cx, cy;
+    if (build_contribs(src->width, width, filter, &cx) != 0) {
+        return 1;
+    }
+    if (build_contribs(src->height, height, filter, &cy) != 0) {
+        cleanup_contribs(&cx);
+        return 1;
+    }
+    float *in = malloc((size_t)src->width * src->height * 4 * sizeof(float));
+    float *tmp = malloc((size_t)width * src->height * 4 * sizeof(float));
+    float *acc = malloc((size_t)width * 4 * sizeof(float));
+    out->pixels = malloc((size_t)width * height * sizeof(uint32_t));
+    if (!in || !tmp || !acc || !out->pixels) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(in);
+        free(tmp);
+        free(acc);
+        cleanup_image(out);
+        cleanup_contribs(&cx);
+        cleanup_contribs(&cy);
+        return 1;
+    }
+
+    for (size_t i = 0; i < (size_t)src->width * src->height; ++i) {
+        uint32_t p = src->pixels[i];
+        in[i * 4] = (p >> 24) & 0xFF;
+        in[i * 4 + 1] = (p >> 16) & 0xFF;
+        in[i * 4 + 2] = (p >> 8) & 0xFF;
+        in[i * 4 + 3] = p & 0xFF;
+    }
+
+    // Horizontal pass, source rows into `tmp`
+    for (uint32_t y = 0; y < src->height; ++y) {
+        const float *row = in + (size_t)y * src->width * 4;
+        float *dst = tmp + (size_t)y * width * 4;
+        for (uint32_t x = 0; x < width; ++x) {
+            const float *w = cx.weights + (size_t)x * cx.taps;
+            const float *s = row + (size_t)cx.start[x] * 4;
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (unsigned t = 0; t < cx.taps; ++t) {
+                for (unsigned k = 0; k < 4; ++k) {
+                    sum[k] += s[t * 4 + k] * w[t];
+                }
+            }
+            memcpy(dst + (size_t)x * 4, sum, sizeof(sum));
+        }
+    }
+
+    // Vertical pass, a whole output row at once so the inner loop runs along memory
+    for (uint32_t y = 0; y < height; ++y) {
+        const float *w = cy.weights + (size_t)y * cy.taps;
+        memset(acc, 0, (size_t)width * 4 * sizeof(float));
+        for (unsigned t = 0; t < cy.taps; ++t) {
+            const float *s = tmp + (size_t)(cy.start[y] + t) * width * 4;
+            float wt = w[t];
+            for (size_t i = 0; i < (size_t)width * 4; ++i) {
+                acc[i] += s[i] * wt;
+            }
+        }
+        uint32_t *dst = out->pixels + (size_t)y * width;
+        for (uint32_t x = 0; x < width; ++x) {
+            // Lanczos rings, keep colors within alpha to stay premultiplied
+            uint32_t a = clamp_channel(acc[x * 4]);
+            uint32_t r = clamp_channel(acc[x * 4 + 1]);
+            uint32_t g = clamp_channel(acc[x * 4 + 2]);
+            uint32_t b = clamp_channel(acc[x * 4 + 3]);
+            dst[x] = a << 24 | (r < a ? r : a) << 16 | (g < a ? g : a) << 8 | (b < a ? b : a);
+        }
+    }
+
+    free(in);
+    free(tmp);
+    free(acc);
+    cleanup_contribs(&cx);
+    cleanup_contribs(&cy);
+    return 0;
+}
+
+uint32_t scale_hotspot(uint32_t hot, uint32_t src_size, uint32_t dst_size) {
+    if (!src_size || src_size == dst_size) {
+        return hot;
+    }
+    uint32_t res = ((uint64_t)hot * 2 + 1) * dst_size / ((uint64_t)src_size * 2);
+    return dst_size && res >= dst_size ? dst_size - 1 : res;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "decode.h"
+
+enum ScaleFilter { FilterLanczos, FilterBox };
+
+// Resample premultiplied `src` into a `width` x `height` image
+int scale_image(const Image *src,
+                uint32_t width,
+                uint32_t height,
+                enum ScaleFilter filter,
+                Image *out);
+
+// Map a hotspot through a scale by its pixel center, so every output agrees on rounding
+uint32_t scale_hotspot(uint32_t hot, uint32_t src_size, uint32_t dst_size);
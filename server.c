@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+
+#include "server.h"
+#include "debug.h"
+
+// Protocol, all integers are little endian
+// Request:  u32 length, then `length` bytes
+//   u8 mode     0 describe, 1 extract
+//   u8 format   0 json, 1 plain
+//   u8 source   0 path, 1 inline bytes
+//   u8 reserved
+//   path of the file, or name of the file, '\0', content of the file
+// Response: u32 length, then `length` bytes of what `-json` or plain mode prints,
+//   or {"error": "..."}
+// A connection may carry any number of requests. Idle connections wait in epoll and hold no
+// worker, a worker takes one request of a ready connection and then arms it again
+#define MAX_REQUEST (64u << 20)
+// A client that stalls in the middle of a request holds its worker at most this long
+#define REQUEST_TIMEOUT_S 10
+// Pause before accepting again when out of fds or buffers, so the error is not spun on
+#define ACCEPT_BACKOFF_MS 100
+
+typedef struct {
+    const GlobalContext *global;
+    int listen_fd;
+    int epoll_fd;
+} ServerContext;
+
+static const char *socket_path;
+
+static void on_signal(int sig) {
+    unlink(socket_path);
+    _exit(0);
+}
+
+static int read_full(int fd, void *buf, size_t n) {
+    uint8_t *p = buf;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return 0;
+        }
+        p += r;
+        n -= r;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buf, size_t n) {
+    const uint8_t *p = buf;
+    while (n) {
+        ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return 0;
+        }
+        p += r;
+        n -= r;
+    }
+    return 1;
+}
+
+static int send_response(int fd, const StringBuilder *out) {
+    uint32_t n = out->size;
+    uint8_t head[4] = {n & 0xFF, (n >> 8) & 0xFF, (n >> 16) & 0xFF, (n >> 24) & 0xFF};
+    return write_full(fd, head, 4) && write_full(fd, out->data, n);
+}
+
+// `req` holds `n` bytes plus a spare byte for the terminator
+static void handle_request(GlobalContext *local, uint8_t *req, size_t n, StringBuilder *out) {
+    if (n < 4) {
+        sb_appendf(out, "{\"error\": \"request too short\"}");
+        return;
+    }
+    local->mode = req[0] == 1 ? Extract : Describe;
+    local->out_format = req[1] == 1 ? Plain : Json;
+    char *payload = (char *)req + 4;
+    size_t payload_size = n - 4;
+    payload[payload_size] = '\0';
+
+    FILE *target = NULL;
+    const char *name = payload;
+    if (req[2] == 0) {
+        target = fopen(payload, "rb");
+    } else {
+        size_t name_len = strnlen(payload, payload_size);
+        if (name_len == payload_size) {
+            sb_appendf(out, "{\"error\": \"inline request without name\"}");
+            return;
+        }
+        if (!*name) {
+            name = "inline.ani";
+        }
+        target = fmemopen(payload + name_len + 1, payload_size - name_len - 1, "rb");
+    }
+    if (!target) {
+        const char *reason = strerror(errno);
+        sb_appendf(out, "{\"error\": \"cannot open `");
+        sb_append_escaped(out, name);
+        sb_appendf(out, "`: ");
+        sb_append_escaped(out, reason);
+        sb_appendf(out, "\"}");
+        return;
+    }
+    if (process_file(local, target, name, out) && !out->size) {
+        sb_appendf(out, "{\"error\": \"cannot parse `");
+        sb_append_escaped(out, name);
+        sb_appendf(out, "`\"}");
+    }
+    fclose(target);
+}
+
+// Events are one-shot, so only one worker at a time owns a connection or the listening socket
+static int arm(const ServerContext *server, int fd, int op) {
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = fd};
+    return epoll_ctl(server->epoll_fd, op, fd, &ev);
+}
+
+static void accept_connections(const ServerContext *server) {
+    while (1) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                err("accept fail: %s", strerror(errno));
+                struct timespec backoff = {0, ACCEPT_BACKOFF_MS * 1000000L};
+                nanosleep(&backoff, NULL);
+            }
+            break;
+        }
+        struct timeval timeout = {REQUEST_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (arm(server, fd, EPOLL_CTL_ADD) != 0) {
+            err("Cannot watch connection: %s", strerror(errno));
+            close(fd);
+            continue;
+        }
+        debug("Accept connection `%d`", fd);
+    }
+    arm(server, server->listen_fd, EPOLL_CTL_MOD);
+}
+
+// Serve one request of `fd`, 0 once the connection is over
+static int serve_request(
+    int fd, GlobalContext *local, StringBuilder *out, uint8_t **req, size_t *req_cap) {
+    uint8_t head[4];
+    if (!read_full(fd, head, 4)) {
+        return 0;
+    }
+    uint32_t n = head[0] | (head[1] << 8) | (head[2] << 16) | ((uint32_t)head[3] << 24);
+    sb_reset(out);
+    if (n > MAX_REQUEST) {
+        sb_appendf(out, "{\"error\": \"request too large\"}");
+        send_response(fd, out);
+        return 0;
+    }
+    if (n + 1 > *req_cap) {
+        uint8_t *tmp = realloc(*req, n + 1);
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return 0;
+        }
+        *req = tmp;
+        *req_cap = n + 1;
+    }
+    if (!read_full(fd, *req, n)) {
+        return 0;
+    }
+    handle_request(local, *req, n, out);
+    return send_response(fd, out);
+}
+
+static void *worker(void *arg) {
+    const ServerContext *server = arg;
+    // Request and output buffers are reused across requests
+    GlobalContext *local = malloc(sizeof(GlobalContext));
+    StringBuilder *out = sb_new();
+    uint8_t *req = NULL;
+    size_t req_cap = 0;
+    if (!local || !out) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(local);
+        sb_cleanup(out);
+        return NULL;
+    }
+    memcpy(local, server->global, sizeof(GlobalContext));
+    while (1) {
+        struct epoll_event ev;
+        if (epoll_wait(server->epoll_fd, &ev, 1, -1) < 1) {
+            if (errno != EINTR) {
+                err("epoll_wait fail: %s", strerror(errno));
+                break;
+            }
+            continue;
+        }
+        int fd = ev.data.fd;
+        if (fd == server->listen_fd) {
+            accept_connections(server);
+        } else if (!serve_request(fd, local, out, &req, &req_cap) ||
+                   arm(server, fd, EPOLL_CTL_MOD) != 0) {
+            debug("Close connection `%d`", fd);
+            close(fd);
+        }
+    }
+    free(req);
+    sb_cleanup(out);
+    free(local);
+    return NULL;
+}
+
+// Serve requests on a unix socket until killed
+int serve(const GlobalContext *ctx) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(ctx->socket_path) >= sizeof(addr.sun_path)) {
+        err("Socket path `%s` is too long", ctx->socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, ctx->socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        err("Cannot create socket: %s", strerror(errno));
+        return 1;
+    }
+    unlink(ctx->socket_path);
+    // Requests may name any path the server can read, so only its owner may connect. The mode
+    // is set before listening, no connection can be made in between
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        chmod(ctx->socket_path, 0600) != 0 || listen(fd, SOMAXCONN) != 0) {
+        err("Cannot listen on `%s`: %s", ctx->socket_path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    socket_path = ctx->socket_path;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    ServerContext server = {ctx, fd, epoll_create1(EPOLL_CLOEXEC)};
+    if (server.epoll_fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+        arm(&server, fd, EPOLL_CTL_ADD) != 0) {
+        err("Cannot poll `%s`: %s", ctx->socket_path, strerror(errno));
+        if (server.epoll_fd >= 0) {
+            close(server.epoll_fd);
+        }
+        close(fd);
+        return 1;
+    }
+    unsigned jobs = ctx->jobs ? ctx->jobs : 1;
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    if (!threads) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        close(server.epoll_fd);
+        close(fd);
+        return 1;
+    }
+    unsigned started = 0;
+    for (unsigned i = 0; i < jobs; ++i) {
+        if (pthread_create(&threads[started], NULL, worker, &server) == 0) {
+            ++started;
+        }
+    }
+    debug("Serving on `%s` with %u workers", ctx->socket_path, started);
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    close(server.epoll_fd);
+    close(fd);
+    unlink(ctx->socket_path);
+    return started ? 0 : 1;
+}
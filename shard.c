@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "shard.h"
+#include "store.h"
+#include "debug.h"
+
+// FNV-1a with a final mix, low bits alone are poor for small shard counts
+static uint64_t path_hash(const char *path) {
+    while (path[0] == '.' && path[1] == '/') {
+        path += 2;
+    }
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *path; ++path) {
+        h ^= (uint8_t)*path;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Files found under a dir argument go by their path below it, so nodes that mount the tree at
+// different roots still split it the same way
+static const char *task_relpath(const GlobalContext *ctx, unsigned i) {
+    return ctx->tasks[i] + (ctx->task_rel ? ctx->task_rel[i] : 0);
+}
+
+typedef struct {
+    const char *path;
+    uint64_t hash;
+    uint64_t size;
+    unsigned idx;  // position in tasks
+} ShardItem;
+
+// Largest first, ties by hash then path, so every node sorts the same
+static int compare_item(const void *a, const void *b) {
+    const ShardItem *x = a, *y = b;
+    if (x->size != y->size) {
+        return x->size < y->size ? 1 : -1;
+    }
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    int cmp = strcmp(x->path, y->path);
+    if (cmp) {
+        return cmp;
+    }
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+int shard_tasks(GlobalContext *ctx) {
+    unsigned n = ctx->task_num;
+    ShardItem *items = malloc((n ? n : 1) * sizeof(ShardItem));
+    char *keep = calloc(n ? n : 1, 1);
+    uint64_t *load = calloc(ctx->shard_count, sizeof(uint64_t));
+    if (!items || !keep || !load) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(items);
+        free(keep);
+        free(load);
+        return 1;
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        items[i].path = task_relpath(ctx, i);
+        items[i].hash = path_hash(items[i].path);
+        items[i].size = 0;
+        items[i].idx = i;
+        struct stat st;
+        if (ctx->shard_by_size && stat(ctx->tasks[i], &st) == 0) {
+            items[i].size = st.st_size;
+        }
+    }
+
+    if (ctx->shard_by_size) {
+        // Greedy, each file to the least loaded shard in decreasing size order
+        qsort(items, n, sizeof(ShardItem), compare_item);
+        for (unsigned i = 0; i < n; ++i) {
+            unsigned target = 0;
+            for (unsigned s = 1; s < ctx->shard_count; ++s) {
+                if (load[s] < load[target]) {
+                    target = s;
+                }
+            }
+            // Files of no size still spread by hash
+            if (!items[i].size) {
+                target = items[i].hash % ctx->shard_count;
+            }
+            load[target] += items[i].size;
+            keep[items[i].idx] = target == ctx->shard_index;
+        }
+    } else {
+        for (unsigned i = 0; i < n; ++i) {
+            keep[i] = items[i].hash % ctx->shard_count == ctx->shard_index;
+        }
+    }
+
+    unsigned kept = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        if (keep[i]) {
+            if (ctx->task_rel) {
+                ctx->task_rel[kept] = ctx->task_rel[i];
+            }
+            ctx->tasks[kept++] = ctx->tasks[i];
+        } else {
+            free((char *)ctx->tasks[i]);
+        }
+    }
+    debug("Shard %u/%u keeps %u of %u files",
+          ctx->shard_index + 1,
+          ctx->shard_count,
+          kept,
+          ctx->task_num);
+    ctx->task_num = kept;
+    free(items);
+    free(keep);
+    free(load);
+    return 0;
+}
+
+typedef struct {
+    char **lines;
+    size_t count;
+    size_t capacity;
+} LineList;
+
+static int push_line(LineList *list, char *line) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity << 1 : 64;
+        char **tmp = realloc(list->lines, capacity * sizeof(char *));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return 1;
+        }
+        list->lines = tmp;
+        list->capacity = capacity;
+    }
+    list->lines[list->count++] = line;
+    return 0;
+}
+
+// Escaped value of the leading `"name"` field, which every record starts with. NULL if the line
+// is not a record
+static const char *line_name(const char *line, size_t *len) {
+    static const char key[] = "{\"name\": \"";
+    if (strncmp(line, key, sizeof(key) - 1) || line[strlen(line) - 1] != '}') {
+        return NULL;
+    }
+    const char *name = line + sizeof(key) - 1;
+    const char *end = name;
+    while (*end && *end != '"') {
+        end += end[0] == '\\' && end[1] ? 2 : 1;
+    }
+    if (!*end) {
+        return NULL;
+    }
+    *len = end - name;
+    return name;
+}
+
+// Records of an NDJSON output, plain text has no name to sort by and is rejected
+static int read_lines(const char *path, LineList *list) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        err("Cannot open `%s`: %s", path, strerror(errno));
+        return 1;
+    }
+    int res = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, in)) >= 0) {
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (!len) {
+            continue;
+        }
+        size_t name_len;
+        if (!line_name(line, &name_len)) {
+            err("`%s` is not an output of '-json', merge only NDJSON files", path);
+            res = 1;
+            break;
+        }
+        char *copy = strdup(line);
+        if (!copy || push_line(list, copy) != 0) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            free(copy);
+            res = 1;
+            break;
+        }
+    }
+    free(line);
+    fclose(in);
+    return res;
+}
+
+// Records ordered by name, then by their whole text
+static int compare_line(const void *a, const void *b) {
+    const char *x = *(char *const *)a, *y = *(char *const *)b;
+    size_t xl, yl;
+    const char *xn = line_name(x, &xl), *yn = line_name(y, &yl);
+    int res = memcmp(xn, yn, xl < yl ? xl : yl);
+    if (res) {
+        return res;
+    }
+    if (xl != yl) {
+        return xl < yl ? -1 : 1;
+    }
+    return strcmp(x, y);
+}
+
+static uint8_t *read_whole(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        err("Cannot open `%s`: %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    uint8_t *buf = NULL;
+    if (fstat(fileno(in), &st) == 0) {
+        buf = malloc(st.st_size ? st.st_size : 1);
+    }
+    if (!buf || fread(buf, 1, st.st_size, in) != (size_t)st.st_size) {
+        err("Cannot read `%s`", path);
+        free(buf);
+        buf = NULL;
+    }
+    *size = buf ? st.st_size : 0;
+    fclose(in);
+    return buf;
+}
+
+// Objects are verified against their name before they are stored again
+static int merge_object(const char *path, const char *name, const char *dest) {
+    size_t size;
+    uint8_t *buf = read_whole(path, &size);
+    if (!buf) {
+        return 1;
+    }
+    uint64_t hash[2];
+    char hex[STORE_HASH_HEX];
+    hash128(buf, size, hash);
+    hash128_hex(hash, hex);
+    int res = 0;
+    if (strcmp(hex, name)) {
+        err("Object `%s` does not match its hash, skip it", path);
+        res = 1;
+    } else {
+        res = store_put(dest, buf, size, hex);
+    }
+    free(buf);
+    return res;
+}
+
+// Manifests of the same file from two shards should be equal, the first one is kept
+static int merge_manifest(const char *path, const char *name, const char *dest) {
+    size_t size;
+    uint8_t *buf = read_whole(path, &size);
+    if (!buf) {
+        return 1;
+    }
+    char target[PATH_MAX];
+    if (snprintf(target, sizeof(target), "%s/manifests/%s", dest, name) >= (int)sizeof(target)) {
+        err("Store path too long");
+        free(buf);
+        return 1;
+    }
+    int res = 0;
+    size_t old_size;
+    struct stat st;
+    if (stat(target, &st) == 0) {
+        uint8_t *old = read_whole(target, &old_size);
+        if (old && (old_size != size || memcmp(old, buf, size))) {
+            warn("Manifest `%s` differs between shards, keep the first one", name);
+        }
+        free(old);
+    } else if (create_parent_dir(target) != 0) {
+        res = 1;
+    } else {
+        FILE *out = fopen(target, "wb");
+        if (!out || fwrite(buf, 1, size, out) != size) {
+            err("Failed to write `%s`", target);
+            res = 1;
+        }
+        if (out) {
+            fclose(out);
+        }
+    }
+    free(buf);
+    return res;
+}
+
+static int compare_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Entries of `dir` named `*<suffix>`, sorted, passed to `fn` with their name sans suffix
+static int merge_entries(const char *dir,
+                         const char *suffix,
+                         const char *prefix,
+                         const char *dest,
+                         int (*fn)(const char *path, const char *name, const char *dest)) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        // A store without manifests or objects yet
+        return errno == ENOENT ? 0 : 1;
+    }
+    LineList names = {NULL, 0, 0};
+    size_t suffix_len = strlen(suffix);
+    struct dirent *entry;
+    int res = 0;
+    while ((entry = readdir(d))) {
+        size_t len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || len <= suffix_len ||
+            strcmp(entry->d_name + len - suffix_len, suffix)) {
+            continue;
+        }
+        char *copy = strdup(entry->d_name);
+        if (!copy || push_line(&names, copy) != 0) {
+            free(copy);
+            res = 1;
+            break;
+        }
+    }
+    closedir(d);
+    qsort(names.lines, names.count, sizeof(char *), compare_name);
+    for (size_t i = 0; i < names.count; ++i) {
+        char path[PATH_MAX], name[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, names.lines[i]);
+        // Objects are named by hash without their fanout dir, manifests keep their suffix
+        if (prefix) {
+            size_t len = strlen(names.lines[i]) - suffix_len;
+            snprintf(name, sizeof(name), "%s%.*s", prefix, (int)len, names.lines[i]);
+        } else {
+            snprintf(name, sizeof(name), "%s", names.lines[i]);
+        }
+        res |= fn(path, name, dest);
+        free(names.lines[i]);
+    }
+    free(names.lines);
+    return res;
+}
+
+static int merge_store(const char *src, const char *dest) {
+    char dir[PATH_MAX];
+    int res = 0;
+    for (unsigned fanout = 0; fanout < 256; ++fanout) {
+        char prefix[3];
+        snprintf(prefix, sizeof(prefix), "%02x", fanout);
+        snprintf(dir, sizeof(dir), "%s/objects/%s", src, prefix);
+        res |= merge_entries(dir, ".ico", prefix, dest, merge_object);
+    }
+    snprintf(dir, sizeof(dir), "%s/manifests", src);
+    res |= merge_entries(dir, ".json", NULL, dest, merge_manifest);
+    return res;
+}
+
+int merge_outputs(const GlobalContext *ctx) {
+    const char **inputs = malloc((ctx->task_num ? ctx->task_num : 1) * sizeof(char *));
+    if (!inputs) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    memcpy(inputs, ctx->tasks, ctx->task_num * sizeof(char *));
+    qsort(inputs, ctx->task_num, sizeof(char *), compare_name);
+
+    // The store may also be given as an input, under another spelling of its path
+    struct stat store_st;
+    char has_store = ctx->store_dir && stat(ctx->store_dir, &store_st) == 0;
+    int res = 0;
+    LineList lines = {NULL, 0, 0};
+    for (unsigned i = 0; i < ctx->task_num; ++i) {
+        struct stat st;
+        if (stat(inputs[i], &st) != 0) {
+            err("Cannot open `%s`: %s", inputs[i], strerror(errno));
+            res = 1;
+        } else if (S_ISDIR(st.st_mode)) {
+            if (!ctx->store_dir) {
+                err("Merging store `%s` needs '-store'", inputs[i]);
+                res = 1;
+            } else if (!has_store || st.st_dev != store_st.st_dev || st.st_ino != store_st.st_ino) {
+                res |= merge_store(inputs[i], ctx->store_dir);
+            }
+        } else {
+            res |= read_lines(inputs[i], &lines);
+        }
+    }
+    free(inputs);
+
+    qsort(lines.lines, lines.count, sizeof(char *), compare_line);
+    for (size_t i = 0; i < lines.count; ++i) {
+        // Shards of overlapping runs report a file twice
+        if (!i || strcmp(lines.lines[i], lines.lines[i - 1])) {
+            puts(lines.lines[i]);
+        }
+    }
+    for (size_t i = 0; i < lines.count; ++i) {
+        free(lines.lines[i]);
+    }
+    free(lines.lines);
+    return res;
+}
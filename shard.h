@@ -0,0 +1,10 @@
+#pragma once
+
+#include "task.h"
+
+// Keep only the tasks of shard `shard_index` of `shard_count`
+int shard_tasks(GlobalContext *ctx);
+
+// Combine per-shard outputs: NDJSON files are printed as one canonically sorted stream, stores
+// are merged into `store_dir`
+int merge_outputs(const GlobalContext *ctx);
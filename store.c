@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "task.h"
+#include "debug.h"
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t u64_le(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Two independent 64 bit lanes per 16 byte block, which the compiler keeps in registers
+void hash128(const void *buf, size_t n, uint64_t out[2]) {
+    const uint8_t *data = buf;
+    const size_t nblocks = n / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0;
+
+    for (size_t i = 0; i < nblocks; ++i) {
+        uint64_t k1 = u64_le(data + i * 16);
+        uint64_t k2 = u64_le(data + i * 16 + 8);
+
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + nblocks * 16;
+    uint64_t k1 = 0, k2 = 0;
+    switch (n & 15) {
+        case 15: k2 ^= (uint64_t)tail[14] << 48; /* fallthrough */
+        case 14: k2 ^= (uint64_t)tail[13] << 40; /* fallthrough */
+        case 13: k2 ^= (uint64_t)tail[12] << 32; /* fallthrough */
+        case 12: k2 ^= (uint64_t)tail[11] << 24; /* fallthrough */
+        case 11: k2 ^= (uint64_t)tail[10] << 16; /* fallthrough */
+        case 10: k2 ^= (uint64_t)tail[9] << 8; /* fallthrough */
+        case 9:
+            k2 ^= (uint64_t)tail[8];
+            k2 *= c2;
+            k2 = rotl64(k2, 33);
+            k2 *= c1;
+            h2 ^= k2;
+            /* fallthrough */
+        case 8: k1 ^= (uint64_t)tail[7] << 56; /* fallthrough */
+        case 7: k1 ^= (uint64_t)tail[6] << 48; /* fallthrough */
+        case 6: k1 ^= (uint64_t)tail[5] << 40; /* fallthrough */
+        case 5: k1 ^= (uint64_t)tail[4] << 32; /* fallthrough */
+        case 4: k1 ^= (uint64_t)tail[3] << 24; /* fallthrough */
+        case 3: k1 ^= (uint64_t)tail[2] << 16; /* fallthrough */
+        case 2: k1 ^= (uint64_t)tail[1] << 8; /* fallthrough */
+        case 1:
+            k1 ^= (uint64_t)tail[0];
+            k1 *= c1;
+            k1 = rotl64(k1, 31);
+            k1 *= c2;
+            h1 ^= k1;
+    }
+
+    h1 ^= n;
+    h2 ^= n;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+void hash128_hex(const uint64_t hash[2], char hex[STORE_HASH_HEX]) {
+    snprintf(hex,
+             STORE_HASH_HEX,
+             "%016llx%016llx",
+             (unsigned long long)hash[0],
+             (unsigned long long)hash[1]);
+}
+
+int store_object_path(const char *store, const char *hex, char path[PATH_MAX]) {
+    int len = snprintf(path, PATH_MAX, "%s/objects/%.2s/%s.ico", store, hex, hex + 2);
+    if (len < 0 || len >= PATH_MAX) {
+        err("Store path too long");
+        return 1;
+    }
+    return 0;
+}
+
+int store_manifest_path(const char *store, const char *file, char path[PATH_MAX]) {
+    while (file[0] == '.' && file[1] == '/') {
+        file += 2;
+    }
+    uint64_t hash[2];
+    char hex[STORE_HASH_HEX];
+    hash128(file, strlen(file), hash);
+    hash128_hex(hash, hex);
+    int len = snprintf(path, PATH_MAX, "%s/manifests/%s.json", store, hex);
+    if (len < 0 || len >= PATH_MAX) {
+        err("Store path too long");
+        return 1;
+    }
+    return 0;
+}
+
+// Write `buf` to a temporary file next to `path`, named in `tmp`, so it can be published whole
+static int write_aside(
+    const char *path, const void *buf, size_t n, mode_t mode, char tmp[PATH_MAX]) {
+    if (snprintf(tmp, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX) {
+        err("Store path too long");
+        return 1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        err("Failed to create `%s`: %s", tmp, strerror(errno));
+        return 1;
+    }
+    int res = 0;
+    for (size_t w = 0; w < n;) {
+        ssize_t k = write(fd, (const uint8_t *)buf + w, n - w);
+        if (k < 0) {
+            err("Failed to write `%s`: %s", tmp, strerror(errno));
+            res = 1;
+            break;
+        }
+        w += k;
+    }
+    if (fchmod(fd, mode) != 0) {
+        warn("Failed to chmod `%s`: %s", tmp, strerror(errno));
+    }
+    if (close(fd) != 0 && res == 0) {
+        err("Failed to write `%s`: %s", tmp, strerror(errno));
+        res = 1;
+    }
+    if (res != 0) {
+        unlink(tmp);
+    }
+    return res;
+}
+
+int store_put(const char *store, const void *buf, size_t n, char hex[STORE_HASH_HEX]) {
+    uint64_t hash[2];
+    hash128(buf, n, hash);
+    hash128_hex(hash, hex);
+
+    char path[PATH_MAX];
+    if (store_object_path(store, hex, path) != 0) {
+        return 1;
+    }
+    // The hash is not collision resistant, an object of another size is a different frame
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        if ((size_t)st.st_size != n) {
+            err("Object `%s` has %lld bytes, not %zu, hash collision",
+                hex,
+                (long long)st.st_size,
+                n);
+            return 1;
+        }
+        debug("Object `%s` already stored", hex);
+        return 0;
+    }
+    if (create_parent_dir(path) != 0) {
+        return 1;
+    }
+
+    // Write aside then publish, readers never see a partial object
+    char tmp[PATH_MAX];
+    if (write_aside(path, buf, n, 0444, tmp) != 0) {
+        return 1;
+    }
+    int res = 0;
+    if (link(tmp, path) != 0 && errno != EEXIST) {
+        err("Failed to store `%s`: %s", path, strerror(errno));
+        res = 1;
+    }
+    unlink(tmp);
+    return res;
+}
+
+int store_put_manifest(const char *store, const char *file, const char *json, size_t n) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    if (store_manifest_path(store, file, path) != 0 || create_parent_dir(path) != 0) {
+        return 1;
+    }
+    // A manifest is replaced on every run, unlike an object
+    if (write_aside(path, json, n, 0644, tmp) != 0) {
+        return 1;
+    }
+    if (rename(tmp, path) != 0) {
+        err("Failed to write manifest `%s`: %s", path, strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+    debug("Writing manifest `%s`", path);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/limits.h>
+
+// 128 bit hash as 32 hex digits
+#define STORE_HASH_HEX 33
+
+// MurmurHash3 x64_128 with seed 0
+void hash128(const void *buf, size_t n, uint64_t out[2]);
+
+void hash128_hex(const uint64_t hash[2], char hex[STORE_HASH_HEX]);
+
+// Path of the object `hex` under `store`: store/objects/xx/yyyy...
+int store_object_path(const char *store, const char *hex, char path[PATH_MAX]);
+
+// Manifest of the file at `file`: store/manifests/<hash of the path>.json, so files of the same
+// name in different dirs keep their own manifest
+int store_manifest_path(const char *store, const char *file, char path[PATH_MAX]);
+
+// Write `buf` under its hash unless it is already stored, the hash is returned in `hex`.
+// Objects are published with link(2), so concurrent writers of the same object are safe. An
+// existing object of another size is reported as a collision and left alone
+int store_put(const char *store, const void *buf, size_t n, char hex[STORE_HASH_HEX]);
+
+// Write the manifest of the file at `file`, the old one is replaced atomically
+int store_put_manifest(const char *store, const char *file, const char *json, size_t n);
@@ -11,6 +11,11 @@ void sb_init(StringBuilder *sb) {
     sb->data[0] = '\0';
 }
 
+void sb_reset(StringBuilder *sb) {
+    sb->size = 0;
+    sb->data[0] = '\0';
+}
+
 StringBuilder *sb_new() {
     StringBuilder *sb = malloc(sizeof(StringBuilder));
     if (!sb) {
@@ -47,3 +52,16 @@ void sb_appendf(StringBuilder *sb, const char *fmt, ...) {
         sb->data = realloc(sb->data, sb->cap);
     }
 }
+
+void sb_append_escaped(StringBuilder *sb, const char *s) {
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
+        switch (*p) {
+            case '"': sb_appendf(sb, "\\\""); break;
+            case '\\': sb_appendf(sb, "\\\\"); break;
+            case '\n': sb_appendf(sb, "\\n"); break;
+            case '\r': sb_appendf(sb, "\\r"); break;
+            case '\t': sb_appendf(sb, "\\t"); break;
+            default: sb_appendf(sb, *p < 0x20 ? "\\u%04x" : "%c", *p); break;
+        }
+    }
+}
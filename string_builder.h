@@ -14,4 +14,9 @@ StringBuilder *sb_new();
 
 void sb_cleanup(StringBuilder *sb);
 
+void sb_reset(StringBuilder *sb);
+
 void sb_appendf(StringBuilder *sb, const char *fmt, ...);
+
+// Append `s` escaped for the inside of a JSON string
+void sb_append_escaped(StringBuilder *sb, const char *s);
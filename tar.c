@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tar.h"
+#include "debug.h"
+
+#define BLOCK 512
+
+// Numeric field, octal text or base-256 with the high bit of the first byte set
+static uint64_t tar_number(const uint8_t *p, size_t n) {
+    uint64_t v = 0;
+    if (p[0] & 0x80) {
+        v = p[0] & 0x3F;
+        for (size_t i = 1; i < n; ++i) {
+            v = v << 8 | p[i];
+        }
+        return v;
+    }
+    size_t i = 0;
+    while (i < n && p[i] == ' ') {
+        ++i;
+    }
+    for (; i < n && p[i] >= '0' && p[i] <= '7'; ++i) {
+        v = v << 3 | (p[i] - '0');
+    }
+    return v;
+}
+
+static int is_zero_block(const uint8_t *h) {
+    uint8_t any = 0;
+    for (unsigned i = 0; i < BLOCK; ++i) {
+        any |= h[i];
+    }
+    return !any;
+}
+
+static int checksum_ok(const uint8_t *h) {
+    unsigned sum = 0;
+    for (unsigned i = 0; i < BLOCK; ++i) {
+        sum += i >= 148 && i < 156 ? ' ' : h[i];
+    }
+    return sum == tar_number(h + 148, 8);
+}
+
+// Value of `key` in pax records `<len> <key>=<value>\n`, NULL if it is absent
+static char *pax_value(const uint8_t *p, size_t n, const char *key) {
+    size_t key_len = strlen(key);
+    size_t i = 0;
+    while (i < n) {
+        size_t len = 0, j = i;
+        while (j < n && p[j] >= '0' && p[j] <= '9') {
+            len = len * 10 + (p[j++] - '0');
+        }
+        if (j >= n || p[j] != ' ' || len <= j - i + 1 || len > n - i) {
+            return NULL;
+        }
+        const uint8_t *rec = p + j + 1, *end = p + i + len - 1;  // without the newline
+        if ((size_t)(end - rec) > key_len && !memcmp(rec, key, key_len) && rec[key_len] == '=') {
+            return strndup((const char *)rec + key_len + 1, end - rec - key_len - 1);
+        }
+        i += len;
+    }
+    return NULL;
+}
+
+// Name of a header, ustar splits long names into prefix and name
+static char *header_name(const uint8_t *h) {
+    size_t name_len = strnlen((const char *)h, 100);
+    size_t prefix_len = !memcmp(h + 257, "ustar", 5) ? strnlen((const char *)h + 345, 155) : 0;
+    char *name = malloc(prefix_len + name_len + 2);
+    if (!name) {
+        return NULL;
+    }
+    if (prefix_len) {
+        memcpy(name, h + 345, prefix_len);
+        name[prefix_len++] = '/';
+    }
+    memcpy(name + prefix_len, h, name_len);
+    name[prefix_len + name_len] = 0;
+    return name;
+}
+
+static int push_member(TarArchive *tar, unsigned *capacity, char *name, uint64_t off, uint64_t size) {
+    if (tar->count + 1 > *capacity) {
+        unsigned cap = *capacity ? *capacity << 1 : 16;
+        TarMember *tmp = realloc(tar->members, cap * sizeof(TarMember));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return 1;
+        }
+        tar->members = tmp;
+        *capacity = cap;
+    }
+    tar->members[tar->count].name = name;
+    tar->members[tar->count].off = off;
+    tar->members[tar->count].size = size;
+    tar->count++;
+    return 0;
+}
+
+static const char *skip_dot_slash(const char *name) {
+    while (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    return name;
+}
+
+static int compare_member(const void *a, const void *b) {
+    const TarMember *x = *(const TarMember *const *)a, *y = *(const TarMember *const *)b;
+    int cmp = strcmp(skip_dot_slash(x->name), skip_dot_slash(y->name));
+    return cmp ? cmp : (x > y) - (x < y);
+}
+
+// A member appended again with `tar -r` replaces the earlier ones of its name, as on extraction,
+// so only the last of every name is kept, in archive order
+static int drop_replaced(TarArchive *tar) {
+    TarMember **sorted = malloc((tar->count ? tar->count : 1) * sizeof(TarMember *));
+    char *keep = malloc(tar->count ? tar->count : 1);
+    if (!sorted || !keep) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(sorted);
+        free(keep);
+        return 1;
+    }
+    for (unsigned i = 0; i < tar->count; ++i) {
+        sorted[i] = &tar->members[i];
+    }
+    qsort(sorted, tar->count, sizeof(TarMember *), compare_member);
+    for (unsigned i = 0; i < tar->count; ++i) {
+        keep[sorted[i] - tar->members] =
+            i + 1 == tar->count ||
+            strcmp(skip_dot_slash(sorted[i]->name), skip_dot_slash(sorted[i + 1]->name));
+    }
+    unsigned kept = 0;
+    for (unsigned i = 0; i < tar->count; ++i) {
+        if (keep[i]) {
+            tar->members[kept++] = tar->members[i];
+        } else {
+            debug("Member `%s` of `%s` is replaced later", tar->members[i].name, tar->path);
+            free(tar->members[i].name);
+        }
+    }
+    tar->count = kept;
+    free(sorted);
+    free(keep);
+    return 0;
+}
+
+// Walk headers, names from GNU `L` and pax `x` headers apply to the next member
+static int index_members(TarArchive *tar) {
+    unsigned capacity = 0;
+    char *long_name = NULL;
+    uint64_t pax_size = 0;
+    char has_pax_size = 0;
+    uint64_t pos = 0;
+    int res = 0;
+    while (pos + BLOCK <= tar->size) {
+        const uint8_t *h = tar->base + pos;
+        if (is_zero_block(h)) {
+            break;
+        }
+        if (!checksum_ok(h)) {
+            err("Bad tar header at offset %llu of `%s`", (unsigned long long)pos, tar->path);
+            res = 1;
+            break;
+        }
+        char type = h[156];
+        char is_meta = type == 'L' || type == 'K' || type == 'x' || type == 'g';
+        uint64_t size = has_pax_size && !is_meta ? pax_size : tar_number(h + 124, 12);
+        uint64_t data = pos + BLOCK;
+        if (size > tar->size - data) {
+            err("Tar member at offset %llu of `%s` is truncated", (unsigned long long)pos, tar->path);
+            res = 1;
+            break;
+        }
+        if (type == 'L') {
+            free(long_name);
+            long_name = strndup((const char *)tar->base + data, size);
+        } else if (type == 'x') {
+            char *path = pax_value(tar->base + data, size, "path");
+            char *size_text = pax_value(tar->base + data, size, "size");
+            if (path) {
+                free(long_name);
+                long_name = path;
+            }
+            if (size_text) {
+                pax_size = strtoull(size_text, NULL, 10);
+                has_pax_size = 1;
+                free(size_text);
+            }
+        } else if (!is_meta) {
+            if (type == '0' || type == '\0' || type == '7') {
+                char *name = long_name ? long_name : header_name(h);
+                long_name = NULL;
+                if (!name || push_member(tar, &capacity, name, data, size) != 0) {
+                    free(name);
+                    res = 1;
+                    break;
+                }
+            }
+            free(long_name);
+            long_name = NULL;
+            has_pax_size = 0;
+        }
+        pos = data + ((size + BLOCK - 1) & ~(uint64_t)(BLOCK - 1));
+    }
+    free(long_name);
+    return res;
+}
+
+TarArchive *tar_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        err("Cannot open archive `%s`: %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BLOCK) {
+        err("`%s` is not a tar archive", path);
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        err("Cannot map archive `%s`: %s", path, strerror(errno));
+        return NULL;
+    }
+    // Members are parsed in archive order, so the archive is read once front to back
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    TarArchive *tar = calloc(1, sizeof(TarArchive));
+    char *copy = strdup(path);
+    if (!tar || !copy) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        munmap(base, st.st_size);
+        free(tar);
+        free(copy);
+        return NULL;
+    }
+    tar->path = copy;
+    tar->base = base;
+    tar->size = st.st_size;
+    if ((index_members(tar) != 0 && !tar->count) || drop_replaced(tar) != 0) {
+        tar_close(tar);
+        return NULL;
+    }
+    debug("Archive `%s` has %u members", path, tar->count);
+    return tar;
+}
+
+void tar_close(TarArchive *tar) {
+    if (!tar) {
+        return;
+    }
+    for (unsigned i = 0; i < tar->count; ++i) {
+        free(tar->members[i].name);
+    }
+    free(tar->members);
+    munmap((void *)tar->base, tar->size);
+    free(tar->path);
+    free(tar);
+}
+
+const TarMember *tar_find(TarArchive *tar, const char *name) {
+    name = skip_dot_slash(name);
+    unsigned start = __atomic_load_n(&tar->next, __ATOMIC_RELAXED);
+    for (unsigned n = 0, i = start; n < tar->count; ++n, i = (i + 1) % tar->count) {
+        if (!strcmp(skip_dot_slash(tar->members[i].name), name)) {
+            __atomic_store_n(&tar->next, (i + 1) % tar->count, __ATOMIC_RELAXED);
+            return &tar->members[i];
+        }
+    }
+    return NULL;
+}
+
+FILE *tar_member_file(const TarArchive *tar, const TarMember *member) {
+    if (!member->size) {
+        return NULL;
+    }
+    return fmemopen((void *)(tar->base + member->off), member->size, "rb");
+}
+
+int split_tar_path(const char *path, char archive[PATH_MAX], const char **member) {
+    // A file that happens to contain the separator in its name is read as it is
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    for (const char *sep = strstr(path, TAR_SEPARATOR); sep; sep = strstr(sep + 1, TAR_SEPARATOR)) {
+        size_t len = sep - path + strlen(TAR_SEPARATOR) - 1;
+        if (len >= PATH_MAX) {
+            return 0;
+        }
+        memcpy(archive, path, len);
+        archive[len] = 0;
+        if (stat(archive, &st) == 0 && S_ISREG(st.st_mode)) {
+            *member = sep + strlen(TAR_SEPARATOR);
+            return 1;
+        }
+    }
+    return 0;
+}
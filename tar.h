@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/limits.h>
+
+// Members of a tar archive are named `archive.tar:member` in tasks
+#define TAR_SEPARATOR ".tar:"
+
+typedef struct {
+    char *name;
+    uint64_t off;  // data region in the archive
+    uint64_t size;
+} TarMember;
+
+// A mapped archive and its regular members in archive order, only the last member of a name
+// counts, like on extraction
+typedef struct {
+    char *path;
+    const uint8_t *base;
+    size_t size;
+    unsigned count;
+    TarMember *members;
+    unsigned next;  // lookups start here, members are usually asked for in archive order
+} TarArchive;
+
+// Map an archive and index it with one pass over its headers, member data is not touched
+TarArchive *tar_open(const char *path);
+
+void tar_close(TarArchive *tar);
+
+// Lookups from many threads only compete for the hint, which is just where the search starts
+const TarMember *tar_find(TarArchive *tar, const char *name);
+
+// Read a member in place from the mapping, the archive must outlive the stream. NULL for an
+// empty member
+FILE *tar_member_file(const TarArchive *tar, const TarMember *member);
+
+// Split `archive.tar:member` at the first `.tar:` that ends a regular file, 0 if `path` is a
+// regular file itself or no such archive exists
+int split_tar_path(const char *path, char archive[PATH_MAX], const char **member);
@@ -0,0 +1,1028 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/sendfile.h>
+
+#include "task.h"
+#include "debug.h"
+#include "ani.h"
+#include "ico.h"
+#include "store.h"
+#include "xcursor.h"
+#include "bundle.h"
+#include "delta.h"
+#include "decode.h"
+#include "timeline.h"
+
+typedef struct {
+    uint32_t jiffies;  // duration of the step, kept exact like the timeline does
+    void *buf;
+    long off;
+    size_t buf_size;
+} IconInfo;
+
+typedef struct {
+    unsigned count;
+    uint32_t cx;
+    uint32_t cy;
+    uint32_t hotx;
+    uint32_t hoty;
+    uint32_t jif_rate;
+    char has_rate;  // has rate chunk
+    const ChunkSeq *seq;
+    const ChunkRate *rate;
+    const ChunkList *list;
+    int src_fd;
+    const AniFile *ani;
+    unsigned max_steps;  // most entries of any parsed `seq `, `rate` or frame list
+    IconInfo *icons;
+} CursorData;
+
+static void collect_chunk_info(const Chunk *chunk, void *data) {
+    CursorData *d = (CursorData *)data;
+    switch (chunk->ty) {
+        case ty_anih: {
+            if (d->icons) {
+                break;
+            }
+            ChunkAnih *inner = chunk->inner;
+            // One icon per step, steps refer to frames through `seq ` if any
+            d->count = inner->cSteps ? inner->cSteps : inner->cFrames;
+            d->cx = inner->cx;
+            d->cy = inner->cy;
+            d->jif_rate = inner->jifRate;
+            // Steps past every parsed table describe nothing, and the tables are already bounded
+            // by the file and its budget
+            if (d->count > d->max_steps) {
+                warn("anih declares %u steps, the file describes %u", d->count, d->max_steps);
+                d->count = d->max_steps;
+            }
+            d->icons = calloc(d->count ? d->count : 1, sizeof(IconInfo));
+            if (!d->icons) {
+                err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            }
+            break;
+        }
+        // Steps are resolved once the walk is done, chunks may come in any order. The first
+        // of every table is used, like `-optimize` does
+        case ty_rate: {
+            d->has_rate = 1;
+            d->rate = d->rate ? d->rate : chunk->inner;
+            break;
+        }
+        case ty_seq: {
+            d->seq = d->seq ? d->seq : chunk->inner;
+            break;
+        }
+        case ty_list: {
+            d->list = d->list ? d->list : chunk->inner;
+            break;
+        }
+        case ty_custom: {
+            break;
+        }
+        default: assert(0);
+    }
+}
+
+// Milliseconds of a step, rounded only when printed so nothing drifts
+static double step_ms(const IconInfo *icon) {
+    return icon->jiffies * 1000.0 / 60.0;
+}
+
+// Resolve the frame and duration of every step from the collected tables
+static void resolve_steps(CursorData *d) {
+    if (!d->icons) {
+        return;
+    }
+    if (d->rate && d->rate->count != d->count) {
+        warn("rate has %u entries but there are %u steps", d->rate->count, d->count);
+    }
+    for (unsigned i = 0; i < d->count; ++i) {
+        // A missing or zero rate entry falls back to jifRate
+        uint32_t jiffies = d->rate && i < d->rate->count ? d->rate->jiffies[i] : 0;
+        d->icons[i].jiffies = jiffies ? jiffies : d->jif_rate;
+        unsigned idx = d->seq && i < d->seq->count ? d->seq->indexes[i] : i;
+        if (!d->list || idx >= d->list->count) {
+            err("Step `%u` refers to missing frame `%u`", i, idx);
+            d->icons[i].buf = NULL;
+            d->icons[i].off = 0;
+            d->icons[i].buf_size = 0;
+            continue;
+        }
+        d->icons[i].buf = d->list->frames[idx]->buffer;
+        d->icons[i].off = d->list->frames[idx]->off;
+        d->icons[i].buf_size = d->list->frames[idx]->size;
+    }
+    if (d->list) {
+        d->hotx = d->list->hotx;
+        d->hoty = d->list->hoty;
+    }
+}
+
+// Helper function to create a directory and its parents if they don't exist
+static int create_dir_recursive(char *dir) {
+#define MKDIR(path) mkdir(path, 0755)
+    char *p = dir;
+    char tmp[256];  // Adjust size as needed
+    size_t len;
+
+    while (*p) {
+        p++;
+        if (*p == '/' || *p == '\\' || *p == '\0') {
+            len = p - dir;
+            if (len == 0)
+                continue;
+            memcpy(tmp, dir, len);
+            tmp[len] = '\0';
+
+            if (MKDIR(tmp) == 0) {
+                // Directory created successfully
+            } else if (errno != EEXIST) {
+                fprintf(stderr, "Failed to create directory '%s': %s\n", tmp, strerror(errno));
+                return -1;
+            }
+        }
+    }
+    return 0;
+#undef MKDIR
+}
+
+// Create parent directories of a file
+int create_parent_dir(const char *path) {
+    char *dir_path = strdup(path);
+    if (!dir_path) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return -1;
+    }
+
+    // Find the last slash to get the directory path
+    char *last_slash = strrchr(dir_path, '/');
+    if (!last_slash) {
+        last_slash = strrchr(dir_path, '\\');
+    }
+
+    int res = 0;
+    if (last_slash) {
+        *last_slash = '\0';  // Null-terminate to get the directory path
+        res = create_dir_recursive(dir_path);
+    }
+
+    free(dir_path);
+    return res;
+}
+
+static int write_file(const char *path, const void *buf, size_t n) {
+    if (create_parent_dir(path) != 0) {
+        return 1;
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        err("Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Check if fwrite successfully wrote all n bytes
+    int res = 0;
+    if (fwrite(buf, 1, n, out) != n) {
+        err("Failed to write all bytes to %s\n", path);
+        res = 1;
+    }
+
+    if (fclose(out) != 0 && res == 0) {
+        err("Failed to write %s: %s\n", path, strerror(errno));
+        res = 1;
+    }
+    return res;
+}
+
+static int write_all(int fd, const void *buf, size_t n) {
+    for (size_t w = 0; w < n;) {
+        ssize_t k = write(fd, (const uint8_t *)buf + w, n - w);
+        if (k < 0) {
+            return 1;
+        }
+        w += k;
+    }
+    return 0;
+}
+
+// Copy `n` bytes at `off` of `in_fd` to `out_fd` without passing them through user space.
+// copy_file_range may reflink or copy server-side, sendfile and pread/write are the fallbacks
+// for kernels or filesystems that refuse it
+static int copy_range(int in_fd, off_t off, int out_fd, size_t n) {
+    while (n) {
+        ssize_t r = copy_file_range(in_fd, &off, out_fd, NULL, n, 0);
+        if (r <= 0) {
+            break;
+        }
+        n -= r;
+    }
+    while (n) {
+        ssize_t r = sendfile(out_fd, in_fd, &off, n);
+        if (r <= 0) {
+            break;
+        }
+        n -= r;
+    }
+    char buf[65536];
+    while (n) {
+        ssize_t r = pread(in_fd, buf, n < sizeof(buf) ? n : sizeof(buf), off);
+        if (r <= 0 || write_all(out_fd, buf, r) != 0) {
+            return 1;
+        }
+        off += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int copy_to_file(const char *path, int src_fd, off_t off, size_t n) {
+    if (create_parent_dir(path) != 0) {
+        return 1;
+    }
+
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        err("Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int res = copy_range(src_fd, off, out, n);
+    if (res != 0) {
+        err("Failed to copy all bytes to %s\n", path);
+    }
+
+    close(out);
+    return res;
+}
+
+// Read `n` bytes at `off` of the icon, either from its buffer or from the source file
+static int read_icon(const CursorData *data, const IconInfo *icon, size_t off, void *buf, size_t n) {
+    if (off + n > icon->buf_size) {
+        return 1;
+    }
+    if (icon->buf) {
+        memcpy(buf, (const uint8_t *)icon->buf + off, n);
+        return 0;
+    }
+    return pread(data->src_fd, buf, n, icon->off + off) != (ssize_t)n;
+}
+
+// Locate the selected entry of `icon`: the single entry header to write and the range of its
+// image inside the frame. Only the ICONDIR is read
+static int select_icon_entry(const GlobalContext *ctx,
+                             const CursorData *data,
+                             const IconInfo *icon,
+                             uint8_t header[ICO_HEADER_SIZE + ICO_ENTRY_SIZE],
+                             size_t *off,
+                             size_t *n) {
+    uint8_t head[ICO_HEADER_SIZE];
+    size_t dir_size = 0;
+    if (read_icon(data, icon, 0, head, sizeof(head)) == 0) {
+        dir_size = ico_dir_size(head);
+    }
+    uint8_t *dir_buf = dir_size ? malloc(dir_size) : NULL;
+    if (!dir_buf || read_icon(data, icon, 0, dir_buf, dir_size) != 0) {
+        err("Frame has no valid ICONDIR");
+        free(dir_buf);
+        return 1;
+    }
+
+    IcoDir dir;
+    int res = parse_ico_dir(dir_buf, dir_size, &dir);
+    free(dir_buf);
+    if (res != 0) {
+        return 1;
+    }
+    int idx = select_ico_entry(&dir, ctx->select_size);
+    const IcoEntry *e = idx >= 0 ? &dir.entries[idx] : NULL;
+    if (!e || e->offset > icon->buf_size || e->size > icon->buf_size - e->offset) {
+        err("No usable ICO entry in frame");
+        cleanup_ico_dir(&dir);
+        return 1;
+    }
+    build_single_ico_header(&dir, idx, header);
+    *off = e->offset;
+    *n = e->size;
+    cleanup_ico_dir(&dir);
+    return 0;
+}
+
+// Write an ICO holding only the selected entry of `icon`, the image itself is copied behind a
+// rewritten single entry header
+static int write_icon_entry(const GlobalContext *ctx,
+                            const char *path,
+                            const CursorData *data,
+                            const IconInfo *icon) {
+    uint8_t header[ICO_HEADER_SIZE + ICO_ENTRY_SIZE];
+    size_t off, n;
+    if (select_icon_entry(ctx, data, icon, header, &off, &n) != 0) {
+        err("Skip %s", path);
+        return 1;
+    }
+
+    if (create_parent_dir(path) != 0) {
+        return 1;
+    }
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        err("Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    int res = write_all(out, header, sizeof(header));
+    if (res == 0) {
+        res = icon->buf ? write_all(out, (const uint8_t *)icon->buf + off, n)
+                        : copy_range(data->src_fd, icon->off + off, out, n);
+    }
+    if (res != 0) {
+        err("Failed to write all bytes to %s\n", path);
+    }
+    close(out);
+    return res;
+}
+
+// Bytes of the ICO that extraction would write for `icon`, NULL on failure
+static uint8_t *load_icon(const GlobalContext *ctx,
+                          const CursorData *data,
+                          const IconInfo *icon,
+                          size_t *size) {
+    uint8_t header[ICO_HEADER_SIZE + ICO_ENTRY_SIZE];
+    size_t off = 0, n = icon->buf_size, head_size = 0;
+    if (ctx->select_size || ctx->select_best) {
+        if (select_icon_entry(ctx, data, icon, header, &off, &n) != 0) {
+            return NULL;
+        }
+        head_size = sizeof(header);
+    }
+    uint8_t *buf = malloc(head_size + n ? head_size + n : 1);
+    if (!buf) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    memcpy(buf, header, head_size);
+    if (read_icon(data, icon, off, buf + head_size, n) != 0) {
+        err("Failed to read frame");
+        free(buf);
+        return NULL;
+    }
+    *size = head_size + n;
+    return buf;
+}
+
+// Icons of a lazy parsed file are copied straight from the source file
+static int write_icon(const GlobalContext *ctx,
+                      const char *path,
+                      const CursorData *data,
+                      const IconInfo *icon) {
+    if (ctx->select_size || ctx->select_best) {
+        return write_icon_entry(ctx, path, data, icon);
+    } else if (icon->buf) {
+        return write_file(path, icon->buf, icon->buf_size);
+    } else {
+        return copy_to_file(path, data->src_fd, icon->off, icon->buf_size);
+    }
+}
+
+const char *path_basename(const char *name) {
+    const char *basename = strlen(name) + name;
+    while (basename != name && *(basename - 1) != '/') {
+        --basename;
+    }
+    // A member of an archive is named after the member, archive dirs may contain `.tar:` too
+    for (const char *member; (member = strstr(basename, TAR_SEPARATOR));) {
+        basename = member + strlen(TAR_SEPARATOR);
+    }
+    return basename;
+}
+
+// Point the frame path of the extract layout at a stored object, copy it across filesystems
+static int link_icon(const char *path, const char *object, const void *buf, size_t n) {
+    if (create_parent_dir(path) != 0) {
+        return 1;
+    }
+    // Never write through an old link, that would change the object
+    if (unlink(path) != 0 && errno != ENOENT) {
+        err("Failed to replace %s: %s", path, strerror(errno));
+        return 1;
+    }
+    if (link(object, path) != 0) {
+        debug("Cannot link `%s`: %s, copy it", path, strerror(errno));
+        return write_file(path, buf, n);
+    }
+    return 0;
+}
+
+// Put every frame of a file into the store and write its manifest, which lists the frames by
+// hash in playback order
+static int store_frames(const GlobalContext *ctx,
+                        const CursorData *data,
+                        const char *filename,
+                        const char *realname) {
+    StringBuilder *manifest = sb_new();
+    if (!manifest) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    sb_appendf(manifest, "{\"name\": \"");
+    sb_append_escaped(manifest, realname);
+    sb_appendf(manifest, "\",\"path\": \"");
+    sb_append_escaped(manifest, filename);
+    sb_appendf(manifest, "\",\"width\": %u,", data->cx);
+    sb_appendf(manifest, "\"height\": %u,", data->cy);
+    sb_appendf(manifest, "\"hotx\": %u,", data->hotx);
+    sb_appendf(manifest, "\"hoty\": %u,", data->hoty);
+    sb_appendf(manifest, "\"jif_rate\": %u,", data->jif_rate);
+    sb_appendf(manifest, "\"frames\": [");
+
+    int res = 0;
+    for (unsigned i = 0; data->icons && i < data->count; ++i) {
+        size_t size;
+        uint8_t *buf = load_icon(ctx, data, &data->icons[i], &size);
+        char hex[STORE_HASH_HEX];
+        if (!buf || store_put(ctx->store_dir, buf, size, hex) != 0) {
+            err("Failed to store frame %u of `%s`", i, realname);
+            free(buf);
+            res = 1;
+            break;
+        }
+        if (ctx->store_link) {
+            char object[PATH_MAX], path[PATH_MAX];
+            int len =
+                snprintf(path, sizeof(path), "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
+            if (len < 0 || len >= (int)sizeof(path)) {
+                err("Frame path of `%s` is too long", realname);
+                res = 1;
+            } else if (store_object_path(ctx->store_dir, hex, object) != 0 ||
+                       link_icon(path, object, buf, size) != 0) {
+                res = 1;
+            }
+        }
+        free(buf);
+        sb_appendf(manifest,
+                   "%s{\"hash\": \"%s\", \"size\": %zu, \"duration\": %.3f}",
+                   i ? "," : "",
+                   hex,
+                   size,
+                   step_ms(&data->icons[i]));
+    }
+    sb_appendf(manifest, "]}\n");
+
+    if (res == 0) {
+        res = store_put_manifest(ctx->store_dir, filename, manifest->data, manifest->size);
+    }
+    sb_cleanup(manifest);
+    return res;
+}
+
+// Convert a file into an Xcursor file named after it without `.ani`, next to its frame dir
+static int convert_xcursor(const GlobalContext *ctx, const CursorData *data, const char *realname) {
+    if (!data->icons || !data->count) {
+        return 1;
+    }
+    StringBuilder *path = sb_new();
+    XcursorSource *steps = calloc(data->count, sizeof(XcursorSource));
+    if (!path || !steps) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        sb_cleanup(path);
+        free(steps);
+        return 1;
+    }
+    size_t stem = is_ani_path(realname) ? strlen(realname) - 4 : strlen(realname);
+    sb_appendf(path, "%s/%.*s", ctx->prefix, (int)stem, realname);
+
+    int res = 0;
+    for (unsigned i = 0; i < data->count; ++i) {
+        const IconInfo *icon = &data->icons[i];
+        steps[i].ico_size = icon->buf_size;
+        steps[i].delay = ((uint64_t)icon->jiffies * 1000 + 30) / 60;
+        if (icon->buf) {
+            steps[i].ico = icon->buf;
+            continue;
+        }
+        // Frames of a lazy parsed file are loaded just for the conversion
+        uint8_t *buf = malloc(icon->buf_size ? icon->buf_size : 1);
+        if (!buf || read_icon(data, icon, 0, buf, icon->buf_size) != 0) {
+            err("Failed to read frame %u of `%s`", i, realname);
+            free(buf);
+            res = 1;
+            break;
+        }
+        steps[i].ico = buf;
+    }
+
+    if (res == 0) {
+        XcursorOptions opts = {
+            .size = ctx->select_size,
+            .best = ctx->select_best,
+            .cx = data->cx,
+            .cy = data->cy,
+            .hotx = data->hotx,
+            .hoty = data->hoty,
+            .scales = ctx->scales,
+            .scale_count = ctx->scale_count,
+            .filter = ctx->filter,
+            .jobs = ctx->jobs,
+        };
+        res = write_xcursor(path->data, steps, data->count, &opts);
+        debug("Writing Xcursor `%s`", path->data);
+    }
+    for (unsigned i = 0; i < data->count; ++i) {
+        if (!data->icons[i].buf) {
+            free((void *)steps[i].ico);
+        }
+    }
+    free(steps);
+    sb_cleanup(path);
+    return res;
+}
+
+// Resample decoded frames by the '-scale' factor, every frame to the size the first one scales to
+// so they share a canvas. The hotspot is mapped along
+static int scale_frames(const GlobalContext *ctx,
+                        Image *images,
+                        unsigned count,
+                        uint32_t *hotx,
+                        uint32_t *hoty) {
+    uint32_t width = images[0].width * ctx->scales[0] + 0.5f;
+    uint32_t height = images[0].height * ctx->scales[0] + 0.5f;
+    width = width ? width : 1;
+    height = height ? height : 1;
+    *hotx = scale_hotspot(*hotx, images[0].width, width);
+    *hoty = scale_hotspot(*hoty, images[0].height, height);
+    for (unsigned i = 0; i < count; ++i) {
+        Image scaled;
+        if (scale_image(&images[i], width, height, ctx->filter, &scaled) != 0) {
+            return 1;
+        }
+        cleanup_image(&images[i]);
+        images[i] = scaled;
+    }
+    return 0;
+}
+
+// Replace ICO frames with serialized deltas of their decoded images
+static int delta_frames(const GlobalContext *ctx,
+                        const uint8_t **frames,
+                        size_t *sizes,
+                        unsigned count,
+                        uint32_t *hotx,
+                        uint32_t *hoty) {
+    Image *images = calloc(count ? count : 1, sizeof(Image));
+    if (!images) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    int res = 0;
+    for (unsigned i = 0; i < count && res == 0; ++i) {
+        res = decode_ico(frames[i], sizes[i], ctx->select_size, &images[i]);
+    }
+    if (res == 0 && count && ctx->scale_count) {
+        res = scale_frames(ctx, images, count, hotx, hoty);
+    }
+    DeltaAnimation delta = {0, 0, 0, NULL};
+    if (res == 0) {
+        res = delta_encode(images, count, &delta);
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        cleanup_image(&images[i]);
+    }
+    free(images);
+    for (unsigned i = 0; i < count && res == 0; ++i) {
+        size_t size = delta_blob_size(&delta.deltas[i]);
+        uint8_t *blob = malloc(size);
+        if (!blob) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            res = 1;
+            break;
+        }
+        delta_write_blob(&delta, i, blob);
+        free((void *)frames[i]);
+        frames[i] = blob;
+        sizes[i] = size;
+    }
+    cleanup_delta(&delta);
+    return res;
+}
+
+// Append a file to the bundle, frames shared by steps through `seq ` are stored once. Steps and
+// their exact jiffies come from the compiled timeline, frames are numbered in order of first use.
+// Deltas are chained in step order instead, one per step, see ANIB_DELTA
+static int bundle_frames(const GlobalContext *ctx, const CursorData *data, const char *realname) {
+    AniTimeline *tl = compile_timeline(data->ani);
+    if (!tl || !tl->step_count) {
+        cleanup_timeline(tl);
+        return 1;
+    }
+    unsigned n = tl->step_count;
+    unsigned capacity = ctx->delta ? n : tl->frame_count;
+    uint32_t *slot = malloc(tl->frame_count ? tl->frame_count * sizeof(uint32_t) : 1);
+    AnibStep *steps = malloc(n * sizeof(AnibStep));
+    const uint8_t **frames = calloc(capacity + 1, sizeof(uint8_t *));
+    size_t *sizes = malloc((capacity + 1) * sizeof(size_t));
+    int res = 0;
+    if (!slot || !steps || !frames || !sizes) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        res = 1;
+    }
+    for (unsigned i = 0; res == 0 && i < tl->frame_count; ++i) {
+        slot[i] = UINT32_MAX;
+    }
+
+    unsigned frame_count = 0;
+    for (unsigned i = 0; res == 0 && i < n; ++i) {
+        uint32_t f = tl->step_frame[i];
+        steps[i].jiffies = tl->step_start_jif[i + 1] - tl->step_start_jif[i];
+        if (slot[f] != UINT32_MAX && !ctx->delta) {
+            steps[i].frame = slot[f];
+            continue;
+        }
+        IconInfo icon = {0, (void *)tl->frame_data[f], tl->frame_off[f], tl->frame_size[f]};
+        if (!icon.buf_size) {
+            err("Step %u of `%s` has no frame", i, realname);
+            res = 1;
+            break;
+        }
+        uint8_t *buf = load_icon(ctx, data, &icon, &sizes[frame_count]);
+        if (!buf) {
+            err("Failed to read frame %u of `%s`", f, realname);
+            res = 1;
+            break;
+        }
+        frames[frame_count] = buf;
+        slot[f] = frame_count;
+        steps[i].frame = frame_count++;
+    }
+
+    uint32_t hotx = tl->hotx, hoty = tl->hoty;
+    if (res == 0 && ctx->delta) {
+        res = delta_frames(ctx, frames, sizes, frame_count, &hotx, &hoty);
+    }
+    if (res == 0) {
+        AnibAnimation anim = {
+            .name = realname,
+            .width = data->cx,
+            .height = data->cy,
+            .hotx = hotx,
+            .hoty = hoty,
+            .jif_rate = data->jif_rate,
+            .flags = ctx->delta ? ANIB_DELTA : 0,
+            .steps = steps,
+            .step_count = n,
+            .frames = frames,
+            .frame_sizes = sizes,
+            .frame_count = frame_count,
+        };
+        res = anib_add(ctx->bundle, &anim);
+    }
+    for (unsigned i = 0; frames && i < frame_count; ++i) {
+        free((void *)frames[i]);
+    }
+    free(slot);
+    free(steps);
+    free(frames);
+    free(sizes);
+    cleanup_timeline(tl);
+    return res;
+}
+
+// Render information of a file into `out`, frames are written out when extracting
+static int emit_info(const GlobalContext *ctx,
+                     const CursorData *data,
+                     const char *filename,
+                     StringBuilder *out) {
+    // Dump content(json)
+    // {
+    //   "name": xxx.ani,
+    //   "width": cx,
+    //   "height": cy,
+    //   "hotx": hotx,
+    //   "hoty": hoty
+    //   "frames": [
+    //      {
+    //        "path": "path/to/frame01.ico",
+    //        "duration": ms
+    //      },
+    //      {
+    //        "path": "path/to/frame02.ico",
+    //        "duration": ms
+    //      },
+    //      {
+    //        "path": "path/to/frame03.ico",
+    //        "duration": ms
+    //      }
+    //   ]
+    // }
+    const char *realname = path_basename(filename);
+    // With a store, frames go there and the extract layout only holds links. Xcursor and bundle
+    // outputs replace the frames
+    char write_frames = ctx->mode == Extract && !ctx->store_dir && !ctx->xcursor && !ctx->bundle;
+    if (ctx->mode == Extract && ctx->store_dir &&
+        store_frames(ctx, data, filename, realname) != 0) {
+        return 1;
+    }
+    if (ctx->mode == Extract && ctx->xcursor && convert_xcursor(ctx, data, realname) != 0) {
+        return 1;
+    }
+    if (ctx->mode == Extract && ctx->bundle && bundle_frames(ctx, data, realname) != 0) {
+        return 1;
+    }
+    int res = 0;
+    switch (ctx->out_format) {
+        case Json: {
+            StringBuilder *json = out;
+            sb_appendf(json, "{\"name\": \"");
+            sb_append_escaped(json, realname);
+            sb_appendf(json, "\",\"width\": %u,", data->cx);
+            sb_appendf(json, "\"height\": %u,", data->cy);
+            sb_appendf(json, "\"hotx\": %u,", data->hotx);
+            sb_appendf(json, "\"hoty\": %u,", data->hoty);
+            sb_appendf(json, "\"jif_rate\": %u,", data->jif_rate);
+            sb_appendf(json, "\"frames\": [");
+            if (data->count >= 1 && data->icons) {
+                for (unsigned i = 0; i < data->count - 1; ++i) {
+                    StringBuilder *path_buf = sb_new();
+                    if (!path_buf) {
+                        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+                        return 1;
+                    }
+                    sb_appendf(path_buf, "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
+                    if (write_frames) {
+                        debug("Writing to file `%s`", path_buf->data);
+                        res |= write_icon(ctx, path_buf->data, data, &data->icons[i]);
+                    }
+
+                    sb_appendf(json, "{\"path\": \"");
+                    sb_append_escaped(json, path_buf->data);
+                    sb_appendf(json, "\",");
+                    sb_appendf(json, "\"duration\": %.3f},", step_ms(&data->icons[i]));
+
+                    sb_cleanup(path_buf);
+                }
+
+                StringBuilder *path_buf = sb_new();
+                if (!path_buf) {
+                    err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+                    return 1;
+                }
+                sb_appendf(path_buf,
+                           "%s/%s/frame-%03d.ico",
+                           ctx->prefix,
+                           realname,
+                           data->count - 1);
+                if (write_frames) {
+                    debug("Writing to file `%s`", path_buf->data);
+                    res |= write_icon(ctx, path_buf->data, data, &data->icons[data->count - 1]);
+                }
+
+                sb_appendf(json, "{\"path\": \"");
+                sb_append_escaped(json, path_buf->data);
+                sb_appendf(json, "\",");
+                sb_appendf(json, "\"duration\": %.3lf}", step_ms(&data->icons[data->count - 1]));
+
+                sb_cleanup(path_buf);
+            }
+            sb_appendf(json, "]}\n");
+            return res;
+        }
+        case Plain: {
+            StringBuilder *text = out;
+            sb_appendf(text, "Name: %s\n", realname);
+            sb_appendf(text, "Width: %u\n", data->cx);
+            sb_appendf(text, "Height: %u\n", data->cy);
+            sb_appendf(text, "HotX: %u\n", data->hotx);
+            sb_appendf(text, "HotY: %u\n", data->hoty);
+            sb_appendf(text, "JifRate: %u\n", data->jif_rate);
+            sb_appendf(text, "Frames:\n");
+            if (data->count >= 1 && data->icons) {
+                for (unsigned i = 0; i < data->count; ++i) {
+                    StringBuilder *path_buf = sb_new();
+                    if (!path_buf) {
+                        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+                        return 1;
+                    }
+                    sb_appendf(text, "  Frame%3d\n", i);
+                    sb_appendf(path_buf, "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
+                    if (write_frames) {
+                        debug("Writing to file `%s`", path_buf->data);
+                        res |= write_icon(ctx, path_buf->data, data, &data->icons[i]);
+                    }
+
+                    sb_appendf(text, "    Output file: %s\n", path_buf->data);
+                    sb_appendf(text, "    Duration: %.3f\n", step_ms(&data->icons[i]));
+
+                    sb_cleanup(path_buf);
+                }
+            }
+            sb_appendf(text, "\n");
+            return res;
+        }
+        case Silent: {
+            if (write_frames && data->icons) {
+                warn("Begin to extract `%s`", filename);
+                for (unsigned i = 0; i < data->count; ++i) {
+                    StringBuilder *path_buf = sb_new();
+                    if (!path_buf) {
+                        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+                        return 1;
+                    }
+                    sb_appendf(path_buf, "%s/%s/frame-%03d.ico", ctx->prefix, realname, i);
+                    debug("Writing to file `%s`", path_buf->data);
+                    res |= write_icon(ctx, path_buf->data, data, &data->icons[i]);
+                    sb_cleanup(path_buf);
+                }
+            }
+            return res;
+        }
+        default: assert(0);
+    }
+}
+
+struct ParsedFile {
+    AniFile *ani;
+    CursorData data;
+};
+
+static unsigned max_steps(const AniFile *ani) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        const Chunk *c = ani->chunks[i];
+        unsigned count = c->ty == ty_seq    ? ((const ChunkSeq *)c->inner)->count
+                         : c->ty == ty_rate ? ((const ChunkRate *)c->inner)->count
+                         : c->ty == ty_list ? ((const ChunkList *)c->inner)->count
+                                            : 0;
+        n = count > n ? count : n;
+    }
+    return n;
+}
+
+// Parse an opened file and collect its info, the file must stay open until it is emitted.
+// Frames of a file with a fd are not loaded but copied straight from it
+ParsedFile *parse_file(const GlobalContext *ctx, FILE *target, const char *path) {
+    ParsedFile *parsed = malloc(sizeof(ParsedFile));
+    if (!parsed) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    ParseOptions opts = {
+        .lazy_frames = fileno(target) >= 0, .recover = ctx->recover, .max_alloc = ctx->file_budget};
+    parsed->ani = parse_ani_ex(target, &opts);
+    if (!parsed->ani) {
+        free(parsed);
+        return NULL;
+    }
+    debug("Finish parsing `%s`", path);
+    WalkContext walk_ctx;
+    walk_ctx.ani = parsed->ani;
+    walk_ctx.visit_chunk = &collect_chunk_info;
+    walk_ctx.visit_frame = NULL;
+    CursorData *data = &parsed->data;
+    data->count = 0;
+    data->icons = NULL;
+    data->cx = 0;
+    data->cy = 0;
+    data->hotx = 0;
+    data->hoty = 0;
+    data->has_rate = 0;
+    data->seq = NULL;
+    data->rate = NULL;
+    data->list = NULL;
+    data->src_fd = fileno(target);
+    data->ani = parsed->ani;
+    data->max_steps = max_steps(parsed->ani);
+    walk_ctx.data = data;
+    walk(&walk_ctx);
+    resolve_steps(data);
+    debug("Finish collecting info of `%s`", path);
+    if (!data->icons) {
+        err("Cannot visit ani info");
+    }
+    return parsed;
+}
+
+int emit_file(const GlobalContext *ctx,
+              const ParsedFile *parsed,
+              const char *path,
+              StringBuilder *out) {
+    return emit_info(ctx, &parsed->data, path, out);
+}
+
+void cleanup_parsed_file(ParsedFile *parsed) {
+    if (!parsed) {
+        return;
+    }
+    free(parsed->data.icons);
+    cleanup_ani(parsed->ani);
+    free(parsed);
+}
+
+// Describe or extract an opened file, output is appended to `out`
+int process_file(const GlobalContext *ctx, FILE *target, const char *path, StringBuilder *out) {
+    ParsedFile *parsed = parse_file(ctx, target, path);
+    if (!parsed) {
+        return 1;
+    }
+    int ok = emit_file(ctx, parsed, path, out);
+    cleanup_parsed_file(parsed);
+    return ok;
+}
+
+FILE *open_task(const GlobalContext *ctx, const char *path, size_t *size) {
+    *size = 0;
+    // Members are named after the archive they were found in, the longest match wins so an
+    // archive path that contains the separator itself is still split right
+    TarArchive *tar = NULL;
+    size_t tar_len = 0;
+    for (unsigned i = 0; i < ctx->archive_count; ++i) {
+        size_t len = strlen(ctx->archives[i]->path);
+        if (len > tar_len && !strncmp(path, ctx->archives[i]->path, len) && path[len] == ':') {
+            tar = ctx->archives[i];
+            tar_len = len;
+        }
+    }
+    if (!tar) {
+        FILE *file = fopen(path, "rb");
+        struct stat st;
+        if (file && fstat(fileno(file), &st) == 0) {
+            *size = st.st_size;
+        }
+        return file;
+    }
+    const char *name = path + tar_len + 1;
+    const TarMember *member = tar_find(tar, name);
+    if (!member) {
+        err("No member `%s` in `%s`", name, tar->path);
+        return NULL;
+    }
+    if (!member->size) {
+        err("Member `%s` of `%s` is empty", name, tar->path);
+        return NULL;
+    }
+    *size = member->size;
+    return tar_member_file(tar, member);
+}
+
+int is_ani_path(const char *path) {
+    size_t len = strlen(path);
+    return len > 4 && !strcasecmp(path + len - 4, ".ani");
+}
+
+// Call `on_file` with every `*.ani` under `dir` and `on_dir` with every directory, `dir` included.
+// Order follows readdir, linked directories are skipped so a link cycle cannot recurse forever
+int scan_dir(const char *dir, ScanCallback on_file, ScanCallback on_dir, void *data) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        err("Cannot open dir `%s`: %s", dir, strerror(errno));
+        return 1;
+    }
+    if (on_dir) {
+        on_dir(dir, data);
+    }
+    int res = 0;
+    size_t dir_len = strlen(dir);
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        char *path = malloc(dir_len + strlen(entry->d_name) + 2);
+        if (!path) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            res = 1;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, entry->d_name);
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN && lstat(path, &st) == 0 && S_ISLNK(st.st_mode)) {
+            type = DT_LNK;
+        }
+        if (type == DT_LNK) {
+            // Links to files are followed, links to dirs are not, they may loop back up the tree
+            type = stat(path, &st) != 0 ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_LNK : DT_REG;
+            if (type == DT_LNK) {
+                debug("Skip linked dir `%s`", path);
+            }
+        } else if (type == DT_UNKNOWN) {
+            type = stat(path, &st) != 0 ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+        if (type == DT_DIR) {
+            res |= scan_dir(path, on_file, on_dir, data);
+        } else if (type == DT_REG && is_ani_path(path)) {
+            on_file(path, data);
+        }
+        free(path);
+    }
+    closedir(d);
+    return res;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdio.h>
+#include <linux/limits.h>
+
+#include "string_builder.h"
+#include "scale.h"
+#include "bundle.h"
+#include "tar.h"
+
+#define MAX_SCALES 8
+
+enum OutFormat { Json, Plain, Silent };
+
+enum Mode { Extract, Describe, Optimize, Serve, Watch, Merge, Report };
+
+// Options
+typedef struct {
+    enum Mode mode;
+    enum OutFormat out_format;
+    char recover;
+    unsigned jobs;  // worker threads
+    size_t mem_limit;  // bytes of files in flight in a batch
+    size_t file_budget;  // bytes of payloads a file may allocate, 0 for no limit
+    size_t process_budget;  // bytes of payloads all files being parsed may allocate
+    const char *socket_path;
+    const char *watch_path;
+    char recursive;  // expand directories in tasks
+    unsigned shard_index;  // 0 based
+    unsigned shard_count;  // 0 to process every task
+    char shard_by_size;  // balance shards by file size instead of count
+    unsigned select_size;  // extract only the ICO entry closest to this size
+    char select_best;  // extract only the largest ICO entry
+    const char *store_dir;  // content addressed frame store
+    char store_link;  // keep the extract layout as hard links into the store
+    char xcursor;  // extract as Xcursor files instead of frames
+    unsigned scale_count;
+    float scales[MAX_SCALES];  // decoded outputs are resampled to these
+    enum ScaleFilter filter;
+    const char *bundle_path;
+    AnibWriter *bundle;  // every extracted file is appended to it
+    char delta;  // bundle decoded frames as deltas instead of ICOs
+    unsigned archive_count;
+    TarArchive **archives;  // opened for `archive.tar:member` tasks
+    unsigned task_num;
+    const char **tasks;
+    unsigned *task_rel;  // with -r, where the path below the dir argument starts in each task
+    const char prefix[PATH_MAX];
+} GlobalContext;
+
+const char *path_basename(const char *name);
+
+int create_parent_dir(const char *path);
+
+typedef struct ParsedFile ParsedFile;
+
+ParsedFile *parse_file(const GlobalContext *ctx, FILE *target, const char *path);
+
+int emit_file(const GlobalContext *ctx,
+              const ParsedFile *parsed,
+              const char *path,
+              StringBuilder *out);
+
+void cleanup_parsed_file(ParsedFile *parsed);
+
+int process_file(const GlobalContext *ctx, FILE *target, const char *path, StringBuilder *out);
+
+// Open a task, the size of it is returned in `size`. Members of archives are read in place
+FILE *open_task(const GlobalContext *ctx, const char *path, size_t *size);
+
+typedef void (*ScanCallback)(const char *path, void *data);
+
+int is_ani_path(const char *path);
+
+int scan_dir(const char *dir, ScanCallback on_file, ScanCallback on_dir, void *data);
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "ani.h"
+
+// Defined by main.c in the tool
+char debug_mode = 0;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                        \
+        }                                                                      \
+    } while (0)
+
+// Exit status of a test binary
+#define TEST_RESULT() (failures ? (fprintf(stderr, "%d checks failed\n", failures), 1) : 0)
+
+// Growable byte buffer to build RIFF files in memory
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t cap;
+} Buf;
+
+static void buf_put(Buf *b, const void *p, size_t n) {
+    if (b->size + n > b->cap) {
+        b->cap = (b->size + n) * 2;
+        b->data = realloc(b->data, b->cap);
+        if (!b->data) {
+            abort();
+        }
+    }
+    memcpy(b->data + b->size, p, n);
+    b->size += n;
+}
+
+static void buf_u8(Buf *b, uint8_t v) {
+    buf_put(b, &v, 1);
+}
+
+static void buf_u16(Buf *b, uint16_t v) {
+    uint8_t le[2] = {v & 0xff, v >> 8};
+    buf_put(b, le, 2);
+}
+
+static void buf_u32(Buf *b, uint32_t v) {
+    uint8_t le[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24};
+    buf_put(b, le, 4);
+}
+
+// Open a chunk, returns the offset to give to `buf_end`
+static size_t buf_begin(Buf *b, const char *cid) {
+    buf_put(b, cid, 4);
+    buf_u32(b, 0);
+    return b->size;
+}
+
+// Patch the size of a chunk and pad it to even length
+static void buf_end(Buf *b, size_t start) {
+    uint32_t size = b->size - start;
+    uint8_t le[4] = {size & 0xff, (size >> 8) & 0xff, (size >> 16) & 0xff, size >> 24};
+    memcpy(b->data + start - 4, le, 4);
+    if (size & 1) {
+        buf_u8(b, 0);
+    }
+}
+
+static void buf_free(Buf *b) {
+    free(b->data);
+    b->data = NULL;
+    b->size = b->cap = 0;
+}
+
+// Anonymous file holding the buffer, positioned at its start
+static FILE *buf_file(const Buf *b) {
+    FILE *f = tmpfile();
+    if (!f || fwrite(b->data, 1, b->size, f) != b->size) {
+        abort();
+    }
+    rewind(f);
+    return f;
+}
+
+// Whole content of a stream
+static Buf file_buf(FILE *f) {
+    Buf b = {0};
+    uint8_t chunk[4096];
+    size_t n;
+    rewind(f);
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        buf_put(&b, chunk, n);
+    }
+    return b;
+}
+
+// Stdout of the code run between `capture_begin` and `capture_end`
+typedef struct {
+    FILE *file;
+    int saved;
+} Capture;
+
+static void capture_begin(Capture *c) {
+    fflush(stdout);
+    c->file = tmpfile();
+    c->saved = dup(STDOUT_FILENO);
+    if (!c->file || c->saved < 0 || dup2(fileno(c->file), STDOUT_FILENO) < 0) {
+        abort();
+    }
+}
+
+static Buf capture_end(Capture *c) {
+    fflush(stdout);
+    dup2(c->saved, STDOUT_FILENO);
+    close(c->saved);
+    Buf b = file_buf(c->file);
+    fclose(c->file);
+    return b;
+}
+
+// A cursor ICO of `count` square 32 bpp DIB entries, entry i is sizes[i] px and keeps the
+// hotspot. Pixel k of an entry is `0xff000000 | (k / 3 + seed) * 0x10305`
+static Buf make_ico(const uint32_t *sizes,
+                    unsigned count,
+                    uint16_t hotx,
+                    uint16_t hoty,
+                    uint32_t seed) {
+    Buf b = {0};
+    buf_u16(&b, 0);
+    buf_u16(&b, 2);
+    buf_u16(&b, count);
+    uint32_t off = 6 + count * 16;
+    for (unsigned i = 0; i < count; ++i) {
+        uint32_t n = sizes[i], size = 40 + n * n * 4 + (n + 31) / 32 * 4 * n;
+        buf_u8(&b, n);
+        buf_u8(&b, n);
+        buf_u16(&b, 0);
+        buf_u16(&b, hotx);
+        buf_u16(&b, hoty);
+        buf_u32(&b, size);
+        buf_u32(&b, off);
+        off += size;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        uint32_t n = sizes[i];
+        uint32_t head[10] = {40, n, n * 2, 1 | 32 << 16, 0, 0, 0, 0, 0, 0};
+        for (unsigned k = 0; k < 10; ++k) {
+            buf_u32(&b, head[k]);
+        }
+        for (uint32_t k = 0; k < n * n; ++k) {
+            buf_u32(&b, 0xff000000u | (k / 3 + seed) * 0x10305);
+        }
+        for (uint32_t k = 0; k < (n + 31) / 32 * 4 * n; ++k) {
+            buf_u8(&b, 0);
+        }
+    }
+    return b;
+}
+
+// An ACON file of `frame_count` icon frames, frames[i] of sizes[i] bytes. `seq` and `rate` are
+// skipped when NULL, `step_count` entries otherwise
+static Buf make_ani(const void *const *frames,
+                    const size_t *sizes,
+                    unsigned frame_count,
+                    const unsigned *seq,
+                    const uint32_t *rate,
+                    unsigned step_count,
+                    uint32_t jif_rate) {
+    Buf b = {0};
+    size_t riff = buf_begin(&b, "RIFF");
+    buf_put(&b, "ACON", 4);
+    size_t anih = buf_begin(&b, "anih");
+    uint32_t fields[9] = {36, frame_count, step_count, 0, 0, 0, 0, jif_rate, seq ? 3 : 1};
+    for (unsigned i = 0; i < 9; ++i) {
+        buf_u32(&b, fields[i]);
+    }
+    buf_end(&b, anih);
+    if (rate) {
+        size_t c = buf_begin(&b, "rate");
+        for (unsigned i = 0; i < step_count; ++i) {
+            buf_u32(&b, rate[i]);
+        }
+        buf_end(&b, c);
+    }
+    if (seq) {
+        size_t c = buf_begin(&b, "seq ");
+        for (unsigned i = 0; i < step_count; ++i) {
+            buf_u32(&b, seq[i]);
+        }
+        buf_end(&b, c);
+    }
+    size_t list = buf_begin(&b, "LIST");
+    buf_put(&b, "fram", 4);
+    for (unsigned i = 0; i < frame_count; ++i) {
+        size_t c = buf_begin(&b, "icon");
+        buf_put(&b, frames[i], sizes[i]);
+        buf_end(&b, c);
+    }
+    buf_end(&b, list);
+    buf_end(&b, riff);
+    return b;
+}
+
+// First chunk of a type, NULL if there is none
+static const Chunk *find_chunk(const AniFile *ani, enum ChunkType ty) {
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        if (ani->chunks[i]->ty == ty) {
+            return ani->chunks[i];
+        }
+    }
+    return NULL;
+}
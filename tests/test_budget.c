@@ -0,0 +1,84 @@
+#include "test.h"
+
+static AniFile *parse_buf(const Buf *b, const ParseOptions *opts) {
+    FILE *f = buf_file(b);
+    AniFile *ani = parse_ani_ex(f, opts);
+    fclose(f);
+    return ani;
+}
+
+static Buf frames_ani(unsigned count, size_t size) {
+    static uint8_t payload[256];
+    const void *frames[64];
+    size_t sizes[64];
+    for (unsigned i = 0; i < count; ++i) {
+        frames[i] = payload;
+        sizes[i] = size;
+    }
+    return make_ani(frames, sizes, count, NULL, NULL, count, 1);
+}
+
+// Payloads count against the file budget, and are given back to the process when freed
+static void test_file_budget(void) {
+    Buf in = frames_ani(4, 200);
+    ParseOptions opts = {0, 0, 1000};
+    AniFile *ani = parse_buf(&in, &opts);
+    CHECK(ani != NULL);
+    CHECK(ani_process_usage() >= 800);
+    cleanup_ani(ani);
+    CHECK(ani_process_usage() == 0);
+
+    opts.max_alloc = 700;
+    CHECK(parse_buf(&in, &opts) == NULL);
+    CHECK(ani_process_usage() == 0);
+    buf_free(&in);
+}
+
+// Lazy frames allocate only their record, which is charged all the same
+static void test_lazy(void) {
+    Buf in = frames_ani(64, 2);
+    ParseOptions opts = {1, 0, 64 * sizeof(Frame)};
+    AniFile *ani = parse_buf(&in, &opts);
+    CHECK(ani != NULL);
+    if (ani) {
+        const ChunkList *list = find_chunk(ani, ty_list)->inner;
+        CHECK(list->count == 64 && list->frames[0]->buffer == NULL);
+        cleanup_ani(ani);
+    }
+    opts.max_alloc = 10 * sizeof(Frame);
+    CHECK(parse_buf(&in, &opts) == NULL);
+    CHECK(ani_process_usage() == 0);
+    buf_free(&in);
+}
+
+// The process budget is shared by every file alive
+static void test_process_budget(void) {
+    Buf in = frames_ani(2, 200);
+    ani_set_process_budget(600);
+    AniFile *first = parse_buf(&in, NULL);
+    CHECK(first != NULL);
+    CHECK(parse_buf(&in, NULL) == NULL);
+    cleanup_ani(first);
+    AniFile *again = parse_buf(&in, NULL);
+    CHECK(again != NULL);
+    cleanup_ani(again);
+    ani_set_process_budget(0);
+    buf_free(&in);
+}
+
+// A declared size beyond the end of file is rejected before anything is allocated
+static void test_truncated(void) {
+    Buf in = frames_ani(2, 200);
+    in.size -= 150;
+    CHECK(parse_buf(&in, NULL) == NULL);
+    CHECK(ani_process_usage() == 0);
+    buf_free(&in);
+}
+
+int main(void) {
+    test_file_budget();
+    test_lazy();
+    test_process_budget();
+    test_truncated();
+    return TEST_RESULT();
+}
@@ -0,0 +1,138 @@
+#include <unistd.h>
+
+#include "test.h"
+#include "bundle.h"
+#include "task.h"
+
+static int payload_is(const AnibFile *b, const AnibRecord *r, unsigned i, const void *p, size_t n) {
+    const AnibFrame *f = &anib_frames(b, r)[i];
+    return f->off % ANIB_ALIGN == 0 && f->size == n && !memcmp(anib_payload(b, f), p, n);
+}
+
+// Animations added directly come back with their steps and payloads
+static void test_round_trip(const char *path) {
+    const uint8_t a[] = "first payload", b[] = "second, longer payload";
+    const uint8_t *frames[] = {a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b)};
+    AnibStep steps[] = {{1, 4}, {0, 2}, {1, 7}};
+    AnibAnimation anims[2] = {
+        {"one.ani", 32, 32, 3, 5, 4, 0, steps, 3, frames, sizes, 2},
+        {"two.ani", 48, 48, 0, 0, 2, 0, steps + 1, 1, frames, sizes, 1},
+    };
+    AnibWriter *w = anib_create(path);
+    CHECK(w != NULL);
+    if (!w) {
+        return;
+    }
+    CHECK(anib_add(w, &anims[0]) == 0);
+    CHECK(anib_add(w, &anims[1]) == 0);
+    CHECK(anib_finish(w) == 0);
+
+    AnibFile *bundle = anib_open(path);
+    CHECK(bundle != NULL);
+    if (!bundle) {
+        return;
+    }
+    CHECK(bundle->header->count == 2);
+    const AnibRecord *one = anib_find(bundle, "one.ani"), *two = anib_find(bundle, "two.ani");
+    CHECK(one != NULL && two != NULL && anib_find(bundle, "three.ani") == NULL);
+    if (one && two) {
+        CHECK(!strcmp(anib_name(bundle, one), "one.ani"));
+        CHECK(one->width == 32 && one->hotx == 3 && one->hoty == 5 && one->jif_rate == 4);
+        CHECK(one->step_count == 3 && one->frame_count == 2 && one->flags == 0);
+        for (unsigned i = 0; i < 3; ++i) {
+            CHECK(anib_steps(bundle, one)[i].frame == steps[i].frame);
+            CHECK(anib_steps(bundle, one)[i].jiffies == steps[i].jiffies);
+        }
+        CHECK(payload_is(bundle, one, 0, a, sizeof(a)));
+        CHECK(payload_is(bundle, one, 1, b, sizeof(b)));
+        CHECK(two->width == 48 && two->step_count == 1 && two->frame_count == 1);
+        CHECK(payload_is(bundle, two, 0, a, sizeof(a)));
+    }
+    anib_close(bundle);
+}
+
+// A payload off its alignment is caught when the bundle is opened
+static void test_misaligned(const char *path, const char *bad_path) {
+    AnibFile *bundle = anib_open(path);
+    CHECK(bundle != NULL);
+    if (!bundle) {
+        return;
+    }
+    Buf copy = {0};
+    buf_put(&copy, bundle->base, bundle->size);
+    const AnibRecord *r = anib_record(bundle, 0);
+    uint64_t frame_off = r->frames_off;
+    anib_close(bundle);
+
+    AnibFrame *f = (AnibFrame *)(copy.data + frame_off);
+    f->off += 8;
+    FILE *out = fopen(bad_path, "wb");
+    CHECK(out != NULL);
+    if (out) {
+        fwrite(copy.data, 1, copy.size, out);
+        fclose(out);
+    }
+    CHECK(anib_open(bad_path) == NULL);
+    buf_free(&copy);
+}
+
+// Files extracted with `-bundle` keep their steps, exact jiffies and frames, shared frames once
+static void test_extract(const char *path) {
+    const char a[] = "frame-a", b[] = "frame-bb";
+    const void *frames[] = {a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b)};
+    unsigned seq[] = {0, 1, 0};
+    uint32_t rate[] = {2, 0, 9};
+    Buf in = make_ani(frames, sizes, 2, seq, rate, 3, 5);
+
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = Extract;
+    ctx.out_format = Silent;
+    ctx.bundle = anib_create(path);
+    CHECK(ctx.bundle != NULL);
+    if (!ctx.bundle) {
+        buf_free(&in);
+        return;
+    }
+    StringBuilder *out = sb_new();
+    FILE *f = buf_file(&in);
+    CHECK(process_file(&ctx, f, "dir/x.ani", out) == 0);
+    fclose(f);
+    sb_cleanup(out);
+    CHECK(anib_finish(ctx.bundle) == 0);
+
+    AnibFile *bundle = anib_open(path);
+    CHECK(bundle != NULL);
+    const AnibRecord *r = bundle ? anib_find(bundle, "x.ani") : NULL;
+    CHECK(r != NULL);
+    if (r) {
+        const AnibStep *steps = anib_steps(bundle, r);
+        CHECK(r->step_count == 3 && r->frame_count == 2 && r->jif_rate == 5);
+        CHECK(steps[0].frame == 0 && steps[1].frame == 1 && steps[2].frame == 0);
+        CHECK(steps[0].jiffies == 2 && steps[1].jiffies == 5 && steps[2].jiffies == 9);
+        CHECK(payload_is(bundle, r, 0, a, sizeof(a)));
+        CHECK(payload_is(bundle, r, 1, b, sizeof(b)));
+    }
+    anib_close(bundle);
+    buf_free(&in);
+}
+
+int main(void) {
+    char dir[] = "/tmp/ani-bundle-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX], bad_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/a.anib", dir);
+    snprintf(bad_path, sizeof(bad_path), "%s/bad.anib", dir);
+    test_round_trip(path);
+    test_misaligned(path, bad_path);
+    test_extract(path);
+    unlink(path);
+    unlink(bad_path);
+    rmdir(dir);
+    return TEST_RESULT();
+}
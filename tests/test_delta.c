@@ -0,0 +1,184 @@
+#include <unistd.h>
+
+#include "test.h"
+#include "delta.h"
+#include "bundle.h"
+#include "task.h"
+
+#define W 37
+#define H 23
+#define FRAMES 5
+
+// Frames that change a little, not at all, everywhere, and in scattered pixels
+static void make_frames(Image frames[FRAMES], uint32_t *pixels) {
+    for (unsigned f = 0; f < FRAMES; ++f) {
+        frames[f].width = W;
+        frames[f].height = H;
+        frames[f].pixels = pixels + f * W * H;
+    }
+    for (unsigned i = 0; i < W * H; ++i) {
+        pixels[i] = 0xff000000u | i * 2654435761u >> 8;
+    }
+    memcpy(frames[1].pixels, frames[0].pixels, W * H * 4);
+    for (unsigned y = 4; y < 9; ++y) {
+        for (unsigned x = 10; x < 30; ++x) {
+            frames[1].pixels[y * W + x] ^= 0x00ff00ff;
+        }
+    }
+    memcpy(frames[2].pixels, frames[1].pixels, W * H * 4);
+    for (unsigned i = 0; i < W * H; ++i) {
+        frames[3].pixels[i] = ~frames[2].pixels[i];
+    }
+    memcpy(frames[4].pixels, frames[3].pixels, W * H * 4);
+    for (unsigned i = 5; i < W * H; i += 97) {
+        frames[4].pixels[i] = 0;
+    }
+}
+
+// Serialized deltas applied in order rebuild every frame, an unchanged frame has no rectangle
+static void test_round_trip(void) {
+    static uint32_t pixels[FRAMES * W * H];
+    Image frames[FRAMES];
+    make_frames(frames, pixels);
+    DeltaAnimation a;
+    CHECK(delta_encode(frames, FRAMES, &a) == 0);
+    CHECK(a.width == W && a.height == H && a.count == FRAMES);
+    CHECK(a.deltas[2].w == 0 || a.deltas[2].h == 0);
+    CHECK(a.deltas[1].x == 10 && a.deltas[1].y == 4 && a.deltas[1].w == 20 && a.deltas[1].h == 5);
+
+    static uint32_t canvas[W * H];
+    memset(canvas, 0, sizeof(canvas));
+    for (unsigned i = 0; i < FRAMES; ++i) {
+        size_t size = delta_blob_size(&a.deltas[i]);
+        uint32_t *blob = malloc(size);
+        delta_write_blob(&a, i, (uint8_t *)blob);
+        uint32_t width, height;
+        FrameDelta view;
+        CHECK(delta_view_blob((const uint8_t *)blob, size, &width, &height, &view) == 0);
+        CHECK(width == W && height == H);
+        delta_apply(&view, canvas, width);
+        CHECK(!memcmp(canvas, frames[i].pixels, sizeof(canvas)));
+        free(blob);
+    }
+    // Seeking rebuilds from a cleared canvas
+    delta_frame(&a, 3, canvas);
+    CHECK(!memcmp(canvas, frames[3].pixels, sizeof(canvas)));
+    cleanup_delta(&a);
+}
+
+// Blobs whose rectangle or runs leave the canvas are refused before they are applied
+static void test_bad_blob(void) {
+    uint32_t blob[DELTA_HEADER_WORDS + 3] = {4, 4, 2, 2, 3, 1, 0, 1, 0};
+    uint32_t width, height;
+    FrameDelta view;
+    CHECK(delta_view_blob((const uint8_t *)blob, sizeof(blob), &width, &height, &view) != 0);
+    uint32_t runs[DELTA_HEADER_WORDS + 3] = {4, 4, 0, 0, 2, 2, 0, 5, 0};
+    CHECK(delta_view_blob((const uint8_t *)runs, sizeof(runs), &width, &height, &view) != 0);
+    CHECK(delta_view_blob((const uint8_t *)runs, 10, &width, &height, &view) != 0);
+}
+
+// Bundle `in` with `-delta`, the scale factor is skipped when 0
+static AnibFile *bundle_delta(const char *path, const Buf *in, float scale) {
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = Extract;
+    ctx.out_format = Silent;
+    ctx.delta = 1;
+    ctx.scale_count = scale > 0;
+    ctx.scales[0] = scale;
+    ctx.filter = FilterBox;
+    ctx.bundle = anib_create(path);
+    if (!ctx.bundle) {
+        return NULL;
+    }
+    StringBuilder *out = sb_new();
+    FILE *f = buf_file(in);
+    CHECK(process_file(&ctx, f, "x.ani", out) == 0);
+    fclose(f);
+    sb_cleanup(out);
+    CHECK(anib_finish(ctx.bundle) == 0);
+    return anib_open(path);
+}
+
+// Rebuild step `i` of a delta record into `canvas`, its size is returned
+static int play_step(const AnibFile *b, const AnibRecord *r, unsigned i, Image *canvas) {
+    const AnibFrame *frames = anib_frames(b, r);
+    const AnibStep *steps = anib_steps(b, r);
+    FrameDelta view;
+    if (delta_view_blob(anib_payload(b, &frames[steps[i].frame]),
+                        frames[steps[i].frame].size,
+                        &canvas->width,
+                        &canvas->height,
+                        &view) != 0) {
+        return 1;
+    }
+    delta_apply(&view, canvas->pixels, canvas->width);
+    return 0;
+}
+
+// Steps of a `-delta` bundle play back to the decoded frames, `-scale` resamples them first
+static void test_bundle(const char *path) {
+    uint32_t size = 16;
+    Buf icos[3] = {
+        make_ico(&size, 1, 3, 5, 0), make_ico(&size, 1, 3, 5, 7), make_ico(&size, 1, 3, 5, 9)};
+    const void *frames[] = {icos[0].data, icos[1].data, icos[2].data};
+    size_t sizes[] = {icos[0].size, icos[1].size, icos[2].size};
+    unsigned seq[] = {0, 1, 2, 1};
+    Buf in = make_ani(frames, sizes, 3, seq, NULL, 4, 6);
+
+    AnibFile *b = bundle_delta(path, &in, 0);
+    CHECK(b != NULL);
+    const AnibRecord *r = b ? anib_find(b, "x.ani") : NULL;
+    CHECK(r != NULL);
+    if (r) {
+        CHECK(r->flags == ANIB_DELTA && r->step_count == 4 && r->frame_count == 4);
+        CHECK(r->hotx == 3 && r->hoty == 5);
+        static uint32_t pixels[16 * 16];
+        memset(pixels, 0, sizeof(pixels));
+        Image canvas = {0, 0, pixels};
+        for (unsigned i = 0; i < 4; ++i) {
+            Image want;
+            CHECK(decode_ico(icos[seq[i]].data, icos[seq[i]].size, 0, &want) == 0);
+            CHECK(play_step(b, r, i, &canvas) == 0);
+            CHECK(canvas.width == 16 && canvas.height == 16);
+            CHECK(!memcmp(pixels, want.pixels, sizeof(pixels)));
+            cleanup_image(&want);
+        }
+    }
+    anib_close(b);
+
+    b = bundle_delta(path, &in, 2);
+    CHECK(b != NULL);
+    r = b ? anib_find(b, "x.ani") : NULL;
+    CHECK(r != NULL);
+    if (r) {
+        CHECK(r->hotx == 7 && r->hoty == 11);
+        static uint32_t pixels[32 * 32];
+        memset(pixels, 0, sizeof(pixels));
+        Image canvas = {0, 0, pixels};
+        CHECK(play_step(b, r, 0, &canvas) == 0);
+        CHECK(canvas.width == 32 && canvas.height == 32);
+    }
+    anib_close(b);
+    for (unsigned i = 0; i < 3; ++i) {
+        buf_free(&icos[i]);
+    }
+    buf_free(&in);
+}
+
+int main(void) {
+    test_round_trip();
+    test_bad_blob();
+
+    char dir[] = "/tmp/ani-delta-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/d.anib", dir);
+    test_bundle(path);
+    unlink(path);
+    rmdir(dir);
+    return TEST_RESULT();
+}
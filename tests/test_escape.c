@@ -0,0 +1,23 @@
+#include "test.h"
+#include "string_builder.h"
+
+static int escapes_to(const char *s, const char *expected) {
+    StringBuilder *sb = sb_new();
+    sb_append_escaped(sb, s);
+    int same = !strcmp(sb->data, expected);
+    if (!same) {
+        fprintf(stderr, "`%s` is escaped to `%s`\n", s, sb->data);
+    }
+    sb_cleanup(sb);
+    return same;
+}
+
+int main(void) {
+    CHECK(escapes_to("plain.ani", "plain.ani"));
+    CHECK(escapes_to("a\"b\\c", "a\\\"b\\\\c"));
+    CHECK(escapes_to("tab\tnl\ncr\r", "tab\\tnl\\ncr\\r"));
+    CHECK(escapes_to("\x01\x1f", "\\u0001\\u001f"));
+    CHECK(escapes_to("caf\xc3\xa9", "caf\xc3\xa9"));
+    CHECK(escapes_to("", ""));
+    return TEST_RESULT();
+}
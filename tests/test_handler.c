@@ -0,0 +1,116 @@
+#include "test.h"
+
+typedef struct {
+    uint32_t size;
+    char text[16];
+} Note;
+
+static unsigned visits;
+
+static void *parse_note(ParseContext *ctx, void *user) {
+    (void)user;
+    Note *note = calloc(1, sizeof(Note));
+    uint32_t size = ani_chunk_size(ctx);
+    if (!note || size >= sizeof(note->text) || !ani_read(ctx, note->text, size)) {
+        free(note);
+        return NULL;
+    }
+    note->size = size;
+    return note;
+}
+
+static void cleanup_note(void *inner, void *user) {
+    (void)user;
+    free(inner);
+}
+
+static void visit_note(const Chunk *chunk, const WalkContext *ctx) {
+    (void)chunk;
+    (void)ctx;
+    ++visits;
+}
+
+// A chunk id and a LIST type are dispatched to their handlers, and visited by walk
+static void test_dispatch(void) {
+    ChunkHandler note = {ANI_FOURCC('n', 'o', 't', 'e'), 0, ty_custom, parse_note, cleanup_note,
+                         visit_note, NULL};
+    ChunkHandler info = {ANI_FOURCC('I', 'N', 'F', 'O'), 1, ty_custom, parse_note, cleanup_note,
+                         NULL, NULL};
+    CHECK(ani_register_handler(&note) == 0);
+    CHECK(ani_register_handler(&info) == 0);
+    CHECK(ani_find_handler(note.fourcc, 0) != NULL);
+    CHECK(ani_find_handler(note.fourcc, 1) == NULL);
+    CHECK(ani_find_handler(info.fourcc, 1) != NULL);
+
+    Buf b = {0};
+    size_t riff = buf_begin(&b, "RIFF");
+    buf_put(&b, "ACON", 4);
+    size_t c = buf_begin(&b, "note");
+    buf_put(&b, "hello", 5);
+    buf_end(&b, c);
+    c = buf_begin(&b, "LIST");
+    buf_put(&b, "INFOab", 6);
+    buf_end(&b, c);
+    c = buf_begin(&b, "junk");
+    buf_put(&b, "xyz", 3);
+    buf_end(&b, c);
+    buf_end(&b, riff);
+
+    FILE *f = buf_file(&b);
+    AniFile *ani = parse_ani(f);
+    fclose(f);
+    CHECK(ani != NULL);
+    if (ani) {
+        CHECK(ani->chunk_count == 2);
+        const Note *n = ani->chunk_count > 0 ? ani->chunks[0]->inner : NULL;
+        CHECK(n && n->size == 5 && !strcmp(n->text, "hello"));
+        CHECK(ani->chunks[0]->fourcc == note.fourcc && ani->chunks[0]->ty == ty_custom);
+        const Note *i = ani->chunk_count > 1 ? ani->chunks[1]->inner : NULL;
+        CHECK(i && i->size == 2 && !strcmp(i->text, "ab"));
+
+        WalkContext walk_ctx = {ani, NULL, NULL, NULL};
+        visits = 0;
+        walk(&walk_ctx);
+        CHECK(visits == 1);
+    }
+    cleanup_ani(ani);
+    buf_free(&b);
+}
+
+// Registering a FourCC again replaces its handler
+static void test_replace(void) {
+    static int tag;
+    ChunkHandler note = {ANI_FOURCC('n', 'o', 't', 'e'), 0, ty_custom, parse_note, cleanup_note,
+                         NULL, &tag};
+    CHECK(ani_register_handler(&note) == 0);
+    const ChunkHandler *h = ani_find_handler(note.fourcc, 0);
+    CHECK(h && h->user == &tag && h->visit == NULL);
+}
+
+// A full table refuses more handlers, and lookups of unknown FourCCs still end
+static void test_full_table(void) {
+    unsigned added = 0;
+    for (uint32_t i = 0; i < 256; ++i) {
+        ChunkHandler h = {ANI_FOURCC('z', 'z', i / 16 + 'a', i % 16 + 'a'), 0, ty_custom,
+                          parse_note, cleanup_note, NULL, NULL};
+        if (ani_register_handler(&h) != 0) {
+            break;
+        }
+        ++added;
+    }
+    // anih, seq, rate and note are already there, one slot stays empty
+    CHECK(added == 64 - 1 - 4);
+    CHECK(ani_find_handler(ANI_FOURCC('u', 'n', 'k', 'n'), 0) == NULL);
+    CHECK(ani_find_handler(ANI_FOURCC('z', 'z', 'a', 'a'), 0) != NULL);
+    CHECK(ani_find_handler(ANI_FOURCC('a', 'n', 'i', 'h'), 0) != NULL);
+    ChunkHandler again = {ANI_FOURCC('z', 'z', 'a', 'a'), 0, ty_custom, parse_note, cleanup_note,
+                          visit_note, NULL};
+    CHECK(ani_register_handler(&again) == 0);
+}
+
+int main(void) {
+    test_dispatch();
+    test_replace();
+    test_full_table();
+    return TEST_RESULT();
+}
@@ -0,0 +1,195 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <ranges>
+#include <vector>
+
+#include "ani.hpp"
+
+// Defined by main.c in the tool
+extern "C" {
+char debug_mode = 0;
+}
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                      \
+    do {                                                                                 \
+        if (!(cond)) {                                                                   \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                                  \
+        }                                                                                \
+    } while (0)
+
+namespace {
+
+const char frame_a[] = "frame-a";
+const char frame_b[] = "frame-bbb";
+
+void put_u32(std::vector<uint8_t> &b, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        b.push_back(v >> (i * 8) & 0xff);
+    }
+}
+
+std::size_t begin_chunk(std::vector<uint8_t> &b, const char *cid) {
+    b.insert(b.end(), cid, cid + 4);
+    put_u32(b, 0);
+    return b.size();
+}
+
+void end_chunk(std::vector<uint8_t> &b, std::size_t start) {
+    uint32_t size = b.size() - start;
+    for (int i = 0; i < 4; ++i) {
+        b[start - 4 + i] = size >> (i * 8) & 0xff;
+    }
+    if (size & 1) {
+        b.push_back(0);
+    }
+}
+
+// Two frames shown in three steps through seq and rate
+std::vector<uint8_t> make_file() {
+    std::vector<uint8_t> b;
+    std::size_t riff = begin_chunk(b, "RIFF");
+    b.insert(b.end(), {'A', 'C', 'O', 'N'});
+    std::size_t c = begin_chunk(b, "anih");
+    for (uint32_t v : {36u, 2u, 3u, 0u, 0u, 0u, 0u, 6u, 3u}) {
+        put_u32(b, v);
+    }
+    end_chunk(b, c);
+    c = begin_chunk(b, "seq ");
+    for (uint32_t v : {0u, 1u, 0u}) {
+        put_u32(b, v);
+    }
+    end_chunk(b, c);
+    c = begin_chunk(b, "rate");
+    for (uint32_t v : {4u, 5u, 6u}) {
+        put_u32(b, v);
+    }
+    end_chunk(b, c);
+    std::size_t list = begin_chunk(b, "LIST");
+    b.insert(b.end(), {'f', 'r', 'a', 'm'});
+    for (const char *frame : {frame_a, frame_b}) {
+        c = begin_chunk(b, "icon");
+        b.insert(b.end(), frame, frame + std::strlen(frame) + 1);
+        end_chunk(b, c);
+    }
+    end_chunk(b, list);
+    end_chunk(b, riff);
+    return b;
+}
+
+ani::File parse(std::vector<uint8_t> &bytes, bool lazy) {
+    std::FILE *f = fmemopen(bytes.data(), bytes.size(), "rb");
+    ParseOptions opts{};
+    opts.lazy_frames = lazy;
+    ani::File file = ani::File::parse(f, opts);
+    std::fclose(f);
+    return file;
+}
+
+bool same_bytes(ani::FrameView frame, const char *want) {
+    auto bytes = frame.bytes();
+    return bytes.size() == std::strlen(want) + 1 && !std::memcmp(bytes.data(), want, bytes.size());
+}
+
+// Views see the parsed chunks and payloads in place, in file order
+void test_views() {
+    std::vector<uint8_t> bytes = make_file();
+    ani::File file = parse(bytes, false);
+    CHECK(file);
+    std::vector<ChunkType> types;
+    for (ani::ChunkView chunk : file.chunks()) {
+        types.push_back(chunk.type());
+        if (const ChunkAnih *anih = chunk.anih()) {
+            CHECK(anih->cSteps == 3 && anih->jifRate == 6);
+        }
+        if (chunk.type() == ty_seq) {
+            auto idx = chunk.indexes();
+            CHECK(idx.size() == 3 && idx[0] == 0 && idx[1] == 1 && idx[2] == 0);
+            CHECK(chunk.list() == nullptr && chunk.frames().begin() == chunk.frames().end());
+        }
+        if (chunk.type() == ty_rate) {
+            auto jif = chunk.jiffies();
+            CHECK(jif.size() == 3 && jif[2] == 6);
+        }
+    }
+    CHECK((types == std::vector<ChunkType>{ty_anih, ty_seq, ty_rate, ty_list}));
+
+    std::vector<ani::FrameView> frames(file.frames().begin(), file.frames().end());
+    CHECK(frames.size() == 2);
+    CHECK(frames.size() == 2 && same_bytes(frames[0], frame_a) && same_bytes(frames[1], frame_b));
+    CHECK(frames.size() == 2 && frames[0].loaded() && frames[1].offset() > frames[0].offset());
+
+    // Works with std::views like any forward range
+    auto sizes = file.frames() | std::views::transform([](ani::FrameView f) { return f.size(); });
+    std::size_t total = 0;
+    for (std::size_t n : sizes) {
+        total += n;
+    }
+    CHECK(total == sizeof(frame_a) + sizeof(frame_b));
+}
+
+// The visitors walk chunks and frames in the order `walk` does
+void test_visit() {
+    std::vector<uint8_t> bytes = make_file();
+    ani::File file = parse(bytes, false);
+    std::vector<const void *> seen, walked;
+    ani::visit(
+        file,
+        [&](ani::ChunkView c) { seen.push_back(c.get()); },
+        [&](ani::FrameView f) { seen.push_back(f.get()); });
+    WalkContext ctx{};
+    ctx.ani = file.get();
+    ctx.data = &walked;
+    ctx.visit_chunk = [](const Chunk *c, void *data) {
+        static_cast<std::vector<const void *> *>(data)->push_back(c);
+    };
+    ctx.visit_frame = [](const Frame *f, void *data) {
+        static_cast<std::vector<const void *> *>(data)->push_back(f);
+    };
+    walk(&ctx);
+    CHECK(seen == walked && seen.size() == 6);
+
+    unsigned chunks = 0, frames = 0;
+    ani::visit_chunks(file, [&](ani::ChunkView) { ++chunks; });
+    ani::visit_frames(file, [&](ani::FrameView) { ++frames; });
+    CHECK(chunks == 4 && frames == 2);
+}
+
+// Lazy frames have no payload to view, a moved from or failed File is empty
+void test_ownership() {
+    std::vector<uint8_t> bytes = make_file();
+    ani::File lazy = parse(bytes, true);
+    CHECK(lazy);
+    for (ani::FrameView frame : lazy.frames()) {
+        CHECK(!frame.loaded() && frame.bytes().empty() && frame.size() > 0);
+    }
+    ani::File moved = std::move(lazy);
+    CHECK(moved && !lazy);
+    CHECK(lazy.chunks().begin() == lazy.chunks().end());
+    CHECK(lazy.frames().begin() == lazy.frames().end());
+
+    std::vector<uint8_t> junk(64, 'x');
+    ani::File failed = parse(junk, false);
+    CHECK(!failed && failed.frames().begin() == failed.frames().end());
+
+    AniFile *raw = moved.release();
+    CHECK(raw && !moved);
+    ani::File owner(raw);
+    CHECK(owner.get() == raw);
+}
+
+}  // namespace
+
+int main() {
+    test_views();
+    test_visit();
+    test_ownership();
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+    }
+    return failures ? 1 : 0;
+}
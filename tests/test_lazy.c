@@ -0,0 +1,43 @@
+#include "test.h"
+
+// Lazy frames point at their payload in the source instead of holding a copy, eager frames hold
+// the same bytes. The hotspot is read from the first frame either way
+static void test_offsets(int lazy) {
+    uint8_t cursor[22] = {0, 0, 2, 0, 1, 0, 32, 32, 0, 0, 7, 0, 9, 0};
+    const char other[] = "second frame";
+    const void *frames[] = {cursor, other};
+    size_t sizes[] = {sizeof(cursor), sizeof(other)};
+    Buf in = make_ani(frames, sizes, 2, NULL, NULL, 2, 1);
+    FILE *f = buf_file(&in);
+    ParseOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.lazy_frames = lazy;
+    AniFile *ani = parse_ani_ex(f, &opts);
+    fclose(f);
+    CHECK(ani != NULL);
+    if (!ani) {
+        buf_free(&in);
+        return;
+    }
+    const ChunkList *list = find_chunk(ani, ty_list)->inner;
+    CHECK(list->count == 2 && list->hotx == 7 && list->hoty == 9);
+    for (unsigned i = 0; i < list->count && i < 2; ++i) {
+        const Frame *frame = list->frames[i];
+        CHECK(frame->size == sizes[i]);
+        CHECK(frame->off > 0 && frame->off + frame->size <= in.size);
+        CHECK(!memcmp(in.data + frame->off, frames[i], sizes[i]));
+        if (lazy) {
+            CHECK(frame->buffer == NULL);
+        } else {
+            CHECK(frame->buffer && !memcmp(frame->buffer, frames[i], sizes[i]));
+        }
+    }
+    cleanup_ani(ani);
+    buf_free(&in);
+}
+
+int main(void) {
+    test_offsets(1);
+    test_offsets(0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+#include "optimize.h"
+
+static AniFile *parse_buf(const Buf *b) {
+    FILE *f = buf_file(b);
+    AniFile *ani = parse_ani(f);
+    fclose(f);
+    return ani;
+}
+
+// Duplicated frames are collapsed behind seq, a uniform rate is folded into jifRate
+static void test_collapse(void) {
+    const char a[] = "frame-a", b[] = "frame-bb";
+    const void *frames[] = {a, b, a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b), sizeof(a), sizeof(b)};
+    uint32_t rate[] = {5, 5, 5, 5};
+    Buf in = make_ani(frames, sizes, 4, NULL, rate, 4, 10);
+    AniFile *ani = parse_buf(&in);
+    CHECK(ani != NULL);
+    CHECK(optimize_ani(ani) == 0);
+
+    const ChunkAnih *anih = find_chunk(ani, ty_anih)->inner;
+    const ChunkList *list = find_chunk(ani, ty_list)->inner;
+    const Chunk *seq_chunk = find_chunk(ani, ty_seq);
+    CHECK(find_chunk(ani, ty_rate) == NULL);
+    CHECK(anih->jifRate == 5);
+    CHECK(anih->cFrames == 2 && anih->cSteps == 4);
+    CHECK((anih->flags & AF_SEQUENCE) != 0);
+    CHECK(list->count == 2);
+    CHECK(list->frames[0]->size == sizeof(a) && !memcmp(list->frames[0]->buffer, a, sizeof(a)));
+    CHECK(list->frames[1]->size == sizeof(b) && !memcmp(list->frames[1]->buffer, b, sizeof(b)));
+    CHECK(seq_chunk != NULL);
+    if (seq_chunk) {
+        const ChunkSeq *seq = seq_chunk->inner;
+        CHECK(seq->count == 4);
+        for (unsigned i = 0; i < seq->count && i < 4; ++i) {
+            CHECK(seq->indexes[i] == i % 2);
+        }
+    }
+
+    // Written form is smaller and reads back the same
+    FILE *out = tmpfile();
+    CHECK(write_ani(ani, out) == 0);
+    Buf packed = file_buf(out);
+    fclose(out);
+    CHECK(packed.size < in.size);
+    AniFile *again = parse_buf(&packed);
+    CHECK(again != NULL);
+    if (again) {
+        CHECK(((const ChunkList *)find_chunk(again, ty_list)->inner)->count == 2);
+        CHECK(((const ChunkAnih *)find_chunk(again, ty_anih)->inner)->jifRate == 5);
+        CHECK(find_chunk(again, ty_seq) != NULL);
+    }
+    cleanup_ani(again);
+    cleanup_ani(ani);
+    buf_free(&packed);
+    buf_free(&in);
+}
+
+// A seq that is the identity once frames are unique is dropped
+static void test_identity_seq(void) {
+    const char a[] = "frame-a", b[] = "frame-b";
+    const void *frames[] = {a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b)};
+    unsigned seq[] = {0, 1};
+    Buf in = make_ani(frames, sizes, 2, seq, NULL, 2, 7);
+    AniFile *ani = parse_buf(&in);
+    CHECK(ani != NULL);
+    CHECK(optimize_ani(ani) == 0);
+    CHECK(find_chunk(ani, ty_seq) == NULL);
+    const ChunkAnih *anih = find_chunk(ani, ty_anih)->inner;
+    CHECK((anih->flags & AF_SEQUENCE) == 0);
+    CHECK(anih->jifRate == 7);
+    cleanup_ani(ani);
+    buf_free(&in);
+}
+
+// A model that cannot be optimized is left untouched
+static void test_untouched(void) {
+    const char a[] = "frame-a";
+    const void *frames[] = {a, a};
+    size_t sizes[] = {sizeof(a), sizeof(a)};
+    unsigned seq[] = {0, 5};
+    Buf in = make_ani(frames, sizes, 2, seq, NULL, 2, 7);
+    AniFile *ani = parse_buf(&in);
+    CHECK(ani != NULL);
+    unsigned chunk_count = ani->chunk_count;
+    CHECK(optimize_ani(ani) != 0);
+    CHECK(ani->chunk_count == chunk_count);
+    CHECK(((const ChunkList *)find_chunk(ani, ty_list)->inner)->count == 2);
+    cleanup_ani(ani);
+    buf_free(&in);
+}
+
+int main(void) {
+    test_collapse();
+    test_identity_seq();
+    test_untouched();
+    return TEST_RESULT();
+}
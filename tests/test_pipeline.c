@@ -0,0 +1,73 @@
+#include "test.h"
+#include "pipeline.h"
+
+#define FILES 12
+
+// Files come out in task order with the output a lone `process_file` gives, whatever the memory
+// limit lets overlap. A missing file fails the batch without stopping it
+static void test_order(const char *dir, size_t mem_limit) {
+    char paths[FILES + 1][PATH_MAX];
+    const char *tasks[FILES + 1];
+    StringBuilder *want = sb_new();
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = Describe;
+    ctx.out_format = Json;
+    ctx.jobs = 3;
+    ctx.mem_limit = mem_limit;
+    for (unsigned i = 0; i < FILES; ++i) {
+        char frame[64];
+        memset(frame, 'a' + i, sizeof(frame));
+        const void *frames[] = {frame, frame, frame};
+        size_t sizes[] = {sizeof(frame), i + 1, 7};
+        Buf in = make_ani(frames, sizes, 1 + i % 3, NULL, NULL, 1 + i % 3, 1 + i);
+        snprintf(paths[i], PATH_MAX, "%s/f%02u.ani", dir, i);
+        FILE *f = fopen(paths[i], "wb");
+        CHECK(f != NULL);
+        if (f) {
+            fwrite(in.data, 1, in.size, f);
+            fclose(f);
+        }
+        f = buf_file(&in);
+        CHECK(process_file(&ctx, f, paths[i], want) == 0);
+        fclose(f);
+        buf_free(&in);
+        tasks[i] = paths[i];
+    }
+    ctx.tasks = tasks;
+    ctx.task_num = FILES;
+    Capture c;
+    capture_begin(&c);
+    int res = run_pipeline(&ctx);
+    Buf got = capture_end(&c);
+    CHECK(res == 0);
+    CHECK(got.size == want->size && !memcmp(got.data, want->data, got.size));
+    buf_free(&got);
+
+    snprintf(paths[FILES], PATH_MAX, "%s/missing.ani", dir);
+    tasks[FILES] = tasks[0];
+    tasks[0] = paths[FILES];
+    ctx.task_num = FILES + 1;
+    capture_begin(&c);
+    res = run_pipeline(&ctx);
+    got = capture_end(&c);
+    CHECK(res != 0);
+    CHECK(got.size == want->size);
+    buf_free(&got);
+    for (unsigned i = 0; i < FILES; ++i) {
+        unlink(paths[i]);
+    }
+    sb_cleanup(want);
+}
+
+int main(void) {
+    char dir[] = "/tmp/ani-pipeline-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_order(dir, 1);
+    test_order(dir, 1 << 20);
+    rmdir(dir);
+    return TEST_RESULT();
+}
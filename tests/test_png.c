@@ -0,0 +1,118 @@
+#include "test.h"
+#include "png.h"
+
+// Generated with zlib: a stored block, fixed Huffman codes, dynamic Huffman codes, and dynamic
+// codes over Adam7 passes. Rows cycle through the five filter types except in the stored one.
+// Pixels are opaque, (x * 37, y * 53, x * y * 7) modulo 256
+static const uint8_t png_stored[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+    0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x04, 0x08, 0x06, 0x00, 0x00, 0x00, 0xad, 0x04, 0x4e,
+    0x43, 0x00, 0x00, 0x00, 0x6f, 0x49, 0x44, 0x41, 0x54, 0x78, 0x01, 0x01, 0x64, 0x00, 0x9b, 0xff,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0x25, 0x00, 0x00, 0xff, 0x4a, 0x00, 0x00, 0xff, 0x6f, 0x00, 0x00,
+    0xff, 0x94, 0x00, 0x00, 0xff, 0xb9, 0x00, 0x00, 0xff, 0x00, 0x00, 0x35, 0x00, 0xff, 0x25, 0x35,
+    0x07, 0xff, 0x4a, 0x35, 0x0e, 0xff, 0x6f, 0x35, 0x15, 0xff, 0x94, 0x35, 0x1c, 0xff, 0xb9, 0x35,
+    0x23, 0xff, 0x00, 0x00, 0x6a, 0x00, 0xff, 0x25, 0x6a, 0x0e, 0xff, 0x4a, 0x6a, 0x1c, 0xff, 0x6f,
+    0x6a, 0x2a, 0xff, 0x94, 0x6a, 0x38, 0xff, 0xb9, 0x6a, 0x46, 0xff, 0x00, 0x00, 0x9f, 0x00, 0xff,
+    0x25, 0x9f, 0x15, 0xff, 0x4a, 0x9f, 0x2a, 0xff, 0x6f, 0x9f, 0x3f, 0xff, 0x94, 0x9f, 0x54, 0xff,
+    0xb9, 0x9f, 0x69, 0xff, 0x36, 0x8f, 0x2a, 0x7f, 0x1d, 0x34, 0x19, 0xfe, 0x00, 0x00, 0x00, 0x00,
+    0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82,
+};
+
+static const uint8_t png_fixed[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+    0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x04, 0x08, 0x06, 0x00, 0x00, 0x00, 0xad, 0x04, 0x4e,
+    0x43, 0x00, 0x00, 0x00, 0x48, 0x49, 0x44, 0x41, 0x54, 0x78, 0x01, 0x63, 0x60, 0x60, 0x60, 0xf8,
+    0xaf, 0x0a, 0xc4, 0x5e, 0x40, 0x9c, 0x0f, 0xc4, 0x53, 0x80, 0x78, 0x27, 0x10, 0x33, 0x32, 0x98,
+    0x82, 0x24, 0xd8, 0x19, 0xd0, 0x31, 0x13, 0x50, 0x82, 0x81, 0xc1, 0x94, 0x1d, 0x88, 0xf9, 0x80,
+    0x58, 0x14, 0x88, 0x65, 0x80, 0x58, 0x99, 0x81, 0x99, 0x21, 0x8b, 0xa1, 0x41, 0x58, 0x9a, 0x8f,
+    0x41, 0x58, 0x5a, 0x08, 0x88, 0x45, 0x81, 0x58, 0x12, 0x88, 0x65, 0x18, 0x00, 0xa3, 0x8a, 0x0e,
+    0x1d, 0x01, 0x7f, 0xa4, 0x84, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60,
+    0x82,
+};
+
+static const uint8_t png_dynamic[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+    0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x0c, 0x08, 0x06, 0x00, 0x00, 0x00, 0x6b, 0xe7, 0x3d,
+    0x81, 0x00, 0x00, 0x01, 0x3c, 0x49, 0x44, 0x41, 0x54, 0x78, 0xda, 0xad, 0xd0, 0xb1, 0x4b, 0x02,
+    0x61, 0x18, 0xc7, 0xf1, 0x27, 0x2f, 0x8c, 0x77, 0xc8, 0xe1, 0x11, 0xc1, 0x3a, 0x07, 0x41, 0x22,
+    0x51, 0x88, 0x1c, 0x0e, 0x84, 0x22, 0x87, 0xe0, 0x8a, 0x83, 0xdb, 0xda, 0x04, 0x07, 0x37, 0x5b,
+    0x0e, 0x1c, 0x9a, 0x6b, 0x97, 0x16, 0x05, 0xff, 0x01, 0xf7, 0x66, 0xe1, 0xa0, 0xb1, 0x39, 0x69,
+    0x16, 0x5c, 0xdd, 0x9b, 0x9f, 0xbe, 0x17, 0x06, 0x41, 0x04, 0x21, 0x0d, 0x1f, 0x9e, 0x83, 0x17,
+    0x8e, 0x1f, 0x5f, 0x11, 0x11, 0x3b, 0x42, 0x84, 0x04, 0x13, 0xcc, 0xb1, 0x84, 0x87, 0x3a, 0x62,
+    0x0c, 0x31, 0x45, 0x8a, 0x15, 0xf2, 0x68, 0x62, 0x47, 0x82, 0xec, 0x07, 0x7b, 0xb2, 0xad, 0x1c,
+    0x3f, 0x10, 0x09, 0xf6, 0x50, 0x40, 0x09, 0x15, 0xd4, 0xd0, 0x40, 0x0b, 0x6d, 0x74, 0x10, 0x82,
+    0x2d, 0xc1, 0x0d, 0xba, 0xe8, 0x63, 0x20, 0x9e, 0xdc, 0xca, 0x7d, 0xd1, 0x2f, 0x48, 0xd1, 0x57,
+    0x94, 0x70, 0x80, 0x0a, 0xaa, 0x32, 0xf6, 0x6b, 0xdc, 0x63, 0x34, 0x70, 0x82, 0x16, 0x02, 0xb4,
+    0x79, 0x4b, 0xb9, 0xcf, 0xb2, 0xfb, 0xb9, 0x80, 0x29, 0x22, 0x2c, 0x10, 0x16, 0x48, 0xe5, 0x0f,
+    0xba, 0xdf, 0xbe, 0x1d, 0x0d, 0x5c, 0xcd, 0x22, 0x17, 0x5a, 0xe2, 0x06, 0x36, 0x71, 0x23, 0x9b,
+    0xbb, 0x27, 0x5b, 0xba, 0x85, 0x79, 0xee, 0xdd, 0xea, 0xae, 0x6c, 0xb1, 0x3b, 0xb3, 0xa1, 0xeb,
+    0xd9, 0xd4, 0x3d, 0x58, 0xea, 0x66, 0xb6, 0x72, 0x2f, 0x96, 0x77, 0x6b, 0x6b, 0xba, 0x7d, 0x22,
+    0x5e, 0x64, 0x11, 0x1b, 0xb2, 0xad, 0x7f, 0x88, 0x98, 0x64, 0x11, 0xab, 0x04, 0xf9, 0x19, 0x6c,
+    0xbc, 0x09, 0x56, 0xf4, 0xcf, 0xd1, 0xc1, 0x25, 0x42, 0x44, 0xbc, 0xc5, 0xdc, 0xd7, 0xdf, 0x22,
+    0xb2, 0x80, 0x79, 0x22, 0x2c, 0x10, 0x16, 0x08, 0x0b, 0x24, 0xdc, 0xdc, 0x2f, 0xfd, 0xcd, 0x55,
+    0x1a, 0x68, 0x68, 0x91, 0x8e, 0x2c, 0xd1, 0x85, 0x4d, 0xb4, 0x6c, 0x73, 0xed, 0xd9, 0x52, 0x67,
+    0xe6, 0xe9, 0xda, 0xea, 0x7a, 0x6a, 0xb1, 0xde, 0xd9, 0x50, 0x53, 0x9b, 0x6a, 0xce, 0x52, 0xbd,
+    0xb6, 0x95, 0x3e, 0x5a, 0x5e, 0xdf, 0xac, 0xa9, 0x87, 0x44, 0xbc, 0xca, 0x22, 0xc6, 0xb2, 0xad,
+    0x0f, 0xb5, 0xb8, 0x86, 0xf0, 0xda, 0xb6, 0x6c, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e,
+    0x44, 0xae, 0x42, 0x60, 0x82,
+};
+
+static const uint8_t png_adam7[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+    0x00, 0x00, 0x00, 0x0d, 0x00, 0x00, 0x00, 0x0b, 0x08, 0x06, 0x00, 0x00, 0x01, 0xd3, 0xb5, 0x37,
+    0xf7, 0x00, 0x00, 0x01, 0x5b, 0x49, 0x44, 0x41, 0x54, 0x78, 0xda, 0x95, 0xd0, 0x31, 0x4b, 0xc3,
+    0x40, 0x14, 0x07, 0xf0, 0xbf, 0x8d, 0xe0, 0xd6, 0x21, 0xa5, 0xe0, 0x90, 0x41, 0x90, 0x60, 0xe8,
+    0x20, 0x38, 0x3c, 0xc8, 0x20, 0x76, 0x10, 0x3a, 0x04, 0x02, 0x15, 0x32, 0x08, 0x82, 0x82, 0x83,
+    0xc3, 0x2d, 0x09, 0x1d, 0x74, 0x93, 0x7e, 0x80, 0x6e, 0x06, 0x0a, 0x5d, 0x9c, 0x84, 0x7c, 0x81,
+    0x0e, 0x85, 0x0c, 0xce, 0x8e, 0x72, 0x73, 0xe9, 0x6a, 0xc1, 0xcf, 0xf0, 0xfc, 0x5f, 0x1b, 0x44,
+    0xc4, 0xc5, 0xe1, 0xc7, 0x25, 0x77, 0xf7, 0xde, 0xbb, 0xf7, 0x00, 0x40, 0x23, 0xda, 0x41, 0xe5,
+    0x3e, 0x5e, 0x81, 0x92, 0x7f, 0xb5, 0xdb, 0x29, 0xab, 0xd5, 0x76, 0x07, 0x16, 0x5a, 0xda, 0x42,
+    0x23, 0xbb, 0xd2, 0xda, 0x0e, 0x15, 0x09, 0x8f, 0x97, 0x34, 0x72, 0xd7, 0x12, 0x1b, 0x6b, 0x89,
+    0x02, 0x4e, 0x0b, 0x36, 0xe6, 0xf5, 0x8a, 0xf6, 0x19, 0x67, 0xa0, 0x89, 0x09, 0xb4, 0x34, 0xb1,
+    0x2e, 0x4d, 0xa6, 0x91, 0x29, 0x74, 0x64, 0x26, 0x5a, 0x9b, 0x8a, 0xf5, 0xce, 0x78, 0x88, 0x0c,
+    0x7f, 0x61, 0x1a, 0x57, 0xd5, 0xa5, 0x2a, 0x9a, 0x74, 0xab, 0x6d, 0x4a, 0x3b, 0x04, 0x42, 0x56,
+    0xcd, 0x69, 0x41, 0x1e, 0xa5, 0x34, 0x75, 0x2f, 0x09, 0x4d, 0x9b, 0x29, 0x03, 0xfc, 0xd6, 0x82,
+    0x69, 0xf3, 0x31, 0x3d, 0x1a, 0xd0, 0x2d, 0x3d, 0xd2, 0x0c, 0x5e, 0xc7, 0x06, 0xe3, 0x70, 0xde,
+    0x47, 0x38, 0x4f, 0xf1, 0x32, 0xbf, 0xe2, 0xfa, 0x41, 0x0f, 0xd8, 0xdd, 0x44, 0x80, 0x11, 0x60,
+    0x04, 0x1b, 0xfb, 0x16, 0xfa, 0x03, 0xcd, 0xfd, 0x77, 0x5d, 0xf8, 0xd7, 0xea, 0xf9, 0x6b, 0x4d,
+    0xfd, 0x7b, 0x9d, 0xfa, 0x2d, 0x05, 0x04, 0x1a, 0xca, 0x9e, 0x26, 0xd2, 0xd6, 0x5c, 0xba, 0x5a,
+    0x4a, 0xa0, 0x0b, 0x39, 0xd4, 0xa5, 0xf4, 0xd4, 0x93, 0x13, 0x8d, 0x24, 0xd6, 0x54, 0xfa, 0x3a,
+    0x92, 0x81, 0x4e, 0x25, 0xd5, 0x5a, 0x32, 0x0e, 0xe1, 0x99, 0x41, 0xe8, 0xe2, 0x3f, 0xd8, 0x8d,
+    0x1b, 0xad, 0xeb, 0x28, 0x68, 0xba, 0x8a, 0x9b, 0xce, 0xb2, 0xa6, 0xbb, 0xa2, 0xe9, 0x70, 0xb2,
+    0xe9, 0x12, 0xa6, 0x82, 0x87, 0x1c, 0xe3, 0x8e, 0x1c, 0xa0, 0x23, 0x47, 0x74, 0x4c, 0x42, 0xa7,
+    0x74, 0x8e, 0x27, 0x79, 0xe3, 0x7a, 0x41, 0x97, 0x74, 0x43, 0x77, 0xf4, 0xe9, 0xa6, 0xc0, 0x4a,
+    0x70, 0x93, 0x08, 0x9a, 0x69, 0xb0, 0x12, 0xfa, 0x94, 0x35, 0xeb, 0x4f, 0xb3, 0xcd, 0xfa, 0x05,
+    0x41, 0x82, 0x97, 0x76, 0x6a, 0x1b, 0x02, 0xa7, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44,
+    0xae, 0x42, 0x60, 0x82,
+};
+
+static uint32_t expected(uint32_t x, uint32_t y) {
+    return 0xFFu << 24 | (x * 37 % 256) << 16 | (y * 53 % 256) << 8 | (x * y * 7 % 256);
+}
+
+static void check_png(const uint8_t *buf, size_t size, uint32_t width, uint32_t height) {
+    Image img = {0, 0, NULL};
+    CHECK(is_png(buf, size));
+    CHECK(decode_png(buf, size, &img) == 0);
+    CHECK(img.width == width && img.height == height);
+    unsigned wrong = 0;
+    for (uint32_t y = 0; img.pixels && y < img.height; ++y) {
+        for (uint32_t x = 0; x < img.width; ++x) {
+            wrong += img.pixels[y * img.width + x] != expected(x, y);
+        }
+    }
+    CHECK(img.pixels && wrong == 0);
+    cleanup_image(&img);
+
+    // A cut stream fails instead of decoding garbage
+    CHECK(decode_png(buf, size - 20, &img) != 0);
+    cleanup_image(&img);
+}
+
+int main(void) {
+    check_png(png_stored, sizeof(png_stored), 6, 4);
+    check_png(png_fixed, sizeof(png_fixed), 6, 4);
+    check_png(png_dynamic, sizeof(png_dynamic), 16, 12);
+    check_png(png_adam7, sizeof(png_adam7), 13, 11);
+    return TEST_RESULT();
+}
@@ -0,0 +1,119 @@
+#include "test.h"
+
+static AniFile *parse_buf(const Buf *b, char recover) {
+    ParseOptions opts = {0};
+    opts.recover = recover;
+    FILE *f = buf_file(b);
+    AniFile *ani = parse_ani_ex(f, &opts);
+    fclose(f);
+    return ani;
+}
+
+static unsigned frame_count(const AniFile *ani) {
+    const Chunk *c = find_chunk(ani, ty_list);
+    return c ? ((const ChunkList *)c->inner)->count : 0;
+}
+
+// anih, a chunk whose size runs past the file, then a frame list of two icons
+static Buf make_bad_size(void) {
+    Buf b = {0};
+    size_t riff = buf_begin(&b, "RIFF");
+    buf_put(&b, "ACON", 4);
+    size_t c = buf_begin(&b, "anih");
+    for (unsigned i = 0; i < 9; ++i) {
+        buf_u32(&b, i == 0 ? 36 : i < 3 ? 2 : 0);
+    }
+    buf_end(&b, c);
+    buf_put(&b, "junk", 4);
+    buf_u32(&b, 0x7fffffff);
+    buf_put(&b, "garbage!", 8);
+    c = buf_begin(&b, "LIST");
+    buf_put(&b, "fram", 4);
+    for (unsigned i = 0; i < 2; ++i) {
+        size_t icon = buf_begin(&b, "icon");
+        buf_put(&b, "data", 4);
+        buf_end(&b, icon);
+    }
+    buf_end(&b, c);
+    buf_end(&b, riff);
+    return b;
+}
+
+// A bad chunk size fails the parse, unless recovering resyncs past it
+static void test_bad_chunk_size(void) {
+    Buf b = make_bad_size();
+    AniFile *ani = parse_buf(&b, 0);
+    CHECK(ani == NULL);
+    cleanup_ani(ani);
+
+    ani = parse_buf(&b, 1);
+    CHECK(ani != NULL);
+    if (ani) {
+        CHECK(find_chunk(ani, ty_anih) != NULL);
+        CHECK(frame_count(ani) == 2);
+    }
+    cleanup_ani(ani);
+    buf_free(&b);
+}
+
+// A bad icon size inside the list resyncs to the next icon
+static void test_bad_icon_size(void) {
+    Buf b = {0};
+    size_t riff = buf_begin(&b, "RIFF");
+    buf_put(&b, "ACON", 4);
+    size_t list = buf_begin(&b, "LIST");
+    buf_put(&b, "fram", 4);
+    size_t c = buf_begin(&b, "icon");
+    buf_put(&b, "one!", 4);
+    buf_end(&b, c);
+    buf_put(&b, "icon", 4);
+    buf_u32(&b, 0xffff);
+    buf_put(&b, "lost", 4);
+    c = buf_begin(&b, "icon");
+    buf_put(&b, "two!", 4);
+    buf_end(&b, c);
+    buf_end(&b, list);
+    buf_end(&b, riff);
+
+    AniFile *ani = parse_buf(&b, 0);
+    CHECK(ani == NULL);
+    cleanup_ani(ani);
+
+    ani = parse_buf(&b, 1);
+    CHECK(ani != NULL);
+    if (ani) {
+        const ChunkList *l = find_chunk(ani, ty_list)->inner;
+        CHECK(l->count == 2);
+        CHECK(l->count == 2 && !memcmp(l->frames[1]->buffer, "two!", 4));
+    }
+    cleanup_ani(ani);
+    buf_free(&b);
+}
+
+// A truncated file keeps the frames that are complete when recovering
+static void test_truncated(void) {
+    const char a[] = "first frame", b2[] = "second frame";
+    const void *frames[] = {a, b2};
+    size_t sizes[] = {sizeof(a), sizeof(b2)};
+    Buf b = make_ani(frames, sizes, 2, NULL, NULL, 2, 1);
+    b.size -= 6;
+
+    AniFile *ani = parse_buf(&b, 0);
+    CHECK(ani == NULL);
+    cleanup_ani(ani);
+
+    ani = parse_buf(&b, 1);
+    CHECK(ani != NULL);
+    if (ani) {
+        CHECK(frame_count(ani) == 1);
+    }
+    cleanup_ani(ani);
+    buf_free(&b);
+}
+
+int main(void) {
+    test_bad_chunk_size();
+    test_bad_icon_size();
+    test_truncated();
+    return TEST_RESULT();
+}
@@ -0,0 +1,81 @@
+#include "test.h"
+#include "report.h"
+
+#define FILES 4
+
+static void write_file(const char *path, const void *p, size_t n) {
+    FILE *f = fopen(path, "wb");
+    CHECK(f != NULL);
+    if (f) {
+        fwrite(p, 1, n, f);
+        fclose(f);
+    }
+}
+
+static Buf report(const GlobalContext *ctx, int *res) {
+    Capture c;
+    capture_begin(&c);
+    *res = run_report(ctx);
+    return capture_end(&c);
+}
+
+// Counts and distributions over a set, the same whatever the number of workers. A file that
+// does not parse is counted and fails the report
+static void test_report(const char *dir) {
+    char paths[FILES][PATH_MAX];
+    const char *tasks[FILES];
+    const char a[] = "frame-a", b[] = "frame-bb";
+    const void *frames[] = {a, b, a};
+    size_t sizes[] = {sizeof(a), sizeof(b), sizeof(a)};
+    unsigned seq[] = {0, 1, 2, 1};
+    uint32_t rate[] = {3, 4};
+    Buf files[FILES] = {
+        make_ani(frames, sizes, 2, NULL, rate, 2, 5),
+        make_ani(frames, sizes, 3, seq, NULL, 4, 5),
+        make_ani(frames, sizes, 1, NULL, NULL, 1, 10),
+        {0},
+    };
+    buf_put(&files[3], "not an animation", 16);
+    for (unsigned i = 0; i < FILES; ++i) {
+        snprintf(paths[i], PATH_MAX, "%s/f%u.ani", dir, i);
+        write_file(paths[i], files[i].data, files[i].size);
+        buf_free(&files[i]);
+        tasks[i] = paths[i];
+    }
+
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = Report;
+    ctx.out_format = Json;
+    ctx.tasks = tasks;
+    ctx.task_num = FILES;
+    ctx.jobs = 1;
+    int res1, res3;
+    Buf one = report(&ctx, &res1);
+    ctx.jobs = 3;
+    Buf three = report(&ctx, &res3);
+    CHECK(res1 != 0 && res3 != 0);
+    CHECK(one.size == three.size && !memcmp(one.data, three.data, one.size));
+    buf_put(&one, "", 1);
+    const char *text = (const char *)one.data;
+    CHECK(strstr(text, "\"files\": 4, \"failed\": 1, \"no_anih\": 0, ") != NULL);
+    CHECK(strstr(text, "\"has_rate\": 1, \"has_seq\": 1, \"frames_steps_differ\": 1") != NULL);
+    CHECK(strstr(text, "\"frames\": {\"1\": 1, \"2\": 1, \"3\": 1}") != NULL);
+    CHECK(strstr(text, "\"jif_rate\": {\"5\": 2, \"10\": 1}") != NULL);
+    buf_free(&one);
+    buf_free(&three);
+    for (unsigned i = 0; i < FILES; ++i) {
+        unlink(paths[i]);
+    }
+}
+
+int main(void) {
+    char dir[] = "/tmp/ani-report-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_report(dir);
+    rmdir(dir);
+    return TEST_RESULT();
+}
@@ -0,0 +1,92 @@
+#include "test.h"
+#include "scale.h"
+
+static int all_equal(const Image *img, uint32_t p) {
+    for (size_t i = 0; i < (size_t)img->width * img->height; ++i) {
+        if (img->pixels[i] != p) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// A flat image stays flat whatever the filter and direction
+static void test_flat(void) {
+    uint32_t pixels[10 * 7];
+    for (unsigned i = 0; i < 10 * 7; ++i) {
+        pixels[i] = 0x80402010;
+    }
+    Image src = {10, 7, pixels};
+    enum ScaleFilter filters[] = {FilterLanczos, FilterBox};
+    uint32_t dims[][2] = {{23, 15}, {4, 3}, {10, 7}, {1, 1}};
+    for (unsigned f = 0; f < 2; ++f) {
+        for (unsigned d = 0; d < 4; ++d) {
+            Image out;
+            CHECK(scale_image(&src, dims[d][0], dims[d][1], filters[f], &out) == 0);
+            CHECK(out.width == dims[d][0] && out.height == dims[d][1]);
+            CHECK(all_equal(&out, 0x80402010));
+            cleanup_image(&out);
+        }
+    }
+}
+
+// Box halves average 2x2 blocks, and doubles repeat every pixel
+static void test_box(void) {
+    uint32_t pixels[16];
+    for (unsigned y = 0; y < 4; ++y) {
+        for (unsigned x = 0; x < 4; ++x) {
+            uint32_t v = (x / 2 * 2 + y / 2) * 40 + (x % 2) * 2 + (y % 2) * 4;
+            pixels[y * 4 + x] = 0xff000000u | v << 16 | v << 8 | v;
+        }
+    }
+    Image src = {4, 4, pixels}, half, twice;
+    CHECK(scale_image(&src, 2, 2, FilterBox, &half) == 0);
+    for (unsigned y = 0; y < 2 && half.pixels; ++y) {
+        for (unsigned x = 0; x < 2; ++x) {
+            uint32_t v = (x * 2 + y) * 40 + 3;
+            CHECK(half.pixels[y * 2 + x] == (0xff000000u | v << 16 | v << 8 | v));
+        }
+    }
+    CHECK(scale_image(&half, 4, 4, FilterBox, &twice) == 0);
+    for (unsigned i = 0; i < 16 && twice.pixels; ++i) {
+        CHECK(twice.pixels[i] == half.pixels[i / 8 * 2 + i % 4 / 2]);
+    }
+    cleanup_image(&half);
+    cleanup_image(&twice);
+}
+
+// Lanczos rings around a hard edge, colors stay within alpha
+static void test_premultiplied(void) {
+    uint32_t pixels[8 * 8];
+    for (unsigned i = 0; i < 8 * 8; ++i) {
+        pixels[i] = i % 8 < 4 ? 0xffffffff : 0;
+    }
+    Image src = {8, 8, pixels}, out;
+    CHECK(scale_image(&src, 21, 21, FilterLanczos, &out) == 0);
+    for (unsigned i = 0; i < 21 * 21 && out.pixels; ++i) {
+        uint32_t p = out.pixels[i], a = p >> 24;
+        CHECK(((p >> 16) & 0xff) <= a && ((p >> 8) & 0xff) <= a && (p & 0xff) <= a);
+    }
+    cleanup_image(&out);
+
+    Image empty;
+    CHECK(scale_image(&src, 0, 4, FilterBox, &empty) != 0);
+}
+
+// Hotspots map through pixel centers and stay inside the image
+static void test_hotspot(void) {
+    CHECK(scale_hotspot(3, 16, 32) == 7);
+    CHECK(scale_hotspot(0, 16, 32) == 1);
+    CHECK(scale_hotspot(15, 16, 32) == 31);
+    CHECK(scale_hotspot(31, 32, 16) == 15);
+    CHECK(scale_hotspot(5, 16, 16) == 5);
+    CHECK(scale_hotspot(40, 16, 24) == 23);
+}
+
+int main(void) {
+    test_flat();
+    test_box();
+    test_premultiplied();
+    test_hotspot();
+    return TEST_RESULT();
+}
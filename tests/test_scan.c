@@ -0,0 +1,100 @@
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "task.h"
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+typedef struct {
+    unsigned count;
+    char paths[8][PATH_MAX];
+} Seen;
+
+typedef struct {
+    Seen files;
+    Seen dirs;
+} Scan;
+
+static void push_seen(Seen *s, const char *path) {
+    if (s->count < 8) {
+        snprintf(s->paths[s->count++], PATH_MAX, "%s", path);
+    }
+}
+
+static void on_file(const char *path, void *data) {
+    push_seen(&((Scan *)data)->files, path);
+}
+
+static void on_dir(const char *path, void *data) {
+    push_seen(&((Scan *)data)->dirs, path);
+}
+
+// Paths relative to `root`, sorted as readdir order is arbitrary
+static int matches(Seen *s, const char *root, const char *const *want, unsigned count) {
+    qsort(s->paths, s->count, PATH_MAX, cmp_path);
+    size_t len = strlen(root);
+    int ok = s->count == count;
+    for (unsigned i = 0; ok && i < count; ++i) {
+        ok = !strncmp(s->paths[i], root, len) && !strcmp(s->paths[i] + len, want[i]);
+    }
+    return ok;
+}
+
+static int touch(const char *root, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    FILE *f = fopen(path, "wb");
+    return f ? fclose(f) : 1;
+}
+
+static void build_tree(const char *root) {
+    char path[PATH_MAX], target[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/sub", root);
+    CHECK(mkdir(path, 0700) == 0);
+    CHECK(touch(root, "a.ani") == 0);
+    CHECK(touch(root, "b.ANI") == 0);
+    CHECK(touch(root, "notes.txt") == 0);
+    CHECK(touch(root, "sub/c.ani") == 0);
+    // A linked file is followed, a link back up the tree is not
+    snprintf(path, sizeof(path), "%s/link.ani", root);
+    snprintf(target, sizeof(target), "%s/a.ani", root);
+    CHECK(symlink(target, path) == 0);
+    snprintf(path, sizeof(path), "%s/sub/loop", root);
+    CHECK(symlink(root, path) == 0);
+}
+
+// Only `*.ani` files are reported, in any case, and the link back to the root is not entered
+static void test_scan(const char *root) {
+    Scan scan = {0};
+    CHECK(scan_dir(root, on_file, on_dir, &scan) == 0);
+    const char *files[] = {"/a.ani", "/b.ANI", "/link.ani", "/sub/c.ani"};
+    const char *dirs[] = {"", "/sub"};
+    CHECK(matches(&scan.files, root, files, 4));
+    CHECK(matches(&scan.dirs, root, dirs, 2));
+
+    char missing[PATH_MAX];
+    snprintf(missing, sizeof(missing), "%s/missing", root);
+    CHECK(scan_dir(missing, on_file, NULL, &scan) != 0);
+    CHECK(is_ani_path("x.ani") && is_ani_path("dir/X.Ani"));
+    CHECK(!is_ani_path(".ani") && !is_ani_path("x.ani.txt"));
+}
+
+int main(void) {
+    char root[] = "/tmp/ani-scan-XXXXXX";
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    build_tree(root);
+    test_scan(root);
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "Cannot remove `%s`\n", root);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,91 @@
+#include <unistd.h>
+
+#include "test.h"
+#include "ico.h"
+#include "task.h"
+
+// The exact size wins, then the closest larger one, then the closest smaller one
+static void test_select(void) {
+    uint32_t sizes[] = {32, 16, 48};
+    Buf ico = make_ico(sizes, 3, 1, 2, 0);
+    IcoDir dir;
+    CHECK(parse_ico_dir(ico.data, ico.size, &dir) == 0);
+    CHECK(dir.type == 2 && dir.count == 3);
+    CHECK(dir.entries[0].planes == 1 && dir.entries[0].bit_count == 2);
+    CHECK(select_ico_entry(&dir, 16) == 1);
+    CHECK(select_ico_entry(&dir, 20) == 0);
+    CHECK(select_ico_entry(&dir, 40) == 2);
+    CHECK(select_ico_entry(&dir, 64) == 2);
+    CHECK(select_ico_entry(&dir, 0) == 2);
+
+    uint8_t head[ICO_HEADER_SIZE + ICO_ENTRY_SIZE];
+    build_single_ico_header(&dir, 1, head);
+    CHECK(head[2] == 2 && head[4] == 1 && head[5] == 0);
+    CHECK(!memcmp(head + ICO_HEADER_SIZE, dir.entries[1].raw, 12));
+    CHECK(head[18] == sizeof(head) && head[19] == 0 && head[20] == 0 && head[21] == 0);
+    cleanup_ico_dir(&dir);
+
+    CHECK(parse_ico_dir(ico.data, 20, &dir) != 0);
+    buf_free(&ico);
+}
+
+// `-size` extracts frames holding only the chosen entry
+static void test_extract(const char *dir) {
+    uint32_t sizes[] = {16, 32};
+    Buf icos[2] = {make_ico(sizes, 2, 0, 0, 1), make_ico(sizes, 2, 0, 0, 2)};
+    const void *frames[] = {icos[0].data, icos[1].data};
+    size_t frame_sizes[] = {icos[0].size, icos[1].size};
+    Buf in = make_ani(frames, frame_sizes, 2, NULL, NULL, 2, 1);
+
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = Extract;
+    ctx.out_format = Silent;
+    ctx.select_size = 32;
+    strcpy((char *)ctx.prefix, dir);
+    StringBuilder *out = sb_new();
+    FILE *f = buf_file(&in);
+    CHECK(process_file(&ctx, f, "x.ani", out) == 0);
+    fclose(f);
+    sb_cleanup(out);
+
+    for (unsigned i = 0; i < 2; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/x.ani/frame-%03u.ico", dir, i);
+        FILE *frame = fopen(path, "rb");
+        CHECK(frame != NULL);
+        if (!frame) {
+            continue;
+        }
+        Buf got = file_buf(frame);
+        fclose(frame);
+        unlink(path);
+        IcoDir src;
+        CHECK(parse_ico_dir(icos[i].data, icos[i].size, &src) == 0);
+        const IcoEntry *e = &src.entries[1];
+        size_t head = ICO_HEADER_SIZE + ICO_ENTRY_SIZE;
+        CHECK(got.size == head + e->size && got.data[4] == 1 && got.data[6] == 32);
+        CHECK(got.size == head + e->size &&
+              !memcmp(got.data + head, icos[i].data + e->offset, e->size));
+        cleanup_ico_dir(&src);
+        buf_free(&got);
+    }
+    char sub[PATH_MAX];
+    snprintf(sub, sizeof(sub), "%s/x.ani", dir);
+    rmdir(sub);
+    buf_free(&icos[0]);
+    buf_free(&icos[1]);
+    buf_free(&in);
+}
+
+int main(void) {
+    test_select();
+    char dir[] = "/tmp/ani-select-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_extract(dir);
+    rmdir(dir);
+    return TEST_RESULT();
+}
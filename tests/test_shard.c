@@ -0,0 +1,119 @@
+#include "test.h"
+#include "shard.h"
+
+static const char *paths[] = {
+    "a.ani", "dir/b.ani", "dir/c.ani", "d.ani", "e/f/g.ani", "h.ani", "i.ani", "j.ani",
+};
+#define PATH_COUNT (sizeof(paths) / sizeof(paths[0]))
+
+// Tasks of one shard, `prefix` is put in front of every path
+static unsigned run_shard(unsigned index, unsigned count, const char *prefix, char kept[]) {
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.shard_index = index;
+    ctx.shard_count = count;
+    ctx.task_num = PATH_COUNT;
+    ctx.tasks = malloc(PATH_COUNT * sizeof(char *));
+    for (unsigned i = 0; i < PATH_COUNT; ++i) {
+        char *path = malloc(strlen(prefix) + strlen(paths[i]) + 1);
+        sprintf(path, "%s%s", prefix, paths[i]);
+        ctx.tasks[i] = path;
+    }
+    CHECK(shard_tasks(&ctx) == 0);
+    for (unsigned i = 0; i < ctx.task_num; ++i) {
+        const char *path = ctx.tasks[i] + strlen(prefix);
+        for (unsigned k = 0; k < PATH_COUNT; ++k) {
+            kept[k] += !strcmp(path, paths[k]);
+        }
+        free((char *)ctx.tasks[i]);
+    }
+    free(ctx.tasks);
+    return ctx.task_num;
+}
+
+// Every path lands in exactly one shard, a leading `./` does not move it
+static void test_split(void) {
+    for (unsigned count = 1; count <= 4; ++count) {
+        char kept[PATH_COUNT] = {0}, dot_kept[PATH_COUNT] = {0};
+        unsigned total = 0;
+        for (unsigned index = 0; index < count; ++index) {
+            char once[PATH_COUNT] = {0}, dot[PATH_COUNT] = {0};
+            total += run_shard(index, count, "", once);
+            run_shard(index, count, "./", dot);
+            CHECK(!memcmp(once, dot, PATH_COUNT));
+            for (unsigned k = 0; k < PATH_COUNT; ++k) {
+                kept[k] += once[k];
+                dot_kept[k] += dot[k];
+            }
+        }
+        CHECK(total == PATH_COUNT);
+        for (unsigned k = 0; k < PATH_COUNT; ++k) {
+            CHECK(kept[k] == 1 && dot_kept[k] == 1);
+        }
+    }
+}
+
+static void write_text(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+// Output of `merge_outputs` over `inputs`, its status in `res`
+static Buf merge(const char **inputs, unsigned count, int *res) {
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.task_num = count;
+    ctx.tasks = inputs;
+    Capture c;
+    capture_begin(&c);
+    *res = merge_outputs(&ctx);
+    return capture_end(&c);
+}
+
+// Shard outputs merge to the same stream whatever their order, duplicates once, plain text is
+// rejected
+static void test_merge(const char *dir) {
+    char a[PATH_MAX], b[PATH_MAX], plain[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a.ndjson", dir);
+    snprintf(b, sizeof(b), "%s/b.ndjson", dir);
+    snprintf(plain, sizeof(plain), "%s/plain.txt", dir);
+    write_text(a, "{\"name\": \"z.ani\",\"x\": 1}\n{\"name\": \"a\\\"q.ani\",\"x\": 2}\n");
+    write_text(b, "{\"name\": \"m.ani\",\"x\": 3}\n\n{\"name\": \"z.ani\",\"x\": 1}\n");
+    write_text(plain, "z.ani\n  frames: 2\n");
+
+    const char *ab[] = {a, b}, *ba[] = {b, a};
+    int res1, res2, res3;
+    Buf out1 = merge(ab, 2, &res1), out2 = merge(ba, 2, &res2);
+    const char want[] =
+        "{\"name\": \"a\\\"q.ani\",\"x\": 2}\n{\"name\": \"m.ani\",\"x\": 3}\n"
+        "{\"name\": \"z.ani\",\"x\": 1}\n";
+    CHECK(res1 == 0 && res2 == 0);
+    CHECK(out1.size == strlen(want) && !memcmp(out1.data, want, out1.size));
+    CHECK(out2.size == out1.size && !memcmp(out1.data, out2.data, out1.size));
+
+    const char *with_plain[] = {a, plain};
+    Buf out3 = merge(with_plain, 2, &res3);
+    CHECK(res3 != 0);
+    buf_free(&out1);
+    buf_free(&out2);
+    buf_free(&out3);
+    unlink(a);
+    unlink(b);
+    unlink(plain);
+}
+
+int main(void) {
+    char dir[] = "/tmp/ani-shard-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_split();
+    test_merge(dir);
+    rmdir(dir);
+    return TEST_RESULT();
+}
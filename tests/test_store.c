@@ -0,0 +1,115 @@
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "store.h"
+#include "task.h"
+
+static unsigned count_files(const char *dir) {
+    DIR *d = opendir(dir);
+    unsigned n = 0;
+    for (struct dirent *e; d && (e = readdir(d));) {
+        n += e->d_name[0] != '.';
+    }
+    if (d) {
+        closedir(d);
+    }
+    return n;
+}
+
+static Buf read_path(const char *path) {
+    Buf b = {0};
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        b = file_buf(f);
+        fclose(f);
+    }
+    return b;
+}
+
+// Equal frames are stored once, different frames get their own object
+static void test_dedupe(const char *store) {
+    const char a[] = "frame a", b[] = "frame b";
+    char hex1[STORE_HASH_HEX], hex2[STORE_HASH_HEX], hex3[STORE_HASH_HEX];
+    CHECK(store_put(store, a, sizeof(a), hex1) == 0);
+    CHECK(store_put(store, a, sizeof(a), hex2) == 0);
+    CHECK(store_put(store, b, sizeof(b), hex3) == 0);
+    CHECK(!strcmp(hex1, hex2));
+    CHECK(strcmp(hex1, hex3) != 0);
+
+    char path[PATH_MAX];
+    CHECK(store_object_path(store, hex1, path) == 0);
+    Buf stored = read_path(path);
+    CHECK(stored.size == sizeof(a) && !memcmp(stored.data, a, sizeof(a)));
+    buf_free(&stored);
+    struct stat st;
+    CHECK(stat(path, &st) == 0 && (st.st_mode & 0777) == 0444);
+
+    // No temporary file is left next to the object
+    char *slash = strrchr(path, '/');
+    *slash = '\0';
+    CHECK(count_files(path) == (hex1[0] == hex3[0] && hex1[1] == hex3[1] ? 2 : 1));
+}
+
+// An object of the same hash and another size is a collision, and is left alone
+static void test_collision(const char *store) {
+    const char a[] = "colliding frame";
+    uint64_t hash[2];
+    char hex[STORE_HASH_HEX], path[PATH_MAX];
+    hash128(a, sizeof(a), hash);
+    hash128_hex(hash, hex);
+    CHECK(store_object_path(store, hex, path) == 0);
+    CHECK(create_parent_dir(path) == 0);
+    FILE *f = fopen(path, "wb");
+    CHECK(f != NULL);
+    if (f) {
+        fputs("other", f);
+        fclose(f);
+    }
+    char got[STORE_HASH_HEX];
+    CHECK(store_put(store, a, sizeof(a), got) != 0);
+    Buf kept = read_path(path);
+    CHECK(kept.size == 5 && !memcmp(kept.data, "other", 5));
+    buf_free(&kept);
+}
+
+// Manifests are keyed by the path without leading `./`, and replaced whole
+static void test_manifest(const char *store) {
+    char p1[PATH_MAX], p2[PATH_MAX], p3[PATH_MAX];
+    CHECK(store_manifest_path(store, "dir/x.ani", p1) == 0);
+    CHECK(store_manifest_path(store, "./dir/x.ani", p2) == 0);
+    CHECK(store_manifest_path(store, "other/x.ani", p3) == 0);
+    CHECK(!strcmp(p1, p2));
+    CHECK(strcmp(p1, p3) != 0);
+
+    const char first[] = "{\"name\": \"x.ani\", \"frames\": [1, 2, 3]}\n";
+    const char second[] = "{\"name\": \"x.ani\"}\n";
+    CHECK(store_put_manifest(store, "dir/x.ani", first, strlen(first)) == 0);
+    CHECK(store_put_manifest(store, "./dir/x.ani", second, strlen(second)) == 0);
+    Buf m = read_path(p1);
+    CHECK(m.size == strlen(second) && !memcmp(m.data, second, m.size));
+    buf_free(&m);
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/manifests", store);
+    CHECK(count_files(dir) == 1);
+}
+
+int main(void) {
+    char store[] = "/tmp/ani-store-XXXXXX";
+    if (!mkdtemp(store)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_dedupe(store);
+    test_collision(store);
+    test_manifest(store);
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", store);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "Cannot remove `%s`\n", store);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,201 @@
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "tar.h"
+#include "task.h"
+
+// One header block, `prefix` is put in the ustar prefix field when given
+static void tar_header(Buf *b, const char *name, const char *prefix, char type, size_t size) {
+    uint8_t h[512] = {0};
+    memcpy(h, name, strnlen(name, 100));
+    memcpy(h + 100, "0000644", 7);
+    snprintf((char *)h + 124, 12, "%011o", (unsigned)size);
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    if (prefix) {
+        memcpy(h + 345, prefix, strlen(prefix));
+    }
+    unsigned sum = 0;
+    for (unsigned i = 0; i < 512; ++i) {
+        sum += i >= 148 && i < 156 ? ' ' : h[i];
+    }
+    snprintf((char *)h + 148, 8, "%06o", sum);
+    buf_put(b, h, 512);
+}
+
+// Data of a member padded to whole blocks
+static void tar_data(Buf *b, const void *p, size_t n) {
+    static const uint8_t zero[512];
+    buf_put(b, p, n);
+    buf_put(b, zero, (512 - n % 512) % 512);
+}
+
+static void tar_member(Buf *b, const char *name, const char *text) {
+    tar_header(b, name, NULL, '0', strlen(text));
+    tar_data(b, text, strlen(text));
+}
+
+static void write_buf(const char *path, const Buf *b) {
+    FILE *f = fopen(path, "wb");
+    CHECK(f != NULL);
+    if (f) {
+        fwrite(b->data, 1, b->size, f);
+        fclose(f);
+    }
+}
+
+static int member_is(TarArchive *tar, const char *name, const char *text) {
+    const TarMember *m = tar_find(tar, name);
+    return m && m->size == strlen(text) && !memcmp(tar->base + m->off, text, m->size);
+}
+
+// Long names of every format are found, and a name appended again replaces the earlier member
+static void test_index(const char *path) {
+    char long_name[201];
+    memset(long_name, 'n', 196);
+    memcpy(long_name + 196, ".ani", 5);
+    char pax_name[161];
+    memset(pax_name, 'p', 156);
+    memcpy(pax_name + 156, ".ani", 5);
+    char pax[256];
+    int pax_len = snprintf(pax, sizeof(pax), "%d path=%s\n", 3 + 1 + 5 + 161, pax_name);
+
+    Buf b = {0};
+    tar_member(&b, "a.ani", "first");
+    tar_header(&b, "b.ani", "some/deep/dir", '0', 6);
+    tar_data(&b, "ustar!", 6);
+    tar_header(&b, "././@LongLink", NULL, 'L', sizeof(long_name));
+    tar_data(&b, long_name, sizeof(long_name));
+    tar_header(&b, "truncated", NULL, '0', 3);
+    tar_data(&b, "gnu", 3);
+    tar_header(&b, "PaxHeader", NULL, 'x', pax_len);
+    tar_data(&b, pax, pax_len);
+    tar_header(&b, "short", NULL, '0', 3);
+    tar_data(&b, "pax", 3);
+    tar_header(&b, "dir/", NULL, '5', 0);
+    tar_member(&b, "./a.ani", "second");
+    static const uint8_t end[1024];
+    buf_put(&b, end, sizeof(end));
+    write_buf(path, &b);
+    buf_free(&b);
+
+    TarArchive *tar = tar_open(path);
+    CHECK(tar != NULL);
+    if (!tar) {
+        return;
+    }
+    CHECK(tar->count == 4);
+    CHECK(member_is(tar, "a.ani", "second"));
+    CHECK(member_is(tar, "./a.ani", "second"));
+    CHECK(member_is(tar, "some/deep/dir/b.ani", "ustar!"));
+    CHECK(member_is(tar, long_name, "gnu"));
+    CHECK(member_is(tar, pax_name, "pax"));
+    CHECK(tar_find(tar, "truncated") == NULL && tar_find(tar, "short") == NULL);
+    CHECK(tar_find(tar, "dir/") == NULL);
+    // Survivors stay in archive order
+    CHECK(!strcmp(tar->members[0].name, "some/deep/dir/b.ani"));
+    CHECK(!strcmp(tar->members[3].name, "./a.ani"));
+    tar_close(tar);
+}
+
+// Paths split only where an archive exists, a file of such a name is read as it is
+static void test_split(const char *dir) {
+    char archive[PATH_MAX], path[PATH_MAX], nested[PATH_MAX], plain[PATH_MAX];
+    snprintf(archive, sizeof(archive), "%s/x.tar", dir);
+    snprintf(nested, sizeof(nested), "%s/d.tar:e", dir);
+    snprintf(plain, sizeof(plain), "%s/y.tar:z.ani", dir);
+    Buf empty = {0};
+    buf_put(&empty, "", 1);
+    write_buf(archive, &empty);
+    write_buf(plain, &empty);
+    CHECK(mkdir(nested, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/f.tar", nested);
+    write_buf(path, &empty);
+    buf_free(&empty);
+
+    char got[PATH_MAX];
+    const char *member;
+    snprintf(path, sizeof(path), "%s:m.ani", archive);
+    CHECK(split_tar_path(path, got, &member) == 1);
+    CHECK(!strcmp(got, archive) && !strcmp(member, "m.ani"));
+    snprintf(path, sizeof(path), "%s/f.tar:in/m.tar:x.ani", nested);
+    CHECK(split_tar_path(path, got, &member) == 1);
+    CHECK(!strcmp(member, "in/m.tar:x.ani"));
+    CHECK(!strncmp(got, nested, strlen(nested)) && !strcmp(got + strlen(nested), "/f.tar"));
+    CHECK(split_tar_path(plain, got, &member) == 0);
+    snprintf(path, sizeof(path), "%s/none.tar:m.ani", dir);
+    CHECK(split_tar_path(path, got, &member) == 0);
+
+    snprintf(path, sizeof(path), "%s/f.tar", nested);
+    unlink(path);
+    rmdir(nested);
+    unlink(archive);
+    unlink(plain);
+}
+
+// Tasks are read from the archive they name, the longest archive path matches
+static void test_open_task(const char *dir) {
+    char outer[PATH_MAX], inner_dir[PATH_MAX], inner[PATH_MAX], task[PATH_MAX];
+    snprintf(outer, sizeof(outer), "%s/o.tar", dir);
+    snprintf(inner_dir, sizeof(inner_dir), "%s/o.tar:sub", dir);
+    snprintf(inner, sizeof(inner), "%s/i.tar", inner_dir);
+    CHECK(mkdir(inner_dir, 0755) == 0);
+    Buf b = {0};
+    tar_member(&b, "sub/i.tar:k.ani", "outer");
+    tar_member(&b, "k.ani", "inner");
+    static const uint8_t end[1024];
+    buf_put(&b, end, sizeof(end));
+    write_buf(outer, &b);
+    write_buf(inner, &b);
+    buf_free(&b);
+
+    GlobalContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    TarArchive *archives[2] = {tar_open(outer), tar_open(inner)};
+    CHECK(archives[0] != NULL && archives[1] != NULL);
+    ctx.archives = archives;
+    ctx.archive_count = 2;
+    size_t size;
+    char text[16] = {0};
+    snprintf(task, sizeof(task), "%s:k.ani", inner);
+    FILE *f = open_task(&ctx, task, &size);
+    CHECK(f != NULL && size == 5);
+    if (f) {
+        CHECK(fread(text, 1, sizeof(text), f) == 5 && !strcmp(text, "inner"));
+        fclose(f);
+    }
+    snprintf(task, sizeof(task), "%s:missing.ani", inner);
+    CHECK(open_task(&ctx, task, &size) == NULL);
+    tar_close(archives[0]);
+    tar_close(archives[1]);
+    unlink(inner);
+    rmdir(inner_dir);
+    unlink(outer);
+}
+
+// Archive members are named after the member, whatever dirs lead to the archive
+static void test_basename(void) {
+    CHECK(!strcmp(path_basename("dir/a.tar:sub/x.ani"), "x.ani"));
+    CHECK(!strcmp(path_basename("d.tar:e/f.tar:m.ani"), "m.ani"));
+    CHECK(!strcmp(path_basename("a.tar:y.ani"), "y.ani"));
+    CHECK(!strcmp(path_basename("dir/plain.ani"), "plain.ani"));
+}
+
+int main(void) {
+    char dir[] = "/tmp/ani-tar-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/a.tar", dir);
+    test_index(path);
+    unlink(path);
+    test_split(dir);
+    test_open_task(dir);
+    test_basename();
+    rmdir(dir);
+    return TEST_RESULT();
+}
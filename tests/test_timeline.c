@@ -0,0 +1,183 @@
+#include "test.h"
+#include "timeline.h"
+
+static AniTimeline *compile_buf(const Buf *b) {
+    FILE *f = buf_file(b);
+    AniFile *ani = parse_ani(f);
+    fclose(f);
+    AniTimeline *tl = ani ? compile_timeline(ani) : NULL;
+    if (ani) {
+        cleanup_ani(ani);
+    }
+    return tl;
+}
+
+// Frames keep their payload and offset in the file, lazy frames only the offset
+static void test_layout(void) {
+    const char a[] = "frame-a", b[] = "frame-bbb";
+    const void *frames[] = {a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b)};
+    Buf in = make_ani(frames, sizes, 2, NULL, NULL, 2, 6);
+    for (char lazy = 0; lazy < 2; ++lazy) {
+        ParseOptions opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.lazy_frames = lazy;
+        FILE *f = buf_file(&in);
+        AniFile *ani = parse_ani_ex(f, &opts);
+        fclose(f);
+        AniTimeline *tl = ani ? compile_timeline(ani) : NULL;
+        CHECK(tl != NULL);
+        if (tl) {
+            CHECK(tl->step_count == 2 && tl->frame_count == 2);
+            CHECK(tl->step_frame[0] == 0 && tl->step_frame[1] == 1);
+            CHECK(tl->step_start_us[0] == 0 && tl->step_start_us[2] == 200000);
+            for (unsigned i = 0; i < 2; ++i) {
+                const void *data = tl->frame_data[i];
+                CHECK(tl->frame_size[i] == sizes[i]);
+                CHECK(!memcmp(in.data + tl->frame_off[i], frames[i], sizes[i]));
+                CHECK(lazy ? !data : data && !memcmp(data, frames[i], sizes[i]));
+            }
+            cleanup_timeline(tl);
+        }
+        if (ani) {
+            cleanup_ani(ani);
+        }
+    }
+    buf_free(&in);
+}
+
+// Steps follow seq and rate, a zero length step is never shown and times loop
+static void test_at(void) {
+    const char a[] = "frame-a", b[] = "frame-b";
+    const void *frames[] = {a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b)};
+    unsigned seq[] = {1, 0, 1};
+    uint32_t rate[] = {6, 3, 0};
+    Buf in = make_ani(frames, sizes, 2, seq, rate, 3, 0);
+    AniTimeline *tl = compile_buf(&in);
+    CHECK(tl != NULL);
+    if (!tl) {
+        buf_free(&in);
+        return;
+    }
+    CHECK(tl->step_count == 3 && tl->frame_count == 2);
+    CHECK(tl->step_start_us[1] == 100000 && tl->step_start_us[3] == 150000);
+
+    TimelinePos pos;
+    CHECK(timeline_at(tl, 0, &pos) == 0);
+    CHECK(pos.step == 0 && pos.frame == 1 && pos.next_change_us == 100000);
+    CHECK(timeline_at(tl, 99999, &pos) == 0 && pos.step == 0);
+    CHECK(timeline_at(tl, 100000, &pos) == 0);
+    CHECK(pos.step == 1 && pos.frame == 0 && pos.next_change_us == 150000);
+    CHECK(timeline_at(tl, 150000, &pos) == 0);
+    CHECK(pos.step == 0 && pos.next_change_us == 250000);
+    CHECK(timeline_at(tl, 1000 * 150000ULL + 120000, &pos) == 0);
+    CHECK(pos.step == 1 && pos.next_change_us == 1001 * 150000ULL);
+    CHECK(timeline_at(tl, UINT64_MAX, &pos) != 0);
+    cleanup_timeline(tl);
+    buf_free(&in);
+}
+
+// A step of one jiffy starts on the first microsecond it is shown, no rounding drifts over loops
+static void test_rounding(void) {
+    const char a[] = "frame-a", b[] = "frame-b";
+    const void *frames[] = {a, b};
+    size_t sizes[] = {sizeof(a), sizeof(b)};
+    Buf in = make_ani(frames, sizes, 2, NULL, NULL, 2, 1);
+    AniTimeline *tl = compile_buf(&in);
+    CHECK(tl != NULL);
+    if (!tl) {
+        buf_free(&in);
+        return;
+    }
+    TimelinePos pos;
+    CHECK(timeline_at(tl, 16666, &pos) == 0 && pos.step == 0 && pos.next_change_us == 16667);
+    CHECK(timeline_at(tl, 16667, &pos) == 0 && pos.step == 1 && pos.next_change_us == 33334);
+    // 3 loops are 6 jiffies, exactly 100000 us
+    CHECK(timeline_at(tl, 99999, &pos) == 0 && pos.step == 1 && pos.next_change_us == 100000);
+    CHECK(timeline_at(tl, 100000, &pos) == 0 && pos.step == 0);
+    cleanup_timeline(tl);
+    buf_free(&in);
+}
+
+// A cursor answers like the binary search, whether it walks forward, wraps or jumps back
+static void test_cursor(void) {
+    const char a[] = "frame-a", b[] = "frame-b", c[] = "frame-c";
+    const void *frames[] = {a, b, c};
+    size_t sizes[] = {sizeof(a), sizeof(b), sizeof(c)};
+    unsigned seq[] = {0, 1, 2, 1, 0, 2};
+    uint32_t rate[] = {1, 4, 0, 7, 2, 5};
+    Buf in = make_ani(frames, sizes, 3, seq, rate, 6, 3);
+    AniTimeline *tl = compile_buf(&in);
+    CHECK(tl != NULL);
+    if (!tl) {
+        buf_free(&in);
+        return;
+    }
+    TimelineCursor cursor;
+    timeline_cursor_init(&cursor, tl);
+    uint64_t times[] = {0, 5000, 17000, 90000, 400000, 410000, 30000, 30000, 5000000, 5016667};
+    for (unsigned i = 0; i < sizeof(times) / sizeof(times[0]); ++i) {
+        TimelinePos want, got;
+        CHECK(timeline_at(tl, times[i], &want) == 0);
+        CHECK(timeline_cursor_at(&cursor, times[i], &got) == 0);
+        CHECK(want.step == got.step && want.frame == got.frame);
+        CHECK(want.next_change_us == got.next_change_us);
+    }
+    for (uint64_t t = 0; t < 2000000; t += 1234) {
+        TimelinePos want, got;
+        CHECK(timeline_at(tl, t, &want) == 0);
+        CHECK(timeline_cursor_at(&cursor, t, &got) == 0);
+        CHECK(want.step == got.step && want.next_change_us == got.next_change_us);
+    }
+    cleanup_timeline(tl);
+    buf_free(&in);
+}
+
+// Without any duration the first step stays forever
+static void test_still(void) {
+    const char a[] = "frame-a";
+    const void *frames[] = {a};
+    size_t sizes[] = {sizeof(a)};
+    Buf in = make_ani(frames, sizes, 1, NULL, NULL, 1, 0);
+    AniTimeline *tl = compile_buf(&in);
+    CHECK(tl != NULL);
+    if (tl) {
+        TimelinePos pos;
+        CHECK(timeline_at(tl, 123456, &pos) == 0);
+        CHECK(pos.step == 0 && pos.next_change_us == UINT64_MAX);
+        cleanup_timeline(tl);
+    }
+    buf_free(&in);
+}
+
+// A loop whose ticks could overflow and a step of a missing frame are rejected
+static void test_reject(void) {
+    const char a[] = "frame-a";
+    const void *frames[] = {a};
+    size_t sizes[] = {sizeof(a)};
+    enum { STEPS = 1100 };
+    static unsigned seq[STEPS];
+    static uint32_t rate[STEPS];
+    for (unsigned i = 0; i < STEPS; ++i) {
+        rate[i] = UINT32_MAX;
+    }
+    Buf in = make_ani(frames, sizes, 1, seq, rate, STEPS, 1);
+    CHECK(compile_buf(&in) == NULL);
+    buf_free(&in);
+
+    unsigned missing[] = {0, 1};
+    in = make_ani(frames, sizes, 1, missing, NULL, 2, 1);
+    CHECK(compile_buf(&in) == NULL);
+    buf_free(&in);
+}
+
+int main(void) {
+    test_layout();
+    test_at();
+    test_rounding();
+    test_cursor();
+    test_still();
+    test_reject();
+    return TEST_RESULT();
+}
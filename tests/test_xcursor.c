@@ -0,0 +1,104 @@
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "test.h"
+#include "ico.h"
+#include "decode.h"
+#include "xcursor.h"
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Decoded image of the entry of `ico` that is `size` px
+static int decode_entry(const Buf *ico, uint32_t size, Image *out) {
+    IcoDir dir;
+    if (parse_ico_dir(ico->data, ico->size, &dir) != 0) {
+        return 1;
+    }
+    int res = 1;
+    for (unsigned i = 0; i < dir.count; ++i) {
+        if (dir.entries[i].width == size) {
+            res = decode_image(ico->data + dir.entries[i].offset, dir.entries[i].size, out);
+            break;
+        }
+    }
+    cleanup_ico_dir(&dir);
+    return res;
+}
+
+// Every step is written in every size of the first frame, sizes ascending, with its delay,
+// the hotspot of its entry and the decoded pixels
+static void test_write(const char *path) {
+    uint32_t sizes[] = {32, 16};
+    Buf icos[2] = {make_ico(sizes, 2, 4, 6, 1), make_ico(sizes, 2, 4, 6, 2)};
+    XcursorSource steps[2] = {{icos[0].data, icos[0].size, 50}, {icos[1].data, icos[1].size, 120}};
+    XcursorOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.cx = opts.cy = 32;
+    opts.jobs = 2;
+    CHECK(write_xcursor(path, steps, 2, &opts) == 0);
+
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    if (!f) {
+        return;
+    }
+    Buf out = file_buf(f);
+    fclose(f);
+    CHECK(out.size > 16 && le32(out.data) == 0x72756358 && le32(out.data + 12) == 4);
+    uint32_t want_size[4] = {16, 16, 32, 32};
+    for (unsigned i = 0; out.size > 16 + 4 * 12 && i < 4; ++i) {
+        const uint8_t *toc = out.data + 16 + i * 12;
+        CHECK(le32(toc + 4) == want_size[i]);
+        uint32_t pos = le32(toc + 8);
+        CHECK(pos + 36 <= out.size);
+        if (pos + 36 > out.size) {
+            continue;
+        }
+        const uint8_t *img = out.data + pos;
+        uint32_t w = le32(img + 16), h = le32(img + 20);
+        CHECK(w == want_size[i] && h == want_size[i]);
+        CHECK(le32(img + 24) == 4 && le32(img + 28) == 6);
+        CHECK(le32(img + 32) == (i % 2 ? 120 : 50));
+        Image want;
+        CHECK(decode_entry(&icos[i % 2], want_size[i], &want) == 0);
+        CHECK(pos + 36 + w * h * 4 <= out.size);
+        for (uint32_t k = 0; pos + 36 + w * h * 4 <= out.size && k < w * h; ++k) {
+            if (le32(img + 36 + k * 4) != want.pixels[k]) {
+                CHECK(!"pixel differs");
+                break;
+            }
+        }
+        cleanup_image(&want);
+    }
+    buf_free(&out);
+
+    // `size` keeps the closest entry only
+    opts.size = 20;
+    CHECK(write_xcursor(path, steps, 2, &opts) == 0);
+    f = fopen(path, "rb");
+    CHECK(f != NULL);
+    if (f) {
+        out = file_buf(f);
+        fclose(f);
+        CHECK(out.size > 16 + 2 * 12 && le32(out.data + 12) == 2 && le32(out.data + 20) == 32);
+        buf_free(&out);
+    }
+    buf_free(&icos[0]);
+    buf_free(&icos[1]);
+}
+
+int main(void) {
+    char dir[] = "/tmp/ani-xcursor-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/x", dir);
+    test_write(path);
+    unlink(path);
+    rmdir(dir);
+    return TEST_RESULT();
+}
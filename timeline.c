@@ -0,0 +1,207 @@
+#include <stdlib.h>
+
+#include "timeline.h"
+#include "debug.h"
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+// Queries compare in ticks of 1/60 us, where both a jiffy (1000000 ticks) and a microsecond (60
+// ticks) are whole numbers, so no rounding accumulates over loops
+#define TICKS_PER_JIF 1000000
+#define TICKS_PER_US 60
+
+// Longest loop and latest time queries accept. Ticks of a time plus one loop stay below
+// 2^64, so no computation in ticks overflows. The loop limit is still over 2000 years
+#define MAX_LOOP_JIF (UINT64_MAX / TICKS_PER_JIF / 4)
+#define MAX_TIME_US (UINT64_MAX / TICKS_PER_US / 2)
+
+// Steps a cursor walks before it rather searches
+#define CURSOR_MAX_WALK 8
+
+AniTimeline *compile_timeline(const AniFile *ani) {
+    const ChunkAnih *anih = NULL;
+    const ChunkSeq *seq = NULL;
+    const ChunkRate *rate = NULL;
+    const ChunkList *list = NULL;
+    for (unsigned i = 0; i < ani->chunk_count; ++i) {
+        const Chunk *c = ani->chunks[i];
+        switch (c->ty) {
+            case ty_anih: anih = anih ? anih : c->inner; break;
+            case ty_seq: seq = seq ? seq : c->inner; break;
+            case ty_rate: rate = rate ? rate : c->inner; break;
+            case ty_list: list = list ? list : c->inner; break;
+            default: break;
+        }
+    }
+    if (!anih || !list) {
+        err("No anih or frame list to compile timeline");
+        return NULL;
+    }
+    unsigned steps = seq ? seq->count : list->count;
+    unsigned frames = list->count;
+
+    // 8 byte arrays first, so every array is naturally aligned
+    size_t size = ALIGN8(sizeof(AniTimeline));
+    size_t start_jif_off = size;
+    size += (steps + 1) * sizeof(uint64_t);
+    size_t start_off = size;
+    size += (steps + 1) * sizeof(uint64_t);
+    size_t off_off = size;
+    size += frames * sizeof(int64_t);
+    size_t data_off = size;
+    size += frames * sizeof(void *);
+    size_t step_frame_off = size;
+    size += steps * sizeof(uint32_t);
+    size_t frame_size_off = size;
+    size += frames * sizeof(uint32_t);
+
+    char *mem = malloc(size);
+    if (!mem) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    AniTimeline *tl = (AniTimeline *)mem;
+    tl->step_count = steps;
+    tl->frame_count = frames;
+    tl->cx = anih->cx;
+    tl->cy = anih->cy;
+    tl->hotx = list->hotx;
+    tl->hoty = list->hoty;
+    tl->step_start_jif = (uint64_t *)(mem + start_jif_off);
+    tl->step_start_us = (uint64_t *)(mem + start_off);
+    tl->frame_off = (int64_t *)(mem + off_off);
+    tl->frame_data = (const void **)(mem + data_off);
+    tl->step_frame = (uint32_t *)(mem + step_frame_off);
+    tl->frame_size = (uint32_t *)(mem + frame_size_off);
+
+    for (unsigned i = 0; i < frames; ++i) {
+        tl->frame_off[i] = list->frames[i]->off;
+        tl->frame_size[i] = list->frames[i]->size;
+        tl->frame_data[i] = list->frames[i]->buffer;
+    }
+    // Start time is derived from accumulated jiffies, so it never drifts
+    uint64_t jiffies = 0;
+    for (unsigned i = 0; i < steps; ++i) {
+        uint32_t frame = seq ? seq->indexes[i] : i;
+        if (frame >= frames) {
+            err("Step `%u` refers to missing frame `%u`", i, frame);
+            free(mem);
+            return NULL;
+        }
+        tl->step_frame[i] = frame;
+        tl->step_start_jif[i] = jiffies;
+        tl->step_start_us[i] = jiffies * 1000000 / 60;
+        uint32_t duration = rate && i < rate->count ? rate->jiffies[i] : 0;
+        jiffies += duration ? duration : anih->jifRate;
+        if (jiffies > MAX_LOOP_JIF) {
+            err("Loop of %llu jiffies is too long", (unsigned long long)jiffies);
+            free(mem);
+            return NULL;
+        }
+    }
+    tl->step_start_jif[steps] = jiffies;
+    tl->step_start_us[steps] = jiffies * 1000000 / 60;
+    return tl;
+}
+
+void cleanup_timeline(AniTimeline *tl) {
+    free(tl);
+}
+
+// Absolute time of a step start, rounded up to the first microsecond it is shown
+static uint64_t start_us(const AniTimeline *tl, uint64_t loop, unsigned step) {
+    uint64_t ticks = (loop * tl->step_start_jif[tl->step_count] + tl->step_start_jif[step]) *
+                     TICKS_PER_JIF;
+    return (ticks + TICKS_PER_US - 1) / TICKS_PER_US;
+}
+
+static int fill_pos(const AniTimeline *tl, uint64_t loop, unsigned step, TimelinePos *pos) {
+    pos->step = step;
+    pos->frame = tl->step_frame[step];
+    pos->next_change_us = step + 1 < tl->step_count ? start_us(tl, loop, step + 1)
+                                                    : start_us(tl, loop + 1, 0);
+    return 0;
+}
+
+// Split a time into its loop and the ticks into that loop
+static int locate(const AniTimeline *tl, uint64_t t_us, uint64_t *loop, uint64_t *ticks) {
+    if (!tl->step_count) {
+        err("Timeline has no step");
+        return 1;
+    }
+    if (t_us > MAX_TIME_US) {
+        err("Time %llu us is out of range", (unsigned long long)t_us);
+        return 1;
+    }
+    uint64_t loop_ticks = tl->step_start_jif[tl->step_count] * TICKS_PER_JIF;
+    uint64_t t = t_us * TICKS_PER_US;
+    *loop = loop_ticks ? t / loop_ticks : 0;
+    *ticks = loop_ticks ? t % loop_ticks : 0;
+    return 0;
+}
+
+int timeline_at(const AniTimeline *tl, uint64_t t_us, TimelinePos *pos) {
+    uint64_t loop, ticks;
+    if (locate(tl, t_us, &loop, &ticks) != 0) {
+        return 1;
+    }
+    if (!tl->step_start_jif[tl->step_count]) {
+        // Nothing ever advances, the first step stays
+        pos->step = 0;
+        pos->frame = tl->step_frame[0];
+        pos->next_change_us = UINT64_MAX;
+        return 0;
+    }
+    // Last step starting at or before `ticks`, zero length steps are skipped over
+    unsigned lo = 0, hi = tl->step_count;
+    while (hi - lo > 1) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (tl->step_start_jif[mid] * TICKS_PER_JIF <= ticks) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return fill_pos(tl, loop, lo, pos);
+}
+
+void timeline_cursor_init(TimelineCursor *cursor, const AniTimeline *tl) {
+    cursor->tl = tl;
+    cursor->loop = 0;
+    cursor->step = 0;
+}
+
+int timeline_cursor_at(TimelineCursor *cursor, uint64_t t_us, TimelinePos *pos) {
+    const AniTimeline *tl = cursor->tl;
+    uint64_t loop, ticks;
+    if (locate(tl, t_us, &loop, &ticks) != 0) {
+        return 1;
+    }
+    if (!tl->step_start_jif[tl->step_count]) {
+        return timeline_at(tl, t_us, pos);
+    }
+    // A preview advances a step or two per query, so walk from the last step, or from the start
+    // of the next loop. Jumps back or far ahead fall back to the binary search
+    unsigned step = loop == cursor->loop + 1 ? 0 : cursor->step;
+    unsigned walked = 0;
+    if ((loop != cursor->loop && loop != cursor->loop + 1) || step >= tl->step_count ||
+        tl->step_start_jif[step] * TICKS_PER_JIF > ticks) {
+        walked = CURSOR_MAX_WALK;
+    }
+    while (walked < CURSOR_MAX_WALK && step + 1 < tl->step_count &&
+           tl->step_start_jif[step + 1] * TICKS_PER_JIF <= ticks) {
+        ++step;
+        ++walked;
+    }
+    if (walked == CURSOR_MAX_WALK) {
+        if (timeline_at(tl, t_us, pos) != 0) {
+            return 1;
+        }
+        cursor->loop = loop;
+        cursor->step = pos->step;
+        return 0;
+    }
+    cursor->loop = loop;
+    cursor->step = step;
+    return fill_pos(tl, loop, step, pos);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ani.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Flat view of an animation, built in one pass and owned by a single allocation.
+// Arrays are indexed by step or by frame, steps refer to frames through `step_frame`
+typedef struct {
+    unsigned step_count;
+    unsigned frame_count;
+    uint32_t cx;
+    uint32_t cy;
+    uint32_t hotx;
+    uint32_t hoty;
+    uint64_t *step_start_jif;  // prefix sums of step durations, step_count + 1 entries
+    uint64_t *step_start_us;   // step_count + 1 entries, the last one is the loop length
+    uint32_t *step_frame;      // frame shown by every step
+    int64_t *frame_off;        // offset of frame payload in source file
+    uint32_t *frame_size;      // size of frame payload
+    const void **frame_data;   // NULL if the file was parsed with `lazy_frames`
+} AniTimeline;
+
+// What is shown at a point of the playback, times are since playback started
+typedef struct {
+    unsigned step;
+    uint32_t frame;
+    uint64_t next_change_us;  // UINT64_MAX if the animation never changes
+} TimelinePos;
+
+// Per playback state over a shared timeline, makes advancing queries O(1)
+typedef struct {
+    const AniTimeline *tl;
+    uint64_t loop;  // loop of the last query
+    unsigned step;  // step of the last query
+} TimelineCursor;
+
+AniTimeline *compile_timeline(const AniFile *ani);
+
+void cleanup_timeline(AniTimeline *tl);
+
+// Step shown at `t_us`, loops forever. Binary search over the step starts
+int timeline_at(const AniTimeline *tl, uint64_t t_us, TimelinePos *pos);
+
+void timeline_cursor_init(TimelineCursor *cursor, const AniTimeline *tl);
+
+// Same as `timeline_at`, but walks from the previous query when `t_us` did not go back far
+int timeline_cursor_at(TimelineCursor *cursor, uint64_t t_us, TimelinePos *pos);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+#include "debug.h"
+
+// Quiet period after the last event of a file before it is extracted
+#define DEBOUNCE_MS 300
+
+#define WATCH_MASK \
+    (IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+    char *path;
+    uint64_t hash;  // content hash of the last extracted version
+} SeenFile;
+
+typedef struct {
+    char *path;
+    long long due_ms;
+} PendingFile;
+
+typedef struct {
+    GlobalContext *ctx;
+    int fd;
+    char **wd_paths;  // indexed by watch descriptor
+    unsigned wd_cap;
+    SeenFile *seen;
+    unsigned seen_count;
+    unsigned seen_cap;
+    PendingFile *pending;
+    unsigned pending_count;
+    unsigned pending_cap;
+    StringBuilder *out;
+} Watcher;
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a
+static uint64_t hash_bytes(const void *buf, size_t n) {
+    const uint8_t *p = buf;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void add_watch(const char *dir, void *data) {
+    Watcher *w = data;
+    int wd = inotify_add_watch(w->fd, dir, WATCH_MASK);
+    if (wd < 0) {
+        err("Cannot watch `%s`: %s", dir, strerror(errno));
+        return;
+    }
+    if ((unsigned)wd >= w->wd_cap) {
+        unsigned cap = w->wd_cap ? w->wd_cap : 16;
+        while (cap <= (unsigned)wd) {
+            cap <<= 1;
+        }
+        char **tmp = realloc(w->wd_paths, cap * sizeof(char *));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return;
+        }
+        memset(tmp + w->wd_cap, 0, (cap - w->wd_cap) * sizeof(char *));
+        w->wd_paths = tmp;
+        w->wd_cap = cap;
+    }
+    free(w->wd_paths[wd]);
+    w->wd_paths[wd] = strdup(dir);
+    debug("Watching `%s`", dir);
+}
+
+// Stop watching a dir and the dirs below it, their paths are no longer valid
+static void drop_watches(Watcher *w, const char *dir) {
+    size_t len = strlen(dir);
+    for (unsigned wd = 0; wd < w->wd_cap; ++wd) {
+        const char *path = w->wd_paths[wd];
+        if (path && !strncmp(path, dir, len) && (path[len] == '\0' || path[len] == '/')) {
+            debug("Stop watching `%s`", path);
+            inotify_rm_watch(w->fd, wd);
+            free(w->wd_paths[wd]);
+            w->wd_paths[wd] = NULL;
+        }
+    }
+}
+
+// Queue a file, an already queued file has its deadline pushed back
+static void add_pending(const char *path, void *data) {
+    Watcher *w = data;
+    long long due = now_ms() + DEBOUNCE_MS;
+    for (unsigned i = 0; i < w->pending_count; ++i) {
+        if (!strcmp(w->pending[i].path, path)) {
+            w->pending[i].due_ms = due;
+            return;
+        }
+    }
+    if (w->pending_count + 1 > w->pending_cap) {
+        unsigned cap = w->pending_cap ? w->pending_cap << 1 : 16;
+        PendingFile *tmp = realloc(w->pending, cap * sizeof(PendingFile));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return;
+        }
+        w->pending = tmp;
+        w->pending_cap = cap;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return;
+    }
+    w->pending[w->pending_count].path = copy;
+    w->pending[w->pending_count].due_ms = due;
+    w->pending_count++;
+}
+
+static SeenFile *find_seen(Watcher *w, const char *path) {
+    for (unsigned i = 0; i < w->seen_count; ++i) {
+        if (!strcmp(w->seen[i].path, path)) {
+            return &w->seen[i];
+        }
+    }
+    if (w->seen_count + 1 > w->seen_cap) {
+        unsigned cap = w->seen_cap ? w->seen_cap << 1 : 16;
+        SeenFile *tmp = realloc(w->seen, cap * sizeof(SeenFile));
+        if (!tmp) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return NULL;
+        }
+        w->seen = tmp;
+        w->seen_cap = cap;
+    }
+    SeenFile *seen = &w->seen[w->seen_count];
+    seen->path = strdup(path);
+    if (!seen->path) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return NULL;
+    }
+    seen->hash = 0;
+    w->seen_count++;
+    return seen;
+}
+
+// Extract a file unless its content is what was extracted last time
+static void extract_if_changed(Watcher *w, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        debug("`%s` is gone", path);
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size == 0) {
+        // Likely created and not written yet, its close will queue it again
+        debug("`%s` is empty, skip", path);
+        fclose(file);
+        return;
+    }
+    uint8_t *buf = size > 0 ? malloc(size) : NULL;
+    if (!buf || fread(buf, 1, size, file) != (size_t)size) {
+        err("Cannot read `%s`", path);
+        free(buf);
+        fclose(file);
+        return;
+    }
+    fclose(file);
+
+    uint64_t hash = hash_bytes(buf, size);
+    SeenFile *seen = find_seen(w, path);
+    if (seen && seen->hash == hash) {
+        debug("`%s` is unchanged, skip", path);
+        free(buf);
+        return;
+    }
+    // Parse the bytes that were hashed, not whatever is on disk by now
+    FILE *target = fmemopen(buf, size, "rb");
+    if (!target) {
+        err("Cannot open `%s` from memory", path);
+        free(buf);
+        return;
+    }
+    sb_reset(w->out);
+    if (process_file(w->ctx, target, path, w->out) == 0 && seen) {
+        seen->hash = hash;
+    }
+    fputs(w->out->data, stdout);
+    fflush(stdout);
+    fclose(target);
+    free(buf);
+}
+
+static void handle_events(Watcher *w) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(w->fd, buf, sizeof(buf));
+    if (len <= 0) {
+        return;
+    }
+    for (char *p = buf; p < buf + len;) {
+        const struct inotify_event *ev = (const struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) {
+            // Events are lost, unchanged files are skipped by their hash
+            warn("inotify queue overflowed, rescan `%s`", w->ctx->watch_path);
+            scan_dir(w->ctx->watch_path, add_pending, add_watch, w);
+            continue;
+        }
+        if (ev->wd < 0 || (unsigned)ev->wd >= w->wd_cap || !w->wd_paths[ev->wd]) {
+            continue;
+        }
+        if (ev->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+            free(w->wd_paths[ev->wd]);
+            w->wd_paths[ev->wd] = NULL;
+            continue;
+        }
+        if (ev->mask & IN_MOVE_SELF) {
+            // Moved out of the tree, a move inside it is seen as IN_MOVED_FROM first
+            char *moved = w->wd_paths[ev->wd];
+            w->wd_paths[ev->wd] = NULL;
+            inotify_rm_watch(w->fd, ev->wd);
+            drop_watches(w, moved);
+            free(moved);
+            continue;
+        }
+        if (!ev->len) {
+            continue;
+        }
+        const char *dir = w->wd_paths[ev->wd];
+        char *path = malloc(strlen(dir) + strlen(ev->name) + 2);
+        if (!path) {
+            err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+            return;
+        }
+        sprintf(path, "%s/%s", dir, ev->name);
+        if (ev->mask & IN_ISDIR) {
+            if (ev->mask & IN_MOVED_FROM) {
+                drop_watches(w, path);
+            } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                // Files may have landed before the watch, pick them up too
+                scan_dir(path, add_pending, add_watch, w);
+            }
+        } else if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_ani_path(path)) {
+            debug("`%s` changed", path);
+            add_pending(path, w);
+        }
+        free(path);
+    }
+}
+
+// Extract everything under the watched dir, then extract files as they are written or moved in
+int watch(const GlobalContext *ctx) {
+    Watcher w;
+    memset(&w, 0, sizeof(w));
+    w.ctx = malloc(sizeof(GlobalContext));
+    w.out = sb_new();
+    if (!w.ctx || !w.out) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        free(w.ctx);
+        sb_cleanup(w.out);
+        return 1;
+    }
+    memcpy(w.ctx, ctx, sizeof(GlobalContext));
+    w.ctx->mode = Extract;
+    w.fd = inotify_init1(IN_CLOEXEC);
+    if (w.fd < 0) {
+        err("Cannot init inotify: %s", strerror(errno));
+        free(w.ctx);
+        sb_cleanup(w.out);
+        return 1;
+    }
+    // Watches are in place before the first scan, nothing written meanwhile is missed
+    if (scan_dir(ctx->watch_path, add_pending, add_watch, &w)) {
+        close(w.fd);
+        free(w.ctx);
+        sb_cleanup(w.out);
+        return 1;
+    }
+    for (unsigned i = 0; i < w.pending_count; ++i) {
+        w.pending[i].due_ms = 0;
+    }
+
+    while (1) {
+        long long now = now_ms();
+        int timeout = -1;
+        for (unsigned i = 0; i < w.pending_count;) {
+            if (w.pending[i].due_ms <= now) {
+                char *path = w.pending[i].path;
+                w.pending[i] = w.pending[--w.pending_count];
+                extract_if_changed(&w, path);
+                free(path);
+                continue;
+            }
+            int left = w.pending[i].due_ms - now;
+            if (timeout < 0 || left < timeout) {
+                timeout = left;
+            }
+            ++i;
+        }
+        struct pollfd pfd = {w.fd, POLLIN, 0};
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0 && errno != EINTR) {
+            err("poll fail: %s", strerror(errno));
+            break;
+        }
+        if (n > 0) {
+            handle_events(&w);
+        }
+    }
+
+    close(w.fd);
+    for (unsigned i = 0; i < w.wd_cap; ++i) {
+        free(w.wd_paths[i]);
+    }
+    for (unsigned i = 0; i < w.seen_count; ++i) {
+        free(w.seen[i].path);
+    }
+    for (unsigned i = 0; i < w.pending_count; ++i) {
+        free(w.pending[i].path);
+    }
+    free(w.wd_paths);
+    free(w.seen);
+    free(w.pending);
+    free(w.ctx);
+    sb_cleanup(w.out);
+    return 1;
+}
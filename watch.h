@@ -0,0 +1,5 @@
+#pragma once
+
+#include "task.h"
+
+int watch(const GlobalContext *ctx);
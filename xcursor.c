@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "xcursor.h"
+#include "decode.h"
+#include "scale.h"
+#include "ico.h"
+#include "task.h"
+#include "debug.h"
+
+#define XCURSOR_MAGIC 0x72756358  // "Xcur"
+#define XCURSOR_VERSION 0x10000
+#define XCURSOR_HEADER_SIZE 16
+#define XCURSOR_TOC_SIZE 12
+#define XCURSOR_IMAGE_TYPE 0xfffd0002
+#define XCURSOR_IMAGE_HEADER_SIZE 36
+#define XCURSOR_IMAGE_VERSION 1
+#define XCURSOR_MAX_DIM 0x7fff
+#define MAX_SIZES 256
+
+typedef struct {
+    unsigned step;
+    uint32_t nominal;
+    Image image;
+    uint32_t xhot, yhot;
+    uint32_t delay;
+    char ok;
+} XcursorImage;
+
+typedef struct {
+    const XcursorSource *steps;
+    const XcursorOptions *opts;
+    const uint32_t *sizes;
+    unsigned size_count;
+    XcursorImage *images;  // size major, `count` steps per size
+    unsigned count;
+    unsigned next;  // next step to decode, shared by the workers
+} DecodeJob;
+
+static int copy_image(const Image *src, Image *dst) {
+    size_t n = (size_t)src->width * src->height * sizeof(uint32_t);
+    dst->pixels = malloc(n ? n : 1);
+    if (!dst->pixels) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    memcpy(dst->pixels, src->pixels, n);
+    dst->width = src->width;
+    dst->height = src->height;
+    return 0;
+}
+
+// Decode a step once per distinct source entry, then derive every nominal size from it
+static void decode_step(const DecodeJob *job, unsigned step) {
+    const XcursorSource *src = &job->steps[step];
+    const XcursorOptions *opts = job->opts;
+    IcoDir dir;
+    size_t dir_size = src->ico_size >= ICO_HEADER_SIZE ? ico_dir_size(src->ico) : 0;
+    if (!dir_size || parse_ico_dir(src->ico, src->ico_size, &dir) != 0) {
+        err("Step `%u` is not an ICO", step);
+        return;
+    }
+    Image decoded = {0, 0, NULL};
+    uint32_t xhot = 0, yhot = 0;
+    int decoded_idx = -1;
+    for (unsigned s = 0; s < job->size_count; ++s) {
+        XcursorImage *img = &job->images[s * job->count + step];
+        int idx = select_ico_entry(&dir, img->nominal);
+        const IcoEntry *e = idx >= 0 ? &dir.entries[idx] : NULL;
+        if (!e || e->offset > src->ico_size || e->size > src->ico_size - e->offset) {
+            err("No usable entry of size %u in step `%u`", img->nominal, step);
+            continue;
+        }
+        if (idx != decoded_idx) {
+            cleanup_image(&decoded);
+            decoded_idx = -1;
+            if (decode_image(src->ico + e->offset, e->size, &decoded) != 0) {
+                continue;
+            }
+            decoded_idx = idx;
+            if (dir.type == 2) {
+                xhot = e->planes;
+                yhot = e->bit_count;
+            } else {
+                xhot = scale_hotspot(opts->hotx, opts->cx, decoded.width);
+                yhot = scale_hotspot(opts->hoty, opts->cy, decoded.height);
+            }
+        }
+
+        int res;
+        // A step without an entry of the nominal size has its closest entry resampled to it
+        if (decoded.width != img->nominal) {
+            uint32_t height = ((uint64_t)decoded.height * img->nominal + decoded.width / 2) /
+                              decoded.width;
+            height = height ? height : 1;
+            res = scale_image(&decoded, img->nominal, height, opts->filter, &img->image);
+            img->xhot = scale_hotspot(xhot, decoded.width, img->nominal);
+            img->yhot = scale_hotspot(yhot, decoded.height, height);
+        } else {
+            res = copy_image(&decoded, &img->image);
+            img->xhot = xhot;
+            img->yhot = yhot;
+        }
+        if (res != 0) {
+            continue;
+        }
+        if (img->xhot >= img->image.width) {
+            img->xhot = img->image.width - 1;
+        }
+        if (img->yhot >= img->image.height) {
+            img->yhot = img->image.height - 1;
+        }
+        img->ok = img->image.width <= XCURSOR_MAX_DIM && img->image.height <= XCURSOR_MAX_DIM;
+    }
+    cleanup_image(&decoded);
+    cleanup_ico_dir(&dir);
+}
+
+static void *decode_worker(void *arg) {
+    DecodeJob *job = arg;
+    unsigned i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        decode_step(job, i);
+    }
+    return NULL;
+}
+
+static unsigned insert_size(uint32_t sizes[MAX_SIZES], unsigned n, uint32_t size) {
+    unsigned j = n;
+    while (j && sizes[j - 1] > size) {
+        --j;
+    }
+    if ((j && sizes[j - 1] == size) || n == MAX_SIZES) {
+        return n;
+    }
+    memmove(sizes + j + 1, sizes + j, (n - j) * sizeof(uint32_t));
+    sizes[j] = size;
+    return n + 1;
+}
+
+// Nominal sizes are the entry widths of the first step, ascending. With scales they are the
+// selected, or the largest, entry width times each scale
+static unsigned collect_sizes(const XcursorSource *step,
+                              const XcursorOptions *opts,
+                              uint32_t sizes[MAX_SIZES]) {
+    IcoDir dir;
+    if (step->ico_size < ICO_HEADER_SIZE || !ico_dir_size(step->ico) ||
+        parse_ico_dir(step->ico, step->ico_size, &dir) != 0) {
+        return 0;
+    }
+    unsigned n = 0;
+    if (opts->scale_count) {
+        int idx = select_ico_entry(&dir, opts->size);
+        for (unsigned i = 0; idx >= 0 && i < opts->scale_count; ++i) {
+            uint32_t size = dir.entries[idx].width * opts->scales[i] + 0.5f;
+            if (size && size <= XCURSOR_MAX_DIM) {
+                n = insert_size(sizes, n, size);
+            }
+        }
+    } else if (opts->size || opts->best) {
+        int idx = select_ico_entry(&dir, opts->size);
+        if (idx >= 0) {
+            sizes[n++] = dir.entries[idx].width;
+        }
+    } else {
+        for (unsigned i = 0; i < dir.count; ++i) {
+            n = insert_size(sizes, n, dir.entries[i].width);
+        }
+    }
+    cleanup_ico_dir(&dir);
+    return n;
+}
+
+static void put_u32(FILE *out, uint32_t v) {
+    uint8_t b[4] = {v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >> 24};
+    fwrite(b, 1, sizeof(b), out);
+}
+
+static int write_images(const char *path, const XcursorImage *images, unsigned count) {
+    if (create_parent_dir(path) != 0) {
+        return 1;
+    }
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        err("Failed to open %s: %s", path, strerror(errno));
+        return 1;
+    }
+    put_u32(out, XCURSOR_MAGIC);
+    put_u32(out, XCURSOR_HEADER_SIZE);
+    put_u32(out, XCURSOR_VERSION);
+    put_u32(out, count);
+    uint32_t pos = XCURSOR_HEADER_SIZE + count * XCURSOR_TOC_SIZE;
+    uint32_t max_width = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        if (images[i].image.width > max_width) {
+            max_width = images[i].image.width;
+        }
+    }
+    // Pixels are little endian u32 in the file
+    uint8_t *row = malloc(max_width * 4);
+    if (!row) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        fclose(out);
+        return 1;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        put_u32(out, XCURSOR_IMAGE_TYPE);
+        put_u32(out, images[i].nominal);
+        put_u32(out, pos);
+        pos += XCURSOR_IMAGE_HEADER_SIZE + images[i].image.width * images[i].image.height * 4;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        const XcursorImage *img = &images[i];
+        put_u32(out, XCURSOR_IMAGE_HEADER_SIZE);
+        put_u32(out, XCURSOR_IMAGE_TYPE);
+        put_u32(out, img->nominal);
+        put_u32(out, XCURSOR_IMAGE_VERSION);
+        put_u32(out, img->image.width);
+        put_u32(out, img->image.height);
+        put_u32(out, img->xhot);
+        put_u32(out, img->yhot);
+        put_u32(out, img->delay);
+        for (uint32_t y = 0; y < img->image.height; ++y) {
+            const uint32_t *src = img->image.pixels + (size_t)y * img->image.width;
+            for (uint32_t x = 0; x < img->image.width; ++x) {
+                row[x * 4] = src[x] & 0xFF;
+                row[x * 4 + 1] = (src[x] >> 8) & 0xFF;
+                row[x * 4 + 2] = (src[x] >> 16) & 0xFF;
+                row[x * 4 + 3] = src[x] >> 24;
+            }
+            fwrite(row, 4, img->image.width, out);
+        }
+    }
+    free(row);
+    int res = ferror(out) ? 1 : 0;
+    if (fclose(out) != 0 || res) {
+        err("Failed to write all bytes to %s", path);
+        return 1;
+    }
+    return 0;
+}
+
+int write_xcursor(const char *path,
+                  const XcursorSource *steps,
+                  unsigned count,
+                  const XcursorOptions *opts) {
+    uint32_t sizes[MAX_SIZES];
+    unsigned size_count = count ? collect_sizes(&steps[0], opts, sizes) : 0;
+    if (!size_count) {
+        err("No image to convert for %s", path);
+        return 1;
+    }
+
+    // Grouped by nominal size, steps in playback order within a size
+    DecodeJob job = {steps, opts, sizes, size_count, NULL, count, 0};
+    unsigned image_count = size_count * count;
+    job.images = calloc(image_count, sizeof(XcursorImage));
+    if (!job.images) {
+        err("OOM in function `%s`, line `%d`", __PRETTY_FUNCTION__, __LINE__);
+        return 1;
+    }
+    for (unsigned s = 0; s < size_count; ++s) {
+        for (unsigned i = 0; i < count; ++i) {
+            job.images[s * count + i].step = i;
+            job.images[s * count + i].nominal = sizes[s];
+        }
+    }
+
+    unsigned workers = opts->jobs < count ? opts->jobs : count;
+    pthread_t *threads = workers > 1 ? malloc(workers * sizeof(pthread_t)) : NULL;
+    unsigned started = 0;
+    while (threads && started < workers &&
+           pthread_create(&threads[started], NULL, decode_worker, &job) == 0) {
+        ++started;
+    }
+    // The calling thread decodes too, which also covers a failed pthread_create
+    decode_worker(&job);
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    int res = 0;
+    unsigned kept = 0;
+    for (unsigned i = 0; i < image_count; ++i) {
+        if (!job.images[i].ok) {
+            res = 1;
+            cleanup_image(&job.images[i].image);
+            continue;
+        }
+        job.images[i].delay = steps[job.images[i].step].delay;
+        job.images[kept++] = job.images[i];
+    }
+    if (kept) {
+        res |= write_images(path, job.images, kept);
+    }
+    for (unsigned i = 0; i < kept; ++i) {
+        cleanup_image(&job.images[i].image);
+    }
+    free(job.images);
+    return res;
+}
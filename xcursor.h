@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "scale.h"
+
+// One animation step, the whole ICO of its frame
+typedef struct {
+    const uint8_t *ico;
+    size_t ico_size;
+    uint32_t delay;  // ms
+} XcursorSource;
+
+typedef struct {
+    unsigned size;  // only the entry closest to this size, 0 for every size
+    char best;  // only the largest entry
+    uint32_t cx, cy;  // size the hotspot below refers to
+    uint32_t hotx, hoty;
+    const float *scales;  // sizes relative to the selected, or largest, entry
+    unsigned scale_count;  // 0 to keep the entry sizes unscaled
+    enum ScaleFilter filter;
+    unsigned jobs;  // decoding threads
+} XcursorOptions;
+
+// Decode every step in each nominal size found in the first frame, or scaled ones, and write them
+// as an Xcursor file. Entries of ICO cursors carry their own hotspot, icons use the scaled one of `opts`
+int write_xcursor(const char *path,
+                  const XcursorSource *steps,
+                  unsigned count,
+                  const XcursorOptions *opts);